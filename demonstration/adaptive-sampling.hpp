@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+    Decides how many latency samples the sim binary takes: instead of the fixed sampling_count of the model, samples are
+    taken until the confidence interval of the requested statistic is at most the target width, or the budget of
+    samples is used up.
+    Statistics:
+        mean  the mean latency of every flow (Student t interval), all flows must reach the target;
+        p99   the 99th percentile latency of every flow (distribution-free interval between order statistics, so it
+              needs a few hundred samples), all flows must reach the target;
+        max   the mean over samples of the largest latency over the flows in a sample (Student t interval).
+    A sample of a flow whose probe packet did not leave the network within the sampling steps (latency -1) is counted
+    as undelivered and not in the statistic.
+*/
+enum class SamplingStatistic { mean, p99, max };
+
+inline SamplingStatistic parse_sampling_statistic(const std::string& name) {
+    if (name == "mean") return SamplingStatistic::mean;
+    if (name == "p99") return SamplingStatistic::p99;
+    if (name == "max") return SamplingStatistic::max;
+    throw std::invalid_argument("Unknown sampling statistic (mean, p99 or max): " + name);
+}
+
+// Inverse of the standard normal distribution function (Abramowitz and Stegun 26.2.23, error below 4.5e-4).
+inline double normal_quantile(double p) {
+    const double q = p < 0.5 ? p : 1 - p;
+    const double t = std::sqrt(-2 * std::log(q));
+    const double z = t - (2.515517 + 0.802853 * t + 0.010328 * t * t) / (1 + 1.432788 * t + 0.189269 * t * t + 0.001308 * t * t * t);
+    return p < 0.5 ? -z : z;
+}
+
+// Half width of the two-sided confidence interval of a mean in standard errors: the quantile of the Student t
+// distribution with the given degrees of freedom (Cornish-Fisher expansion around the normal quantile).
+inline double student_t_quantile(double confidence, double freedom) {
+    const double z = normal_quantile(0.5 + confidence / 2);
+    return z + (z * z * z + z) / (4 * freedom) + (5 * std::pow(z, 5) + 16 * z * z * z + 3 * z) / (96 * freedom * freedom);
+}
+
+struct SamplingTarget {
+    SamplingStatistic statistic = SamplingStatistic::mean;
+    double half_width = 0;     // In steps, the interval is estimate +- half_width.
+    double confidence = 0.95;
+    int min_samples = 10;      // Before the first check, so the variance estimate means something.
+    int max_samples = 1000;    // The budget.
+};
+
+class SamplingController {
+public:
+    SamplingController(const SamplingTarget& target, int num_flows)
+        : target_(target), num_flows_(num_flows), series_(target.statistic == SamplingStatistic::max ? 1 : num_flows),
+          undelivered_(series_.size(), 0), z_(normal_quantile(0.5 + target.confidence / 2)) {
+        if (!(target.half_width > 0) || !(target.confidence > 0 && target.confidence < 1) || target.min_samples < 2 ||
+            target.max_samples < target.min_samples) {
+            throw std::invalid_argument("Invalid sampling target");
+        }
+    }
+
+    // The latencies of the flows in one sample.
+    void add(const int* latencies) {
+        samples_++;
+        if (target_.statistic == SamplingStatistic::max) {
+            const int* end = latencies + num_flows_;
+            if (std::find(latencies, end, -1) != end) {
+                undelivered_[0]++;
+            } else {
+                series_[0].add(*std::max_element(latencies, end));
+            }
+            return;
+        }
+        for (std::size_t flow = 0; flow < series_.size(); ++flow) {
+            if (latencies[flow] < 0) {
+                undelivered_[flow]++;
+            } else {
+                series_[flow].add(latencies[flow]);
+            }
+        }
+    }
+
+    [[nodiscard]] int samples() const { return samples_; }
+    [[nodiscard]] bool converged() const {
+        if (samples_ < target_.min_samples) return false;
+        return std::ranges::all_of(series_, [this](const auto& series) { return interval(series).half_width <= target_.half_width; });
+    }
+    // Whether to stop taking samples.
+    [[nodiscard]] bool done() const { return samples_ >= target_.max_samples || converged(); }
+
+    // {"statistic": ..., "confidence": ..., "target_half_width": ..., "samples": ..., "converged": ...,
+    //  "estimates": [{"value": ..., "half_width": ..., "samples": ..., "undelivered": ...}, ...]} on one line; the
+    // estimates are per flow, or one for the max statistic. An interval that cannot be computed yet has half width -1.
+    void write_json(std::ostream& out) const {
+        constexpr const char* NAMES[] = {"mean", "p99", "max"};
+        out << "{\"statistic\": \"" << NAMES[static_cast<int>(target_.statistic)] << "\", \"confidence\": " << target_.confidence
+            << ", \"target_half_width\": " << target_.half_width << ", \"samples\": " << samples_
+            << ", \"converged\": " << (converged() ? "true" : "false") << ", \"estimates\": [";
+        for (std::size_t series = 0; series < series_.size(); ++series) {
+            const auto estimate = interval(series_[series]);
+            out << (series == 0 ? "" : ", ") << "{\"value\": " << estimate.value << ", \"half_width\": "
+                << (std::isfinite(estimate.half_width) ? estimate.half_width : -1) << ", \"samples\": " << series_[series].count
+                << ", \"undelivered\": " << undelivered_[series] << "}";
+        }
+        out << "]}";
+    }
+
+private:
+    /*
+        The delivered latencies of a flow (or the max over flows), kept so that an interval costs no pass over the
+        samples: the running mean and sum of squared deviations (Welford) for the mean, and the count of every latency
+        (whole steps, at most the sampling steps) for the order statistics of p99.
+    */
+    struct Series {
+        long count = 0;
+        double mean = 0;
+        double squares = 0;
+        std::vector<long> counts;  // Per latency.
+
+        void add(int latency) {
+            count++;
+            const double delta = latency - mean;
+            mean += delta / static_cast<double>(count);
+            squares += delta * (latency - mean);
+            if (latency >= static_cast<int>(counts.size())) counts.resize(latency + 1, 0);
+            counts[latency]++;
+        }
+        // The latency of the given rank (from 1) in ascending order.
+        [[nodiscard]] int order_statistic(long rank) const {
+            long below = 0;
+            for (std::size_t latency = 0; latency < counts.size(); ++latency) {
+                below += counts[latency];
+                if (below >= rank) return static_cast<int>(latency);
+            }
+            return static_cast<int>(counts.size()) - 1;
+        }
+    };
+
+    struct Interval {
+        double value = 0;
+        double half_width = std::numeric_limits<double>::infinity();
+    };
+
+    [[nodiscard]] Interval interval(const Series& series) const {
+        const auto n = static_cast<double>(series.count);
+        Interval result;
+        if (series.count < 2) return result;
+        if (target_.statistic == SamplingStatistic::p99) {
+            // Ranks of the order statistics bounding the quantile, from the normal approximation of the binomial.
+            constexpr double p = 0.99;
+            const double spread = z_ * std::sqrt(n * p * (1 - p));
+            const auto lower = static_cast<long>(std::floor(n * p - spread));
+            const auto upper = static_cast<long>(std::ceil(n * p + spread));
+            result.value = series.order_statistic(static_cast<long>(std::ceil(n * p)));
+            if (lower >= 1 && upper <= series.count) {
+                result.half_width = (series.order_statistic(upper) - series.order_statistic(lower)) / 2.0;
+            }
+            return result;
+        }
+        result.value = series.mean;
+        result.half_width = student_t_quantile(target_.confidence, n - 1) * std::sqrt(series.squares / (n - 1) / n);
+        return result;
+    }
+
+    SamplingTarget target_;
+    int num_flows_;
+    std::vector<Series> series_;  // Per flow (or the max over flows).
+    std::vector<int> undelivered_;
+    double z_;
+    int samples_ = 0;
+};
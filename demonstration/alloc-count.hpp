@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+    Counts of heap allocations made by this thread, including those of scheduler libraries loaded into the process.
+    Only counting when alloc-count.cpp, which replaces the global operator new, is linked into the binary (built with
+    SIM_ALLOC_TRACKING, see stage-timing.hpp for the counts per stage of a phase, and check.cpp).
+*/
+#ifdef SIM_ALLOC_TRACKING
+inline constexpr bool alloc_tracking = true;
+#else
+inline constexpr bool alloc_tracking = false;
+#endif
+
+struct AllocationCount {
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+};
+
+inline thread_local AllocationCount threadAllocations;
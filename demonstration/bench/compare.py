@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""Performance regression gate for the simulator and the schedulers.
+
+Runs the BM_Instance* benchmarks of sim_bench on the runtime models in bench/instances (the example, experiment_1 and
+experiment_2 instances, as written by `rossa generate --fast`) and compares the time per phase and the peak RSS against
+the committed bench/baseline.json. Every benchmark runs in its own process, so the peak RSS is its own.
+
+A benchmark regresses in time if its median is above the baseline median by more than --time-threshold (relative) AND
+by more than --noise-factor times the robust standard deviation (1.4826 * MAD) of either run, so noisy benchmarks need a
+larger difference. It regresses in memory if its peak RSS is above the baseline by more than --rss-threshold (relative)
+plus --rss-slack-kb. A benchmark regressing in time is run once more and only fails if it regresses again, so a burst
+of load on the machine does not fail the gate. Exits with 1 on any regression, and with 2 if a benchmark could not run
+(sim_bench exited with an error or reported none); the others still run, and --update then writes no baseline.
+
+    compare.py --sim-bench build/sim_bench              # compare
+    compare.py --sim-bench build/sim_bench --update     # write a new baseline (after an intended change)
+
+The CMake target `bench_compare` runs the comparison (`cmake --build build --target bench_compare`).
+"""
+import argparse
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+from pathlib import Path
+
+HERE = Path(__file__).resolve().parent
+MAD_TO_SIGMA = 1.4826
+
+
+class BenchmarkError(RuntimeError):
+    """sim_bench failed or did not run a benchmark."""
+
+
+def run_sim_bench(cmd: list, env: dict) -> str:
+    try:
+        return subprocess.run(cmd, env=env, check=True, capture_output=True, text=True).stdout
+    except subprocess.CalledProcessError as e:
+        detail = e.stderr.strip().splitlines()[-1] if e.stderr.strip() else 'no output'
+        raise BenchmarkError(f'{Path(cmd[0]).name} exited with {e.returncode}: {detail}') from e
+    except OSError as e:
+        raise BenchmarkError(f'could not run {cmd[0]}: {e}') from e
+
+
+def run_benchmark(sim_bench: str, env: dict, name: str, repetitions: int, min_time: float) -> dict:
+    cmd = [sim_bench, f'--benchmark_filter=^{name}$', f'--benchmark_repetitions={repetitions}',
+           f'--benchmark_min_time={min_time}', '--benchmark_format=json']
+    try:
+        runs = [b for b in json.loads(run_sim_bench(cmd, env))['benchmarks'] if b.get('run_type') == 'iteration']
+    except (json.JSONDecodeError, KeyError) as e:
+        raise BenchmarkError(f'unreadable output: {e}') from e
+    if not runs:
+        raise BenchmarkError('did not run')
+    if any('error_message' in b for b in runs):
+        raise BenchmarkError(runs[0]['error_message'])
+    # Times are per iteration, which is one phase (or one scheduler call), in time_unit. CPU time, as the benchmarks are
+    # single-threaded and it is less affected by other load on the machine than real_time.
+    scale = {'ns': 1, 'us': 1e3, 'ms': 1e6, 's': 1e9}[runs[0]['time_unit']]
+    times = [b['cpu_time'] * scale for b in runs]
+    median = statistics.median(times)
+    return {
+        'ns_per_phase': round(median, 1),
+        'mad_ns': round(statistics.median(abs(t - median) for t in times), 1),
+        'peak_rss_kb': max(b['peak_rss_kb'] for b in runs),
+    }
+
+
+def list_benchmarks(sim_bench: str, env: dict) -> list:
+    cmd = [sim_bench, '--benchmark_list_tests=true', '--benchmark_filter=^BM_Instance']
+    return run_sim_bench(cmd, env).split()
+
+
+def context() -> dict:
+    return {'machine': platform.machine(), 'system': platform.system(), 'cpus': os.cpu_count()}
+
+
+def compare(name: str, base: dict, current: dict, args) -> list:
+    problems = []
+    diff = current['ns_per_phase'] - base['ns_per_phase']
+    noise = args.noise_factor * MAD_TO_SIGMA * max(base['mad_ns'], current['mad_ns'])
+    if diff > args.time_threshold * base['ns_per_phase'] and diff > noise:
+        problems.append(f'{name}: {base["ns_per_phase"]:.0f} -> {current["ns_per_phase"]:.0f} ns/phase '
+                        f'(+{100 * diff / base["ns_per_phase"]:.1f}%, noise {noise:.0f} ns)')
+    rss_limit = base['peak_rss_kb'] * (1 + args.rss_threshold) + args.rss_slack_kb
+    if current['peak_rss_kb'] > rss_limit:
+        problems.append(f'{name}: peak RSS {base["peak_rss_kb"]:.0f} -> {current["peak_rss_kb"]:.0f} kB '
+                        f'(limit {rss_limit:.0f} kB)')
+    return problems
+
+
+def report(problems: list, failures: list) -> None:
+    print('\n' + '!' * 80, file=sys.stderr)
+    if problems:
+        print(f'PERFORMANCE REGRESSION in {len(problems)} benchmark(s):', file=sys.stderr)
+        for problem in problems:
+            print(f'    {problem}', file=sys.stderr)
+        print('If intended, update the baseline with --update and commit bench/baseline.json.', file=sys.stderr)
+    if failures:
+        print(f'FAILED TO RUN {len(failures)} benchmark(s), which were not compared:', file=sys.stderr)
+        for failure in failures:
+            print(f'    {failure}', file=sys.stderr)
+    print('!' * 80, file=sys.stderr)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--sim-bench', required=True, help='Path to the sim_bench executable')
+    parser.add_argument('--baseline', type=Path, default=HERE / 'baseline.json')
+    parser.add_argument('--instances', type=Path, nargs='*',
+                        default=sorted((HERE / 'instances').glob('*.txt')), help='Runtime model files')
+    parser.add_argument('--schedulers', help='Scheduler libraries separated by ":" (default: those built with sim_bench)')
+    parser.add_argument('--repetitions', type=int, default=9)
+    parser.add_argument('--min-time', type=float, default=0.1, help='Seconds per repetition')
+    parser.add_argument('--time-threshold', type=float, default=0.15)
+    parser.add_argument('--noise-factor', type=float, default=3.0)
+    parser.add_argument('--rss-threshold', type=float, default=0.10)
+    parser.add_argument('--rss-slack-kb', type=float, default=1024)
+    parser.add_argument('--update', action='store_true', help='Write the results as the new baseline')
+    args = parser.parse_args()
+
+    env = dict(os.environ, ROSSA_BENCH_MODELS=':'.join(str(p) for p in args.instances))
+    if args.schedulers:
+        env['ROSSA_BENCH_SCHEDULERS'] = args.schedulers
+    try:
+        names = list_benchmarks(args.sim_bench, env)
+    except BenchmarkError as e:
+        print(f'Could not list the benchmarks: {e}', file=sys.stderr)
+        return 2
+    if not names:
+        print('No instance benchmarks found (no instances or no scheduler libraries)', file=sys.stderr)
+        return 2
+
+    results = {}
+    failures = []
+    for name in names:
+        try:
+            r = results[name] = run_benchmark(args.sim_bench, env, name, args.repetitions, args.min_time)
+        except BenchmarkError as e:
+            failures.append(f'{name}: {e}')
+            print(f'{name:<50} FAILED: {e}')
+            continue
+        print(f'{name:<50} {r["ns_per_phase"]:>12.0f} ns/phase  ±{r["mad_ns"]:<8.0f} {r["peak_rss_kb"]:>8.0f} kB')
+
+    if args.update:
+        if failures:
+            report([], failures)
+            print('Not writing a baseline with failed benchmarks.', file=sys.stderr)
+            return 2
+        with open(args.baseline, 'w') as f:
+            json.dump({'context': context(), 'benchmarks': results}, f, indent=2, sort_keys=True)
+            f.write('\n')
+        print(f'Wrote baseline {args.baseline}')
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    if baseline.get('context') != context():
+        print(f'WARNING: baseline was recorded on {baseline.get("context")}, this is {context()}; '
+              f'timings may not be comparable', file=sys.stderr)
+    problems = []
+    for name, current in results.items():
+        if name not in baseline['benchmarks']:
+            print(f'WARNING: {name} is not in the baseline', file=sys.stderr)
+            continue
+        base = baseline['benchmarks'][name]
+        found = compare(name, base, current, args)
+        if found:
+            print(f'{name} looks slower, running it again')
+            try:
+                found = compare(name, base, run_benchmark(args.sim_bench, env, name, args.repetitions, args.min_time), args)
+            except BenchmarkError as e:
+                failures.append(f'{name} (run again): {e}')
+                found = []
+        problems += found
+    for name in baseline['benchmarks'].keys() - results.keys() - set(names):
+        print(f'WARNING: {name} is in the baseline but was not run', file=sys.stderr)
+
+    if problems or failures:
+        report(problems, failures)
+        return 2 if failures else 1
+    print(f'No regressions in {len(results)} benchmarks')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,188 @@
+// Python extension running the simulator in-process, see rossa.cppsim.simulate_in_process.
+// Results are returned as numpy arrays instead of the CSV text written by the sim binary.
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include "scheduler-library.hpp"
+#include "sim-engine.hpp"
+#include "static-schedule.hpp"
+
+namespace py = pybind11;
+
+namespace {
+
+template <typename T>
+std::vector<T> to_vector(const py::array_t<T, py::array::c_style | py::array::forcecast>& array) {
+    return std::vector<T>(array.data(), array.data() + array.size());
+}
+
+// As the sim binary takes --seed, --antithetic and --demand-variance, and the settings of the scheduler instead of the
+// environment (SchedulerLibrary::configure).
+struct RunOptions {
+    std::optional<std::uint32_t> seed;
+    bool antithetic = false;
+    double demand_variance = 0;  // Percent.
+    std::optional<std::map<std::string, std::string>> settings;
+};
+
+// Same content as the sim binary prints, one row per step or sample.
+template <typename Sim>
+py::dict simulate(Sim& sim, const RunOptions& options) {
+    const auto& model = sim.model();
+    if (options.seed) sim.seed(*options.seed);
+    sim.set_antithetic(options.antithetic);
+    sim.set_demand_variance(options.demand_variance / 100.0);
+    const py::ssize_t steps = model.sim_steps + 1;
+    py::array_t<bool> did_overflow(steps);
+    py::array_t<packet_t> packets_at_node({steps, static_cast<py::ssize_t>(sim.num_nodes())});
+    py::array_t<double> port_utilization({steps, static_cast<py::ssize_t>(sim.num_ports())});
+    py::array_t<int> sample_latency({static_cast<py::ssize_t>(model.sampling_count), static_cast<py::ssize_t>(sim.num_flows())});
+    auto overflow_out = did_overflow.mutable_unchecked<1>();
+    auto packets_out = packets_at_node.mutable_unchecked<2>();
+    auto utilization_out = port_utilization.mutable_unchecked<2>();
+    auto latency_out = sample_latency.mutable_unchecked<2>();
+    {
+        py::gil_scoped_release release;
+        sim.ON_CONSTRUCT();
+        sim.run_one_simulation(model.sim_steps, [&](int step) {
+            overflow_out(step) = sim.gDidOverflow;
+            for (int node = 0; node < sim.num_nodes(); ++node) packets_out(step, node) = sim.packetsAtNode(node);
+            for (int port = 0; port < sim.num_ports(); ++port) utilization_out(step, port) = sim.portUtilization(port);
+        });
+        for (int sample_id = 0; sample_id < model.sampling_count; ++sample_id) {
+            sim.run_one_simulation(model.sampling_steps, [](int) {});
+            for (int flow = 0; flow < sim.num_flows(); ++flow) latency_out(sample_id, flow) = sim.sampleLatency[flow];
+        }
+    }
+    py::dict result;
+    result["did_overflow"] = did_overflow;
+    result["packets_at_node"] = packets_at_node;
+    result["port_utilization"] = port_utilization;
+    result["sample_latency"] = sample_latency;
+    return result;
+}
+
+py::dict simulate_model(SchedulerLibrary& scheduler, SimModel model, const RunOptions& options) {
+    validate_model(model);
+    std::unique_lock<std::mutex> lock;
+    if (!scheduler.thread_local_state()) {
+        // Wait without the GIL, a simulation holding the scheduler needs it to finish.
+        py::gil_scoped_release release;
+        lock = scheduler.lock();
+    }
+    scheduler.configure(options.settings);
+    return with_runtime_simulator(std::move(model), scheduler.api(), [&options](auto& sim) { return simulate(sim, options); });
+}
+
+// The choices of the scheduler for every phase (static-schedule.hpp), with shape (num_phases, choices per phase).
+py::array_t<packet_t> static_schedule(SchedulerLibrary& scheduler, SimModel model) {
+    validate_model(model);
+    StaticSchedule table;
+    {
+        py::gil_scoped_release release;
+        std::unique_lock<std::mutex> lock;
+        if (!scheduler.thread_local_state()) lock = scheduler.lock();
+        scheduler.configure(std::nullopt);  // The environment, as generating reads it.
+        table = ::static_schedule(std::move(model), scheduler.api());
+    }
+    py::array_t<packet_t> choices({static_cast<py::ssize_t>(table.num_phases), static_cast<py::ssize_t>(table.choices_per_phase)});
+    std::copy(table.choices.begin(), table.choices.end(), choices.mutable_data());
+    return choices;
+}
+
+} // namespace
+
+PYBIND11_MODULE(rossa_sim, m) {
+    m.doc() = "In-process rossa simulator";
+
+    py::class_<SchedulerLibrary>(m, "Scheduler")
+        .def(py::init<std::string>(), py::arg("path"), "Loads a scheduler library (e.g. librotor_lb.so)")
+        .def_property_readonly("path", &SchedulerLibrary::path);
+
+    m.def("simulate",
+          [](SchedulerLibrary& scheduler, int num_phases, int num_switches,
+             const py::array_t<packet_t, py::array::c_style | py::array::forcecast>& node_capacities,
+             const py::array_t<packet_t, py::array::c_style | py::array::forcecast>& port_bandwidths,
+             const py::array_t<node_t, py::array::c_style | py::array::forcecast>& topology,
+             const py::array_t<node_t, py::array::c_style | py::array::forcecast>& flows,
+             const py::array_t<packet_t, py::array::c_style | py::array::forcecast>& amounts,
+             int sim_steps, int sampling_steps, int sampling_count, std::optional<std::uint32_t> seed, bool antithetic,
+             double demand_variance, std::optional<std::map<std::string, std::string>> settings) {
+              if (flows.ndim() != 2 || flows.shape(1) != 2) throw std::invalid_argument("flows must have shape (num_flows, 2)");
+              if (amounts.ndim() != 2 || amounts.shape(0) != flows.shape(0)) {
+                  throw std::invalid_argument("amounts must have shape (num_flows, max_flow_time)");
+              }
+              SimModel model;
+              model.num_phases = num_phases;
+              model.num_nodes = static_cast<int>(node_capacities.size());
+              model.num_flows = static_cast<int>(flows.shape(0));
+              model.num_switches = num_switches;
+              model.max_flow_time = static_cast<int>(amounts.shape(1));
+              model.sim_steps = sim_steps;
+              model.sampling_steps = sampling_steps;
+              model.sampling_count = sampling_count;
+              model.node_capacities = to_vector(node_capacities);
+              model.port_bandwidths = to_vector(port_bandwidths);
+              model.topology = to_vector(topology);
+              const auto flow_nodes = flows.unchecked<2>();
+              for (py::ssize_t flow = 0; flow < flows.shape(0); ++flow) model.flows.push_back({flow_nodes(flow, 0), flow_nodes(flow, 1)});
+              model.amounts = to_vector(amounts);
+              return simulate_model(scheduler, std::move(model), RunOptions{seed, antithetic, demand_variance, std::move(settings)});
+          },
+          py::arg("scheduler"), py::arg("num_phases"), py::arg("num_switches"), py::arg("node_capacities"),
+          py::arg("port_bandwidths"), py::arg("topology"), py::arg("flows"), py::arg("amounts"),
+          py::arg("sim_steps"), py::arg("sampling_steps"), py::arg("sampling_count"), py::arg("seed") = py::none(),
+          py::arg("antithetic") = false, py::arg("demand_variance") = 0.0, py::arg("settings") = py::none(),
+          "Simulates a model given as arrays. topology has shape (num_phases, num_ports). seed, antithetic and "
+          "demand_variance (percent) as the sim binary takes them; settings (a dict) replace the environment as the "
+          "settings of the scheduler, e.g. CHOICE_APPROACH.");
+
+    m.def("static_schedule",
+          [](SchedulerLibrary& scheduler, int num_phases, int num_switches,
+             const py::array_t<packet_t, py::array::c_style | py::array::forcecast>& node_capacities,
+             const py::array_t<packet_t, py::array::c_style | py::array::forcecast>& port_bandwidths,
+             const py::array_t<node_t, py::array::c_style | py::array::forcecast>& topology,
+             const py::array_t<node_t, py::array::c_style | py::array::forcecast>& flows) {
+              if (flows.ndim() != 2 || flows.shape(1) != 2) throw std::invalid_argument("flows must have shape (num_flows, 2)");
+              SimModel model;
+              model.num_phases = num_phases;
+              model.num_nodes = static_cast<int>(node_capacities.size());
+              model.num_flows = static_cast<int>(flows.shape(0));
+              model.num_switches = num_switches;
+              model.max_flow_time = 1;
+              model.node_capacities = to_vector(node_capacities);
+              model.port_bandwidths = to_vector(port_bandwidths);
+              model.topology = to_vector(topology);
+              const auto flow_nodes = flows.unchecked<2>();
+              for (py::ssize_t flow = 0; flow < flows.shape(0); ++flow) model.flows.push_back({flow_nodes(flow, 0), flow_nodes(flow, 1)});
+              model.amounts.assign(model.flows.size(), 0);
+              return static_schedule(scheduler, std::move(model));
+          },
+          py::arg("scheduler"), py::arg("num_phases"), py::arg("num_switches"), py::arg("node_capacities"),
+          py::arg("port_bandwidths"), py::arg("topology"), py::arg("flows"),
+          "The choices (extGetScheduleChoiceAll) of a scheduler whose choices in a phase never change, with shape "
+          "(num_phases, num_nodes * num_flows * (num_switches + 1)). Raises ValueError for a scheduler that does not "
+          "declare static choices (extStaticSchedule).");
+
+    m.def("simulate_file",
+          [](SchedulerLibrary& scheduler, const std::string& path, const std::optional<std::string>& trace,
+             std::optional<std::uint32_t> seed, bool antithetic, double demand_variance,
+             std::optional<std::map<std::string, std::string>> settings) {
+              std::ifstream in(path);
+              if (!in) throw std::runtime_error("Could not open model file: " + path);
+              auto model = read_model(in);
+              if (trace) model.use_trace(std::make_shared<const TrafficTrace>(*trace));
+              return simulate_model(scheduler, std::move(model), RunOptions{seed, antithetic, demand_variance, std::move(settings)});
+          },
+          py::arg("scheduler"), py::arg("path"), py::arg("trace") = py::none(), py::arg("seed") = py::none(),
+          py::arg("antithetic") = false, py::arg("demand_variance") = 0.0, py::arg("settings") = py::none(),
+          "Simulates a runtime model file (sim-model.txt), optionally with the ingress amounts of a traffic trace. The "
+          "other arguments as for simulate.");
+}
@@ -0,0 +1,374 @@
+// Checks of the simulator and the scheduler libraries, one per command:
+//   allocations      Simulating a phase does not allocate once warmed up, in the engine or the scheduler. Built with
+//                    alloc-count.cpp (SIM_ALLOC_TRACKING), counting the heap allocations per stage of simulatePhase
+//                    (see stage-timing.hpp); those of the scheduler stage are the allocations of the scheduler.
+//   modes            The incremental (ROTORLB_INCREMENTAL) and bounded (ROTORLB_MAX_ITERATIONS and
+//                    ROTORLB_TIME_BUDGET_US with caps no acceptance reaches) modes of RotorLB, alone and combined, make
+//                    the choices of the default, for both choice approaches. The modes are set in place of the
+//                    environment (SchedulerLibrary::configure), which the scheduler reads in every extSchedulerInit.
+//   threads          Simulations on two threads, each loading the library by a path of its own, give the results of a
+//                    simulation on one thread: the SchedulerLibrary registry must give both the same lock, or a
+//                    scheduler with global state is used by both at once.
+//   static-schedule  A library that declares static choices (static-schedule.hpp) chooses as the table of the phase in
+//                    every call of seeded simulations. Libraries that do not declare them are refused, which is printed.
+//   overflow         The overflow probability estimated by multilevel splitting (rare-event.hpp) agrees with plain
+//                    Monte Carlo, within three standard deviations of their difference.
+//
+// Usage: check <command> [--model MODEL-FILE]... [options] <scheduler-library>...
+// Runs the check on every runtime model (by default a small network, 8 nodes with 16 flows over 2 switches) with every
+// library, printing a line per model and library (per mode for modes), and exits with 1 if any failed, 2 on errors.
+// Options:
+//   allocations: --warmup PHASES and --phases PHASES (default: twice the phases of the topology each). The allocations
+//                of --phases phases after the setup steps and --warmup phases are counted.
+//   modes:       --steps STEPS (default: the sim_steps of the model), the steps of the simulation compared.
+//   threads:     --rounds ROUNDS (default 20), the seeded simulations (sim_steps steps and the samples) per thread.
+//   overflow:    --steps STEPS (default: sim_steps), --runs RUNS (default 1000), --effort COUNT (default 1000, per
+//                level), --capacity-scale FACTOR (default 1, of the node capacities) and --demand-variance PERCENT
+//                (default 0, see Simulator::set_demand_variance).
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "generators.hpp"
+#include "rare-event.hpp"
+#include "scheduler-library.hpp"
+#include "sim-engine.hpp"
+#include "static-schedule.hpp"
+
+static_assert(alloc_tracking, "check must be built with SIM_ALLOC_TRACKING and alloc-count.cpp");
+
+namespace {
+    // The options of a command, --name VALUE.
+    class Options {
+    public:
+        void set(const std::string& name, const std::string& value) { values_[name] = value; }
+
+        [[nodiscard]] std::optional<int> integer(const std::string& name) const {
+            const auto it = values_.find(name);
+            return it == values_.end() ? std::nullopt : std::optional(std::stoi(it->second));
+        }
+        [[nodiscard]] double real(const std::string& name, double otherwise) const {
+            const auto it = values_.find(name);
+            return it == values_.end() ? otherwise : std::stod(it->second);
+        }
+
+    private:
+        std::map<std::string, std::string> values_;
+    };
+
+    // A model to check on and a library to check with.
+    struct Fixture {
+        std::string model_name;
+        const SimModel& model;
+        std::string library_path;
+        SchedulerLibrary& library;
+
+        // How lines about it start.
+        [[nodiscard]] std::string name() const { return model_name + " " + library_path; }
+    };
+
+    // The model of the checks without --model: small enough for every check to run in a moment, with a cycle of
+    // several phases and flows between all kinds of node pairs.
+    SimModel small_model() { return to_sim_model(benchmark_network(8, 16, 2, 4, 40)); }
+
+    // Hashes the choices of every call (FNV-1a).
+    class ChoiceHashes : public SimObserver {
+    public:
+        explicit ChoiceHashes(std::size_t choices_per_call) : choices_per_call_(choices_per_call) {}
+
+        void begin() override { hashes.clear(); }
+        void observe(const PhaseRecord& record) override {
+            std::uint64_t hash = 0xcbf29ce484222325;
+            for (std::size_t i = 0; i < choices_per_call_; ++i) {
+                hash = (hash ^ static_cast<std::uint32_t>(record.choices[i])) * 0x100000001b3;
+            }
+            hashes.push_back(hash);
+        }
+
+        std::vector<std::uint64_t> hashes;
+
+    private:
+        std::size_t choices_per_call_;
+    };
+
+    /*** allocations ***/
+
+    bool check_allocations(const Fixture& fixture, const Options& options) {
+        const int warmup = options.integer("--warmup").value_or(2 * fixture.model.num_phases);
+        const int phases = options.integer("--phases").value_or(2 * fixture.model.num_phases);
+        return with_runtime_simulator(fixture.model, fixture.library.api(), [&](auto& sim) {
+            sim.seed(1);
+            sim.ON_CONSTRUCT();
+            sim.reset_run();
+            for (int phase = 0; phase < warmup; ++phase) sim.simulatePhase();
+            sim.stageTimings.reset();
+            for (int phase = 0; phase < phases; ++phase) sim.simulatePhase();
+
+            std::uint64_t total = 0;
+            std::cout << fixture.name() << ":";
+            for (std::size_t stage = 0; stage < STAGE_NAMES.size(); ++stage) {
+                const auto& count = sim.stageTimings.allocations(static_cast<Stage>(stage));
+                if (count.allocations == 0) continue;
+                total += count.allocations;
+                std::cout << " " << STAGE_NAMES[stage] << " " << static_cast<double>(count.allocations) / phases
+                          << " allocations (" << static_cast<double>(count.bytes) / phases << " bytes) per phase;";
+            }
+            std::cout << (total == 0 ? " no allocations" : "") << "\n";
+            return total == 0;
+        });
+    }
+
+    /*** modes ***/
+
+    using Settings = std::map<std::string, std::string>;
+
+    const std::pair<const char*, Settings> MODES[] = {
+        {"incremental", {{"ROTORLB_INCREMENTAL", "TRUE"}}},
+        {"bounded iterations", {{"ROTORLB_MAX_ITERATIONS", "1000000"}}},
+        {"bounded time", {{"ROTORLB_TIME_BUDGET_US", "10000000"}}},
+        {"incremental bounded", {{"ROTORLB_INCREMENTAL", "TRUE"}, {"ROTORLB_MAX_ITERATIONS", "1000000"}}},
+    };
+
+    // The hashes of the calls of a simulation with the scheduler configured with the settings, empty if it failed.
+    std::vector<std::uint64_t> simulate_mode(const Fixture& fixture, int steps, const Settings& settings) {
+        fixture.library.configure(settings);
+        return with_runtime_simulator(fixture.model, fixture.library.api(), [&](auto& sim) {
+            ChoiceHashes hashes(static_cast<std::size_t>(sim.num_nodes()) * sim.num_flows() * (sim.num_switches() + 1));
+            sim.seed(1);
+            sim.ON_CONSTRUCT();
+            sim.attach(hashes);
+            try {
+                sim.run_one_simulation(steps, [](int) {});
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << "\n";
+                hashes.hashes.clear();
+            }
+            return std::move(hashes.hashes);
+        });
+    }
+
+    bool check_modes(const Fixture& fixture, const Options& options) {
+        const int steps = options.integer("--steps").value_or(fixture.model.sim_steps);
+        bool same = true;
+        for (const char* approach : {"UNIFORM", "QUICKEST"}) {
+            const Settings base{{"CHOICE_APPROACH", approach}};
+            const auto reference = simulate_mode(fixture, steps, base);
+            if (reference.empty()) throw std::runtime_error("The default mode failed on " + fixture.name());
+            for (const auto& [name, variables] : MODES) {
+                Settings settings = base;
+                settings.insert(variables.begin(), variables.end());
+                const auto hashes = simulate_mode(fixture, steps, settings);
+                std::cout << fixture.name() << " " << approach << " " << name << ": ";
+                if (hashes.empty()) {
+                    std::cout << "failed\n";
+                    same = false;
+                    continue;
+                }
+                std::size_t call = 0;
+                while (call < reference.size() && call < hashes.size() && reference[call] == hashes[call]) call++;
+                if (call == reference.size() && call == hashes.size()) {
+                    std::cout << "same choices in " << call << " calls\n";
+                } else {
+                    std::cout << "differs from the default in call " << call << "\n";
+                    same = false;
+                }
+            }
+        }
+        fixture.library.configure(std::nullopt);
+        return same;
+    }
+
+    /*** threads ***/
+
+    // A hash (FNV-1a) of what the sim binary prints of a seeded simulation of the model.
+    std::uint64_t simulate_hashed(const SimModel& model, SchedulerLibrary& library) {
+        std::unique_lock<std::mutex> lock;
+        if (!library.thread_local_state()) lock = library.lock();
+        return with_runtime_simulator(model, library.api(), [&](auto& sim) {
+            std::uint64_t hash = 0xcbf29ce484222325;
+            const auto add = [&hash](std::int64_t value) { hash = (hash ^ static_cast<std::uint64_t>(value)) * 0x100000001b3; };
+            sim.seed(1);
+            sim.ON_CONSTRUCT();
+            sim.run_one_simulation(model.sim_steps, [&](int) {
+                add(sim.gDidOverflow);
+                for (int node = 0; node < sim.num_nodes(); ++node) add(sim.packetsAtNode(node));
+            });
+            for (int sample = 0; sample < model.sampling_count; ++sample) {
+                sim.run_one_simulation(model.sampling_steps, [](int) {});
+                for (int flow = 0; flow < sim.num_flows(); ++flow) add(sim.sampleLatency[flow]);
+            }
+            return hash;
+        });
+    }
+
+    bool check_threads(const Fixture& fixture, const Options& options) {
+        const int rounds = options.integer("--rounds").value_or(20);
+        if (rounds < 1) throw std::invalid_argument("--rounds must be positive");
+        const auto reference = simulate_hashed(fixture.model, fixture.library);
+        // The same library by another path.
+        const std::filesystem::path path(fixture.library_path);
+        const std::string paths[] = {fixture.library_path, (path.parent_path() / "." / path.filename()).string()};
+        std::atomic<int> differed = 0;
+        std::vector<std::thread> threads;
+        for (const auto& thread_path : paths) {
+            threads.emplace_back([&, thread_path] {
+                SchedulerLibrary library(thread_path);
+                for (int round = 0; round < rounds; ++round) differed += simulate_hashed(fixture.model, library) != reference;
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        std::cout << fixture.name() << ": " << differed << " of " << 2 * rounds
+                  << " simulations on two threads differed from one thread\n";
+        return differed == 0;
+    }
+
+    /*** static-schedule ***/
+
+    // Counts the calls whose choices differ from the table.
+    class TableComparison : public SimObserver {
+    public:
+        explicit TableComparison(const StaticSchedule& table) : table_(table) {}
+
+        void begin() override {}  // Counted over all simulations.
+        void observe(const PhaseRecord& record) override {
+            const int32_t* expected = table_.phase(record.phase);
+            differed += !std::equal(record.choices, record.choices + table_.choices_per_phase, expected);
+            calls++;
+        }
+
+        long calls = 0;
+        long differed = 0;
+
+    private:
+        const StaticSchedule& table_;
+    };
+
+    bool check_static_schedule(const Fixture& fixture, const Options&) {
+        std::optional<StaticSchedule> table;
+        try {
+            table = static_schedule(fixture.model, fixture.library.api());
+        } catch (const std::invalid_argument& e) {
+            std::cout << fixture.name() << ": refused, " << e.what() << "\n";
+            return true;
+        }
+        return with_runtime_simulator(fixture.model, fixture.library.api(), [&](auto& sim) {
+            TableComparison comparison(*table);
+            sim.seed(1);
+            sim.ON_CONSTRUCT();
+            sim.attach(comparison);
+            sim.run_one_simulation(fixture.model.sim_steps, [](int) {});
+            for (int sample = 0; sample < fixture.model.sampling_count; ++sample) {
+                sim.run_one_simulation(fixture.model.sampling_steps, [](int) {});
+            }
+            std::cout << fixture.name() << ": static, " << comparison.differed << " of " << comparison.calls
+                      << " calls chose otherwise than the table\n";
+            return comparison.differed == 0;
+        });
+    }
+
+    /*** overflow ***/
+
+    bool check_overflow(const Fixture& fixture, const Options& options) {
+        SimModel model = fixture.model;
+        const double capacity_scale = options.real("--capacity-scale", 1);
+        for (auto& capacity : model.node_capacities) capacity = static_cast<packet_t>(capacity * capacity_scale);
+        SplittingOptions splitting;
+        splitting.steps = options.integer("--steps").value_or(model.sim_steps);
+        splitting.effort = options.integer("--effort").value_or(splitting.effort);
+        const int runs = options.integer("--runs").value_or(1000);
+        if (runs < 1) throw std::invalid_argument("--runs must be positive");
+        return with_runtime_simulator(std::move(model), fixture.library.api(), [&](auto& sim) {
+            sim.seed(1);
+            sim.set_demand_variance(options.real("--demand-variance", 0) / 100.0);
+            sim.ON_CONSTRUCT();
+            int overflows = 0;
+            for (int run = 0; run < runs; ++run) {
+                sim.run_one_simulation(splitting.steps, [](int) {});
+                overflows += sim.gDidOverflow;
+            }
+            const double plain = static_cast<double>(overflows) / runs;
+            const auto estimate = estimate_overflow_probability(sim, splitting);
+
+            const double split_error = estimate.relative_error * estimate.probability;
+            const double deviation = std::sqrt(plain * (1 - plain) / runs + split_error * split_error);
+            const bool agree = std::fabs(plain - estimate.probability) <= 3 * deviation;
+            std::cout << fixture.name() << ": Monte Carlo " << plain << " (" << overflows << " of " << runs
+                      << " runs), splitting " << estimate.probability << " +- " << split_error << ", "
+                      << (agree ? "agree" : "DIFFER") << "\n";
+            return agree;
+        });
+    }
+
+    struct Command {
+        const char* name;
+        std::vector<std::string> options;  // Besides --model.
+        bool (*check)(const Fixture&, const Options&);
+    };
+
+    const Command COMMANDS[] = {
+        {"allocations", {"--warmup", "--phases"}, check_allocations},
+        {"modes", {"--steps"}, check_modes},
+        {"threads", {"--rounds"}, check_threads},
+        {"static-schedule", {}, check_static_schedule},
+        {"overflow", {"--steps", "--runs", "--effort", "--capacity-scale", "--demand-variance"}, check_overflow},
+    };
+
+    int usage(const char* program) {
+        std::cerr << "Usage: " << program << " <command> [--model MODEL-FILE]... [options] <scheduler-library>...\n"
+                  << "Commands (options in check.cpp):";
+        for (const auto& command : COMMANDS) std::cerr << " " << command.name;
+        std::cerr << "\n";
+        return 2;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) return usage(argv[0]);
+    const auto command = std::find_if(std::begin(COMMANDS), std::end(COMMANDS),
+                                      [&](const Command& c) { return c.name == std::string(argv[1]); });
+    if (command == std::end(COMMANDS)) return usage(argv[0]);
+    Options options;
+    std::vector<std::string> model_paths;
+    std::vector<std::string> libraries;
+    for (int i = 2; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            libraries.push_back(arg);
+        } else if (i + 1 < argc && arg == "--model") {
+            model_paths.emplace_back(argv[++i]);
+        } else if (i + 1 < argc && std::find(command->options.begin(), command->options.end(), arg) != command->options.end()) {
+            options.set(arg, argv[++i]);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (libraries.empty()) return usage(argv[0]);
+    try {
+        std::vector<std::pair<std::string, SimModel>> models;
+        for (const auto& path : model_paths) {
+            std::ifstream in(path);
+            if (!in) throw std::runtime_error("Could not open model file: " + path);
+            models.emplace_back(path, read_model(in));
+        }
+        if (models.empty()) models.emplace_back("small", small_model());
+        bool passed = true;
+        for (const auto& library_path : libraries) {
+            SchedulerLibrary library(library_path);
+            for (const auto& [name, model] : models) passed &= command->check({name, model, library_path, library}, options);
+        }
+        return passed ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 2;
+    }
+}
@@ -1,6 +1,9 @@
 # Clean compiled schedulers
 rm -R schedulers/build/*
 
+# Clean cached simulator binaries.
+rm -Rf build-cache
+
 # Clean copied to be path-findable from UPPAAL.
 rm libfixed.so librotor_lb.so libvaliant.so
 
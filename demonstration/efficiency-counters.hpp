@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <ostream>
+#include <vector>
+#include "sim-engine.hpp"
+
+/*
+    Where the packets and the bandwidth of a simulation go, to tell why a scheduler underperforms. Per phase of the
+    rotor cycle (summed over its steps) and in total:
+        held                buffered packets the choices did not give to a port (the dummy switch, or no choice),
+                            or gave to a port connected to their own node
+        rate_limited        packets given to a port beyond its bandwidth
+        sent                packets sent over ports
+        delivered_direct    ... to their egress, by their ingress node (one hop)
+        delivered_indirect  ... to their egress, by another node (the last of several hops)
+        forwarded           ... to another node than their egress
+        bandwidth           of all ports
+        unused_idle         bandwidth no packets were given to
+        unused_self_loop    bandwidth of ports connected to their own node in the phase, which send nothing
+        unused_truncation   bandwidth lost to rounding the packets given to a port down to whole packets
+    The unused bandwidth of every port is kept as well. Packets given to a port are fractional (the buffered packets
+    split by the choice weights), so are held, rate_limited and the unused bandwidth.
+*/
+class EfficiencyCounters : public SimObserver {
+public:
+    struct Counters {
+        double held = 0;
+        double rate_limited = 0;
+        double sent = 0;
+        double delivered_direct = 0;
+        double delivered_indirect = 0;
+        double forwarded = 0;
+        double bandwidth = 0;
+        double unused_idle = 0;
+        double unused_self_loop = 0;
+        double unused_truncation = 0;
+
+        void add(const Counters& other) {
+            held += other.held;
+            rate_limited += other.rate_limited;
+            sent += other.sent;
+            delivered_direct += other.delivered_direct;
+            delivered_indirect += other.delivered_indirect;
+            forwarded += other.forwarded;
+            bandwidth += other.bandwidth;
+            unused_idle += other.unused_idle;
+            unused_self_loop += other.unused_self_loop;
+            unused_truncation += other.unused_truncation;
+        }
+        void write_json(std::ostream& out) const {
+            out << "{\"held\": " << held << ", \"rate_limited\": " << rate_limited << ", \"sent\": " << sent
+                << ", \"delivered_direct\": " << delivered_direct << ", \"delivered_indirect\": " << delivered_indirect
+                << ", \"forwarded\": " << forwarded << ", \"bandwidth\": " << bandwidth << ", \"unused_idle\": " << unused_idle
+                << ", \"unused_self_loop\": " << unused_self_loop << ", \"unused_truncation\": " << unused_truncation << "}";
+        }
+    };
+
+    EfficiencyCounters(int num_phases, int num_ports) : phases_(num_phases), unused_(num_ports) {}
+
+    void begin() override {
+        std::fill(phases_.begin(), phases_.end(), Counters{});
+        std::fill(unused_.begin(), unused_.end(), 0.0);
+        steps_ = 0;
+    }
+
+    void observe(const PhaseRecord& record) override {
+        auto& counters = phases_[record.phase];
+        const auto& model = record.model;
+        // Held: buffered and not given to a port, or given to one connected to its own node (added by port).
+        counters.held += static_cast<double>(record.buffered);
+        for (port_t p = 0; p < model.num_ports(); ++p) {
+            counters.held -= record.scheduled[p];
+            port(counters, p, record.bandwidths[p], record.target(p) == record.port_owner(p), record.scheduled[p], record.port_sent[p]);
+        }
+        for (flow_t flow = 0; flow < model.num_flows; ++flow) {
+            for (port_t p = 0; p < model.num_ports(); ++p) {
+                const packet_t sent = record.sent_by(p, flow);
+                if (record.target(p) != model.flows[flow].egress) {
+                    counters.forwarded += sent;
+                } else if (record.port_owner(p) == model.flows[flow].ingress) {
+                    counters.delivered_direct += sent;
+                } else {
+                    counters.delivered_indirect += sent;
+                }
+            }
+        }
+        steps_++;
+    }
+
+    [[nodiscard]] Counters total() const {
+        Counters total;
+        for (const auto& counters : phases_) total.add(counters);
+        return total;
+    }
+
+    // {"steps": ..., "total": {counters}, "phases": [{counters}, ...], "unused_per_port": [...]} on one line.
+    void write_json(std::ostream& out) const {
+        out << "{\"steps\": " << steps_ << ", \"total\": ";
+        total().write_json(out);
+        out << ", \"phases\": [";
+        for (std::size_t phase = 0; phase < phases_.size(); ++phase) {
+            if (phase > 0) out << ", ";
+            phases_[phase].write_json(out);
+        }
+        out << "], \"unused_per_port\": [";
+        for (std::size_t port = 0; port < unused_.size(); ++port) out << (port == 0 ? "" : ", ") << unused_[port];
+        out << "]}";
+    }
+
+private:
+    // A port given scheduled packets (fractional) of which it sent the whole sent packets.
+    void port(Counters& counters, port_t port, packet_t bandwidth, bool self_loop, double scheduled, packet_t sent) {
+        counters.bandwidth += bandwidth;
+        if (self_loop) {
+            counters.held += scheduled;
+            counters.unused_self_loop += bandwidth;
+            unused_[port] += bandwidth;
+            return;
+        }
+        const double unused = bandwidth - sent;
+        const double truncated = (scheduled < bandwidth ? scheduled : bandwidth) - sent;
+        counters.sent += sent;
+        counters.rate_limited += scheduled > bandwidth ? scheduled - bandwidth : 0;
+        counters.unused_truncation += truncated > 0 ? truncated : 0;
+        counters.unused_idle += unused - (truncated > 0 ? truncated : 0);
+        unused_[port] += unused;
+    }
+
+    std::vector<Counters> phases_;  // Summed over the steps in each phase.
+    std::vector<double> unused_;    // Bandwidth per port.
+    long steps_ = 0;
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "sim-engine.hpp"
+
+/*
+    The throughput of every flow over a simulation: the packets offered at its ingress and delivered at its egress, so
+    the sustained throughput of a scheduler is measured instead of inferred from buffer growth. The delivered packets
+    of every step (the goodput time series) go into the output of the sim binary (see output-writer.hpp); this keeps
+    the totals:
+        offered, delivered   packets over the simulation
+        delivered_ratio      delivered over offered (1 when nothing was offered)
+        goodput              delivered packets per step over the simulation, and from the start of the steady state
+                             (start_steady_state, the sim binary starts it halfway, after the network filled up)
+        backlog              packets offered and not delivered at the end
+        time_to_drain        steps from the last step with ingress until the packets offered up to then were all
+                             delivered, -1 if they were not within the simulation
+*/
+class FlowThroughput : public SimObserver {
+public:
+    explicit FlowThroughput(int num_flows) : flows_(num_flows) {}
+
+    void begin() override {
+        for (auto& flow : flows_) flow = FlowTotals{};
+        steps_ = 0;
+        steady_start_ = -1;
+    }
+    // The packets delivered in the phase count before those arriving in it.
+    void observe(const PhaseRecord& record) override {
+        for (flow_t flow = 0; flow < static_cast<flow_t>(flows_.size()); ++flow) {
+            depart(flow, record.step, record.delivered[flow]);
+            arrive(flow, record.step, record.arrived[flow]);
+        }
+    }
+
+    void arrive(flow_t flow, int step, packet_t amount) {
+        if (amount <= 0) return;
+        auto& f = flows_[flow];
+        f.offered += amount;
+        f.last_ingress = step;
+        f.drained = -1;
+    }
+    // Every step, also when nothing was delivered.
+    void depart(flow_t flow, int step, packet_t amount) {
+        auto& f = flows_[flow];
+        f.delivered += amount;
+        if (amount > 0 && f.delivered == f.offered) f.drained = step;
+        steps_ = step + 1;
+    }
+    // The steady-state goodput counts from the steps simulated so far on.
+    void start_steady_state() {
+        steady_start_ = steps_;
+        for (auto& flow : flows_) flow.delivered_at_steady_start = flow.delivered;
+    }
+
+    // [{"offered": ..., "delivered": ..., "delivered_ratio": ..., "goodput": ..., "goodput_steady": ..., "backlog": ...,
+    //   "time_to_drain": ...}, ...] per flow, on one line.
+    void write_json(std::ostream& out) const {
+        out << "[";
+        for (std::size_t flow = 0; flow < flows_.size(); ++flow) {
+            const auto& f = flows_[flow];
+            const double ratio = f.offered > 0 ? static_cast<double>(f.delivered) / static_cast<double>(f.offered) : 1.0;
+            const double goodput = steps_ > 0 ? static_cast<double>(f.delivered) / steps_ : 0.0;
+            const double steady = steady_start_ >= 0 && steps_ > steady_start_
+                                      ? static_cast<double>(f.delivered - f.delivered_at_steady_start) / (steps_ - steady_start_)
+                                      : goodput;
+            out << (flow == 0 ? "" : ", ") << "{\"offered\": " << f.offered << ", \"delivered\": " << f.delivered
+                << ", \"delivered_ratio\": " << ratio << ", \"goodput\": " << goodput << ", \"goodput_steady\": " << steady
+                << ", \"backlog\": " << f.offered - f.delivered
+                << ", \"time_to_drain\": " << (f.drained >= 0 ? f.drained - f.last_ingress : -1) << "}";
+        }
+        out << "]";
+    }
+
+private:
+    struct FlowTotals {
+        std::int64_t offered = 0;
+        std::int64_t delivered = 0;
+        std::int64_t delivered_at_steady_start = 0;
+        int last_ingress = -1;  // Step.
+        int drained = -1;       // Step all packets offered were delivered, -1 while some are not.
+    };
+
+    std::vector<FlowTotals> flows_;
+    int steps_ = 0;          // Simulated.
+    int steady_start_ = -1;  // Step, -1 before the steady state.
+};
@@ -0,0 +1,135 @@
+// Generates a model in the runtime format (and optionally a binary traffic trace) from a rotor topology and a traffic
+// pattern, see generators.hpp. The same options and seed always give the same files.
+//
+// Usage: generate [--option value]... <model-file>
+// Options (defaults in brackets):
+//     --nodes N [16]  --switches S [4]  --capacity PACKETS [5000]  --bandwidth PACKETS [550]
+//     --topology rotating|permutation [rotating]  --interval I [nodes / switches]  --start-offset O [1]
+//     --traffic uniform|gravity|hotspot|permutation [gravity]
+//     --min-demand D [1]  --max-demand D [300]  --steps T [1]  --variance PERCENT [0]
+//     --flows F [nodes]  (uniform, hotspot)
+//     --connection PERCENT [25]  --power P [1]  (gravity)
+//     --hotspots K [1]  --hotspot-percent PERCENT [50]  (hotspot)
+//     --sim-steps [50]  --sampling-steps [200]  --sampling-count [50]
+//     --seed [0]
+//     --trace FILE  Write the amounts to a binary traffic trace instead of the model file (sim --trace FILE model-file).
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include "generators.hpp"
+
+namespace {
+    class Options {
+    public:
+        Options(int argc, char** argv) {
+            for (int i = 1; i < argc; ++i) {
+                const std::string arg = argv[i];
+                if (arg.rfind("--", 0) == 0 && i + 1 < argc) {
+                    values_[arg.substr(2)] = argv[++i];
+                } else if (positional_.empty() && arg.rfind("--", 0) != 0) {
+                    positional_ = arg;
+                } else {
+                    throw std::invalid_argument("Unexpected argument: " + arg);
+                }
+            }
+            if (positional_.empty()) throw std::invalid_argument("No model file given");
+        }
+
+        [[nodiscard]] const std::string& model_path() const { return positional_; }
+
+        std::string text(const std::string& name, const std::string& fallback) { return take(name).value_or(fallback); }
+        int integer(const std::string& name, int fallback) {
+            const auto value = take(name);
+            return value ? std::stoi(*value) : fallback;
+        }
+        double real(const std::string& name, double fallback) {
+            const auto value = take(name);
+            return value ? std::stod(*value) : fallback;
+        }
+        std::optional<std::string> take(const std::string& name) {
+            const auto it = values_.find(name);
+            if (it == values_.end()) return std::nullopt;
+            auto value = it->second;
+            values_.erase(it);
+            return value;
+        }
+
+        // Throws for options that were given but not used by the chosen topology and traffic.
+        void check_all_used() const {
+            if (!values_.empty()) throw std::invalid_argument("Unknown or unused option: --" + values_.begin()->first);
+        }
+
+    private:
+        std::map<std::string, std::string> values_;
+        std::string positional_;
+    };
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options options(argc, argv);
+        GeneratedModel model;
+        model.num_nodes = options.integer("nodes", 16);
+        model.num_switches = options.integer("switches", 4);
+        model.capacity = options.integer("capacity", 5000);
+        model.bandwidth = options.integer("bandwidth", 550);
+        model.sim_steps = options.integer("sim-steps", model.sim_steps);
+        model.sampling_steps = options.integer("sampling-steps", model.sampling_steps);
+        model.sampling_count = options.integer("sampling-count", model.sampling_count);
+        const auto seed = static_cast<std::uint64_t>(std::stoull(options.text("seed", "0")));
+        const auto trace_path = options.take("trace");
+        if (model.num_nodes < 2 || model.num_switches < 1) throw std::invalid_argument("Need at least 2 nodes and 1 switch");
+
+        // Separate streams, so changing the traffic does not change the topology and vice versa.
+        GeneratorRng topology_rng(seed, 1);
+        GeneratorRng traffic_rng(seed, 2);
+
+        const auto topology = options.text("topology", "rotating");
+        if (topology == "rotating") {
+            const int interval = options.integer("interval", std::max(1, model.num_nodes / model.num_switches));
+            model.topology = rotating_topology(model.num_nodes, model.num_switches, interval, options.integer("start-offset", 1));
+        } else if (topology == "permutation") {
+            model.topology = permutation_topology(model.num_nodes, model.num_switches, topology_rng);
+        } else {
+            throw std::invalid_argument("Unknown topology: " + topology);
+        }
+
+        const auto traffic = options.text("traffic", "gravity");
+        const packet_t min_demand = options.integer("min-demand", 1);
+        const packet_t max_demand = options.integer("max-demand", 300);
+        if (traffic == "uniform") {
+            model.traffic = uniform_traffic(model.num_nodes, options.integer("flows", model.num_nodes), min_demand, max_demand, traffic_rng);
+        } else if (traffic == "gravity") {
+            const double connection = options.real("connection", 25);
+            model.traffic = gravity_traffic(model.num_nodes, connection, min_demand, max_demand, options.real("power", 1), traffic_rng);
+        } else if (traffic == "hotspot") {
+            const int num_flows = options.integer("flows", model.num_nodes);
+            const int num_hotspots = options.integer("hotspots", 1);
+            model.traffic = hotspot_traffic(model.num_nodes, num_flows, num_hotspots, options.real("hotspot-percent", 50),
+                                            min_demand, max_demand, traffic_rng);
+        } else if (traffic == "permutation") {
+            model.traffic = permutation_traffic(model.num_nodes, min_demand, max_demand, traffic_rng);
+        } else {
+            throw std::invalid_argument("Unknown traffic: " + traffic);
+        }
+        model.traffic.num_steps = options.integer("steps", 1);
+        model.traffic.variance = options.real("variance", 0) / 100.0;
+        model.traffic.seed = traffic_rng.next();
+        if (model.traffic.num_steps < 1 || model.traffic.variance < 0) throw std::invalid_argument("Need at least 1 step and a non-negative variance");
+        options.check_all_used();
+
+        std::ofstream out(options.model_path());
+        if (!out) throw std::runtime_error("Could not open model file for writing: " + options.model_path());
+        write_runtime_model(out, model, !trace_path);
+        if (!out.flush()) throw std::runtime_error("Could not write model file: " + options.model_path());
+        if (trace_path) write_traffic_trace(*trace_path, model.traffic);
+        std::cerr << model.num_nodes << " nodes, " << model.num_switches << " switches, " << model.topology.num_phases
+                  << " phases, " << model.traffic.flows.size() << " flows\n";
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        std::cerr << "Usage: " << argv[0] << " [--option value]... <model-file> (options at the top of generate.cpp)\n";
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <numeric>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "sim-engine.hpp"
+#include "traffic-trace.hpp"
+
+/*
+    Native topology and traffic generators, for models too large to build with the Python builders (rossa cli.py and
+    model.py), e.g. N=1024. The output is the runtime model format (read_model) and optionally a binary traffic trace.
+    Everything is derived from one seed with portable arithmetic (std::mt19937_64 and std::seed_seq are fully specified),
+    so the same parameters give the same model on every platform.
+*/
+
+// A random stream. The distributions of <random> are implementation defined, so they are not used.
+class GeneratorRng {
+public:
+    GeneratorRng(std::uint64_t seed, std::uint32_t stream) {
+        std::seed_seq seq{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32), stream};
+        engine_.seed(seq);
+    }
+
+    // Uniform in [0, n).
+    std::uint64_t below(std::uint64_t n) {
+        const std::uint64_t limit = UINT64_MAX - UINT64_MAX % n;
+        std::uint64_t x;
+        do {
+            x = engine_();
+        } while (x >= limit);
+        return x % n;
+    }
+    // Uniform in [low, high].
+    int between(int low, int high) { return low + static_cast<int>(below(static_cast<std::uint64_t>(high - low) + 1)); }
+    // Uniform in [0, 1).
+    double unit() { return static_cast<double>(engine_() >> 11) * 0x1.0p-53; }
+    std::uint64_t next() { return engine_(); }
+
+private:
+    std::mt19937_64 engine_;
+};
+
+/*** TOPOLOGY ***/
+
+struct GeneratedTopology {
+    int num_phases = 0;
+    std::vector<node_t> targets;  // Target node at phase * num_ports + port, ports numbered node * num_switches + switch.
+};
+
+/*
+    As RotatingSwitches: switch sw starts at offset sw * interval + start_offset and every phase all offsets advance by
+    one (in 1..num_nodes-1), so node n is connected to n + offset (mod num_nodes). Repeats after num_nodes - 1 phases.
+    With advance, the offsets advance by that much every phase instead, and num_phases (if not 0) cuts the cycle short.
+*/
+inline GeneratedTopology rotating_topology(int num_nodes, int num_switches, int interval, int start_offset, int advance = 1,
+                                           int num_phases = 0) {
+    if (num_nodes < 2 || num_switches < 1) throw std::invalid_argument("Rotating topology needs at least 2 nodes and 1 switch");
+    if (advance < 1 || num_phases < 0) throw std::invalid_argument("Rotating topology needs an advance of at least 1");
+    std::vector<int> offsets;
+    for (int sw = 0; sw < num_switches; ++sw) {
+        const int offset = sw * interval + start_offset;
+        if (offset < 1 || offset >= num_nodes) throw std::invalid_argument("Rotating topology offsets must be in 1..num_nodes-1");
+        offsets.push_back(offset);
+    }
+    GeneratedTopology topology;
+    topology.num_phases = num_phases > 0 ? num_phases : num_nodes - 1;
+    topology.targets.reserve(static_cast<std::size_t>(topology.num_phases) * num_nodes * num_switches);
+    for (int phase = 0; phase < topology.num_phases; ++phase) {
+        for (int node = 0; node < num_nodes; ++node) {
+            for (const int offset : offsets) {
+                const int shifted = static_cast<int>((offset - 1 + static_cast<std::int64_t>(phase) * advance) % (num_nodes - 1)) + 1;
+                topology.targets.push_back((node + shifted) % num_nodes);
+            }
+        }
+    }
+    return topology;
+}
+
+/*
+    RotorNet-style: the num_nodes - 1 matchings of a randomly relabeled offset decomposition (together connecting every
+    pair of nodes exactly once) in random order, dealt round-robin to the switches. Every switch cycles through its own
+    share, so the topology repeats after ceil((num_nodes - 1) / num_switches) phases; when the matchings do not divide
+    evenly the last phase reuses the first matchings.
+*/
+inline GeneratedTopology permutation_topology(int num_nodes, int num_switches, GeneratorRng& rng) {
+    if (num_nodes < 2 || num_switches < 1) throw std::invalid_argument("Permutation topology needs at least 2 nodes and 1 switch");
+    std::vector<node_t> label(num_nodes);
+    std::iota(label.begin(), label.end(), 0);
+    for (int i = num_nodes - 1; i > 0; --i) std::swap(label[i], label[rng.below(i + 1)]);
+    std::vector<int> matchings(num_nodes - 1);
+    std::iota(matchings.begin(), matchings.end(), 1);
+    for (int i = num_nodes - 2; i > 0; --i) std::swap(matchings[i], matchings[rng.below(i + 1)]);
+
+    GeneratedTopology topology;
+    topology.num_phases = (num_nodes - 1 + num_switches - 1) / num_switches;
+    topology.targets.resize(static_cast<std::size_t>(topology.num_phases) * num_nodes * num_switches);
+    for (int phase = 0; phase < topology.num_phases; ++phase) {
+        for (int sw = 0; sw < num_switches; ++sw) {
+            const int offset = matchings[(phase * num_switches + sw) % (num_nodes - 1)];
+            for (int i = 0; i < num_nodes; ++i) {
+                const node_t node = label[i];
+                topology.targets[(static_cast<std::size_t>(phase) * num_nodes + node) * num_switches + sw] = label[(i + offset) % num_nodes];
+            }
+        }
+    }
+    return topology;
+}
+
+/*** TRAFFIC ***/
+
+/*
+    Flows with a base demand each. Over num_steps steps the ingress amount of a flow varies uniformly by +-variance
+    (a fraction) around its demand, at least 1, as the gravity builder does. The variation is a hash of the seed, flow
+    and step, so amounts can be produced in any order (flow by flow for the model file, step by step for a trace)
+    without being stored.
+*/
+struct TrafficMatrix {
+    std::vector<Flow> flows;
+    std::vector<packet_t> demands;
+    int num_steps = 1;
+    double variance = 0;
+    std::uint64_t seed = 0;
+
+    [[nodiscard]] packet_t amount(flow_t flow, int step) const {
+        const packet_t demand = demands[flow];
+        if (variance == 0) return demand;
+        // splitmix64 finalizer over (seed, flow, step).
+        std::uint64_t z = seed + 0x9E3779B97F4A7C15ULL * (static_cast<std::uint64_t>(flow) * 0x100000001ULL + step + 1);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        const double u = static_cast<double>(z >> 11) * 0x1.0p-53;
+        return std::max<packet_t>(1, static_cast<packet_t>(demand * (1 - variance + 2 * variance * u)));
+    }
+};
+
+namespace detail {
+    inline void check_demands(int num_nodes, packet_t min_demand, packet_t max_demand) {
+        if (num_nodes < 2) throw std::invalid_argument("Traffic needs at least 2 nodes");
+        if (min_demand < 0 || max_demand < min_demand) throw std::invalid_argument("Demands must satisfy 0 <= min_demand <= max_demand");
+    }
+    inline node_t other_node(int num_nodes, node_t node, GeneratorRng& rng) {
+        const auto other = static_cast<node_t>(rng.below(num_nodes - 1));
+        return other >= node ? other + 1 : other;
+    }
+}
+
+// As UniformFlowBuilder: num_flows flows between random distinct nodes, demand uniform in [min_demand, max_demand].
+inline TrafficMatrix uniform_traffic(int num_nodes, int num_flows, packet_t min_demand, packet_t max_demand, GeneratorRng& rng) {
+    detail::check_demands(num_nodes, min_demand, max_demand);
+    TrafficMatrix traffic;
+    for (int flow = 0; flow < num_flows; ++flow) {
+        const packet_t demand = rng.between(min_demand, max_demand);
+        const auto ingress = static_cast<node_t>(rng.below(num_nodes));
+        traffic.flows.push_back({ingress, detail::other_node(num_nodes, ingress, rng)});
+        traffic.demands.push_back(demand);
+    }
+    return traffic;
+}
+
+/*
+    As GravityFlowBuilder: every node gets a random send and receive mass, connection_percent of all ordered node pairs
+    get a flow with demand min + (send mass * receive mass)^power * (max - min).
+*/
+inline TrafficMatrix gravity_traffic(int num_nodes, double connection_percent, packet_t min_demand, packet_t max_demand,
+                                     double power, GeneratorRng& rng) {
+    detail::check_demands(num_nodes, min_demand, max_demand);
+    if (connection_percent < 0 || connection_percent > 100) throw std::invalid_argument("Connection percentage must be in 0..100");
+    std::vector<double> send_mass(num_nodes), recv_mass(num_nodes);
+    for (auto& mass : send_mass) mass = rng.unit();
+    for (auto& mass : recv_mass) mass = rng.unit();
+
+    // Partial Fisher-Yates over the ordered pairs, pair i is (i / (n - 1), other) as in detail::other_node.
+    const auto num_pairs = static_cast<std::uint32_t>(num_nodes) * static_cast<std::uint32_t>(num_nodes - 1);
+    const auto num_flows = static_cast<std::uint32_t>(std::llround(num_pairs * connection_percent * 0.01));
+    std::vector<std::uint32_t> pairs(num_pairs);
+    std::iota(pairs.begin(), pairs.end(), 0u);
+    TrafficMatrix traffic;
+    traffic.flows.reserve(num_flows);
+    traffic.demands.reserve(num_flows);
+    for (std::uint32_t i = 0; i < num_flows; ++i) {
+        std::swap(pairs[i], pairs[i + rng.below(num_pairs - i)]);
+        const auto ingress = static_cast<node_t>(pairs[i] / (num_nodes - 1));
+        auto egress = static_cast<node_t>(pairs[i] % (num_nodes - 1));
+        if (egress >= ingress) egress++;
+        const double mass = std::pow(send_mass[ingress], power) * std::pow(recv_mass[egress], power);
+        traffic.flows.push_back({ingress, egress});
+        traffic.demands.push_back(static_cast<packet_t>(std::lround(min_demand + mass * (max_demand - min_demand))));
+    }
+    return traffic;
+}
+
+/*
+    num_flows flows from random nodes, hotspot_percent of them towards one of num_hotspots randomly chosen nodes and the
+    rest towards a random node. Demand uniform in [min_demand, max_demand].
+*/
+inline TrafficMatrix hotspot_traffic(int num_nodes, int num_flows, int num_hotspots, double hotspot_percent,
+                                     packet_t min_demand, packet_t max_demand, GeneratorRng& rng) {
+    detail::check_demands(num_nodes, min_demand, max_demand);
+    if (num_hotspots < 1 || num_hotspots > num_nodes) throw std::invalid_argument("Number of hotspots must be in 1..num_nodes");
+    std::vector<node_t> nodes(num_nodes);
+    std::iota(nodes.begin(), nodes.end(), 0);
+    for (int i = 0; i < num_hotspots; ++i) std::swap(nodes[i], nodes[i + rng.below(num_nodes - i)]);
+    const std::vector<node_t> hotspots(nodes.begin(), nodes.begin() + num_hotspots);
+
+    TrafficMatrix traffic;
+    for (int flow = 0; flow < num_flows; ++flow) {
+        const packet_t demand = rng.between(min_demand, max_demand);
+        const bool to_hotspot = rng.unit() * 100 < hotspot_percent;
+        const node_t egress = to_hotspot ? hotspots[rng.below(num_hotspots)] : static_cast<node_t>(rng.below(num_nodes));
+        traffic.flows.push_back({detail::other_node(num_nodes, egress, rng), egress});
+        traffic.demands.push_back(demand);
+    }
+    return traffic;
+}
+
+// One flow from every node to its image under a random permutation without fixed points (a single cycle).
+inline TrafficMatrix permutation_traffic(int num_nodes, packet_t min_demand, packet_t max_demand, GeneratorRng& rng) {
+    detail::check_demands(num_nodes, min_demand, max_demand);
+    std::vector<node_t> successor(num_nodes);
+    std::iota(successor.begin(), successor.end(), 0);
+    // Sattolo's algorithm.
+    for (int i = num_nodes - 1; i > 0; --i) std::swap(successor[i], successor[rng.below(i)]);
+    TrafficMatrix traffic;
+    for (node_t node = 0; node < num_nodes; ++node) {
+        traffic.flows.push_back({node, successor[node]});
+        traffic.demands.push_back(rng.between(min_demand, max_demand));
+    }
+    return traffic;
+}
+
+/*** OUTPUT ***/
+
+struct GeneratedModel {
+    int num_nodes = 0;
+    int num_switches = 0;
+    int sim_steps = 50;
+    int sampling_steps = 200;
+    int sampling_count = 50;
+    packet_t capacity = 0;  // Of every node.
+    packet_t bandwidth = 0;  // Of every port.
+    GeneratedTopology topology;
+    TrafficMatrix traffic;
+};
+
+/*
+    Writes the runtime model format (read_model). With amounts = false the flows get a single zero amount, for use with
+    the traffic trace written by write_traffic_trace (as rossa generate --traffic-trace).
+*/
+inline void write_runtime_model(std::ostream& out, const GeneratedModel& model, bool amounts = true) {
+    const int num_ports = model.num_nodes * model.num_switches;
+    const int max_flow_time = amounts ? model.traffic.num_steps : 1;
+    out << "rossa-model 1\n"
+        << model.topology.num_phases << ' ' << model.num_nodes << ' ' << model.traffic.flows.size() << ' '
+        << model.num_switches << ' ' << max_flow_time << '\n'
+        << model.sim_steps << ' ' << model.sampling_steps << ' ' << model.sampling_count << '\n';
+    auto line = [&out](int count, auto value_at) {
+        for (int i = 0; i < count; ++i) out << (i == 0 ? "" : " ") << value_at(i);
+        out << '\n';
+    };
+    line(model.num_nodes, [&](int) { return model.capacity; });
+    line(num_ports, [&](int) { return model.bandwidth; });
+    for (int phase = 0; phase < model.topology.num_phases; ++phase) {
+        line(num_ports, [&](int port) { return model.topology.targets[static_cast<std::size_t>(phase) * num_ports + port]; });
+    }
+    for (flow_t flow = 0; flow < static_cast<flow_t>(model.traffic.flows.size()); ++flow) {
+        out << model.traffic.flows[flow].ingress << ' ' << model.traffic.flows[flow].egress;
+        for (int step = 0; step < max_flow_time; ++step) out << ' ' << (amounts ? model.traffic.amount(flow, step) : 0);
+        out << '\n';
+    }
+}
+
+// Writes the ingress amounts in the binary traffic trace format (traffic-trace.hpp), one step at a time.
+inline void write_traffic_trace(const std::string& path, const TrafficMatrix& traffic) {
+    if (traffic.flows.empty()) throw std::invalid_argument("A traffic trace needs at least one flow");
+    std::ofstream out(path, std::ios::binary);
+    if (!out) throw std::runtime_error("Could not open traffic trace for writing: " + path);
+    const auto num_flows = static_cast<uint32_t>(traffic.flows.size());
+    const uint32_t reserved = 0;
+    const auto num_steps = static_cast<uint64_t>(traffic.num_steps);
+    out.write(TrafficTrace::MAGIC, sizeof(TrafficTrace::MAGIC));
+    out.write(reinterpret_cast<const char*>(&num_flows), sizeof(num_flows));
+    out.write(reinterpret_cast<const char*>(&reserved), sizeof(reserved));
+    out.write(reinterpret_cast<const char*>(&num_steps), sizeof(num_steps));
+    std::vector<packet_t> row(num_flows);
+    for (int step = 0; step < traffic.num_steps; ++step) {
+        for (flow_t flow = 0; flow < static_cast<flow_t>(num_flows); ++flow) row[flow] = traffic.amount(flow, step);
+        out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(packet_t)));
+    }
+    if (!out) throw std::runtime_error("Could not write traffic trace: " + path);
+}
+
+/*** BENCHMARK NETWORKS ***/
+
+/*
+    The synthetic networks of the microbenchmarks (sim_bench and schedulers/bench/scheduler_bench), by nodes N, flows F,
+    switches S and phases P: in phase p, switch sw connects node n to n + 1 + ((p * S + sw) mod (N - 1)), so the
+    ceil((N - 1) / S) phases of a cycle connect every pair of nodes once, and the flows are between random distinct
+    nodes, each with the same demand. Every parameter gives the same network, so the benchmarks of the engine and of the
+    schedulers measure the same fixtures.
+*/
+inline GeneratedModel benchmark_network(int num_nodes, int num_flows, int num_switches, int num_phases, packet_t demand) {
+    GeneratorRng rng(123456, 0);
+    GeneratedModel model;
+    model.num_nodes = num_nodes;
+    model.num_switches = num_switches;
+    model.capacity = 6000;
+    model.bandwidth = 350;
+    model.topology = rotating_topology(num_nodes, num_switches, 1, 1, num_switches, num_phases);
+    model.traffic = uniform_traffic(num_nodes, num_flows, demand, demand, rng);
+    return model;
+}
+
+// The benchmark networks as {N, F, S, P}: N = 16..128 with 4 switches and 4 flows per node, and around N = 64 each of
+// F, S and P varied on its own.
+inline std::vector<std::array<int, 4>> benchmark_network_sizes() {
+    std::vector<std::array<int, 4>> sizes;
+    auto add = [&sizes](int n, int f, int s, int p) { sizes.push_back({n, f, s, p == 0 ? (n - 1 + s - 1) / s : p}); };
+    for (const int n : {16, 32, 64, 128}) add(n, 4 * n, 4, 0);
+    for (const int f : {64, 1024}) add(64, f, 4, 0);
+    for (const int s : {2, 8}) add(64, 256, s, 0);
+    add(64, 256, 4, 32);
+    return sizes;
+}
+
+// The runtime model of a generated one, with the amounts of its traffic.
+inline SimModel to_sim_model(const GeneratedModel& generated) {
+    SimModel model;
+    model.num_phases = generated.topology.num_phases;
+    model.num_nodes = generated.num_nodes;
+    model.num_flows = static_cast<int>(generated.traffic.flows.size());
+    model.num_switches = generated.num_switches;
+    model.max_flow_time = generated.traffic.num_steps;
+    model.sim_steps = generated.sim_steps;
+    model.sampling_steps = generated.sampling_steps;
+    model.sampling_count = generated.sampling_count;
+    model.node_capacities.assign(model.num_nodes, generated.capacity);
+    model.port_bandwidths.assign(model.num_ports(), generated.bandwidth);
+    model.topology = generated.topology.targets;
+    model.flows = generated.traffic.flows;
+    for (flow_t flow = 0; flow < model.num_flows; ++flow) {
+        for (int step = 0; step < model.max_flow_time; ++step) model.amounts.push_back(generated.traffic.amount(flow, step));
+    }
+    validate_model(model);
+    return model;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <utility>
+#include <vector>
+#include "sim-engine.hpp"
+
+/*
+    The latency of every packet of a simulation, from the cumulative arrival (ingress) and departure (egress) curves of
+    each flow as in network calculus: the n-th packet of a flow arrives at the first step the arrival curve reaches n
+    and leaves at the first step the departure curve reaches n, so one deterministic run gives the whole latency
+    distribution instead of one sampled packet per flow and run.
+    Packets of a flow are taken to leave in the order they arrived (FIFO per flow). Where a flow is split over several
+    paths this is the FIFO-equivalent (virtual) delay: the mean is exact once all packets have left, the spread may be
+    narrower than that of the individual packets.
+    Memory is the arrivals not fully departed yet (one entry per step with ingress) plus a histogram up to the largest
+    latency, so long runs stream. Latencies are in steps, counted as the sampled latency (sampleLatency) is.
+*/
+class LatencyCurves : public SimObserver {
+public:
+    explicit LatencyCurves(int num_flows) : flows_(num_flows) {}
+
+    // Forgets all packets, keeping the memory.
+    void begin() override {
+        for (auto& flow : flows_) {
+            flow.head = 0;
+            flow.size = 0;
+            flow.histogram.clear();
+            flow.arrived = 0;
+            flow.departed = 0;
+        }
+    }
+
+    // The packets delivered in the phase leave before those arriving in it.
+    void observe(const PhaseRecord& record) override {
+        for (flow_t flow = 0; flow < static_cast<flow_t>(flows_.size()); ++flow) {
+            depart(flow, record.step, record.delivered[flow]);
+            arrive(flow, record.step, record.arrived[flow]);
+        }
+    }
+
+    void arrive(flow_t flow, int step, packet_t amount) {
+        if (amount <= 0) return;
+        auto& f = flows_[flow];
+        f.arrived += amount;
+        if (f.size > 0) {
+            auto& last = f.arrivals[(f.head + f.size - 1) % f.arrivals.size()];
+            if (last.step == step) {
+                last.amount += amount;
+                return;
+            }
+        }
+        if (f.size == f.arrivals.size()) grow(f);
+        f.arrivals[(f.head + f.size) % f.arrivals.size()] = {step, amount};
+        f.size++;
+    }
+
+    void depart(flow_t flow, int step, packet_t amount) {
+        auto& f = flows_[flow];
+        while (amount > 0 && f.size > 0) {
+            auto& first = f.arrivals[f.head];
+            const packet_t leaving = amount < first.amount ? amount : first.amount;
+            const auto latency = static_cast<std::size_t>(step - first.step);
+            if (latency >= f.histogram.size()) f.histogram.resize(latency + 1, 0);
+            f.histogram[latency] += leaving;
+            f.departed += leaving;
+            amount -= leaving;
+            first.amount -= leaving;
+            if (first.amount == 0) {
+                f.head = (f.head + 1) % f.arrivals.size();
+                f.size--;
+            }
+        }
+    }
+
+    // Packets of the flow that left the network with each latency (index).
+    [[nodiscard]] const std::vector<std::uint64_t>& histogram(flow_t flow) const { return flows_[flow].histogram; }
+    [[nodiscard]] std::uint64_t delivered(flow_t flow) const { return flows_[flow].departed; }
+    [[nodiscard]] std::uint64_t in_flight(flow_t flow) const { return flows_[flow].arrived - flows_[flow].departed; }
+
+    [[nodiscard]] double mean(flow_t flow) const {
+        const auto& f = flows_[flow];
+        if (f.departed == 0) return -1;
+        double total = 0;
+        for (std::size_t latency = 0; latency < f.histogram.size(); ++latency) total += static_cast<double>(latency * f.histogram[latency]);
+        return total / static_cast<double>(f.departed);
+    }
+    // The smallest latency of at least the fraction q of the delivered packets, -1 if none were delivered.
+    [[nodiscard]] int quantile(flow_t flow, double q) const {
+        const auto& f = flows_[flow];
+        if (f.departed == 0) return -1;
+        std::uint64_t count = 0;
+        for (std::size_t latency = 0; latency < f.histogram.size(); ++latency) {
+            count += f.histogram[latency];
+            if (static_cast<double>(count) >= q * static_cast<double>(f.departed)) return static_cast<int>(latency);
+        }
+        return static_cast<int>(f.histogram.size()) - 1;
+    }
+
+    // [{"delivered": ..., "in_flight": ..., "mean": ..., "p50": ..., "p90": ..., "p99": ..., "max": ...,
+    //   "histogram": [packets with latency 0, 1, ...]}, ...] per flow, on one line.
+    void write_json(std::ostream& out) const {
+        out << "[";
+        for (flow_t flow = 0; flow < static_cast<flow_t>(flows_.size()); ++flow) {
+            out << (flow == 0 ? "" : ", ") << "{\"delivered\": " << delivered(flow) << ", \"in_flight\": " << in_flight(flow)
+                << ", \"mean\": " << mean(flow) << ", \"p50\": " << quantile(flow, 0.5) << ", \"p90\": " << quantile(flow, 0.9)
+                << ", \"p99\": " << quantile(flow, 0.99) << ", \"max\": " << quantile(flow, 1.0) << ", \"histogram\": [";
+            const auto& counts = histogram(flow);
+            for (std::size_t latency = 0; latency < counts.size(); ++latency) out << (latency == 0 ? "" : ", ") << counts[latency];
+            out << "]}";
+        }
+        out << "]";
+    }
+
+private:
+    struct Arrival {
+        int step = 0;
+        packet_t amount = 0;  // Not departed yet.
+    };
+    struct FlowCurve {
+        std::vector<Arrival> arrivals;  // Ring of size entries from head, in arrival order.
+        std::size_t head = 0;
+        std::size_t size = 0;
+        std::vector<std::uint64_t> histogram;
+        std::uint64_t arrived = 0;
+        std::uint64_t departed = 0;
+    };
+
+    static void grow(FlowCurve& f) {
+        std::vector<Arrival> arrivals(f.arrivals.empty() ? 64 : 2 * f.arrivals.size());
+        for (std::size_t i = 0; i < f.size; ++i) arrivals[i] = f.arrivals[(f.head + i) % f.arrivals.size()];
+        f.arrivals = std::move(arrivals);
+        f.head = 0;
+    }
+
+    std::vector<FlowCurve> flows_;
+};
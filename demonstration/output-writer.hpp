@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "schedulers/ext/ext.hpp"
+
+/*
+    Output of the sim binary, formatted and written by a writer thread so the simulation does not wait for it. The
+    simulation copies the values of each step (or sample) into a slot of a single-producer single-consumer ring and goes
+    on; the writer formats the slots it finds filled into a buffer and writes that out in large chunks. The simulation
+    only waits when all slots are filled, i.e. when the output cannot keep up.
+
+    Text output is the semicolon separated format of the sim binary (parsed by rossa cppsim.RossaData.from_csv_str).
+    Binary output is little-endian (read by rossa cppsim.read_binary_output):
+        char magic[8] = "RSIMOUT1"
+        uint32 num_nodes
+        uint32 num_ports
+        uint32 num_flows
+        uint32 flags: 1 if steps have delivered_at_egress, otherwise 0
+        records, each starting with a uint8 kind:
+            0 (step):      int32 step, uint8 did_overflow, int32 packets_at_node[num_nodes], float64 port_utilization[num_ports]
+                           (, int32 delivered_at_egress[num_flows] with flag 1)
+            1 (separator): nothing, the steps are followed by the samples
+            2 (sample):    int32 sample_id, int32 sample_latency[num_flows]
+*/
+class OutputWriter {
+public:
+    enum class Format { text, binary };
+    static constexpr char MAGIC[8] = {'R', 'S', 'I', 'M', 'O', 'U', 'T', '1'};
+    static constexpr std::uint32_t FLAG_DELIVERIES = 1;
+
+    // With deliveries, steps also have the packets of every flow delivered at its egress in the step (the goodput).
+    OutputWriter(std::ostream& out, Format format, int num_nodes, int num_ports, int num_flows, bool deliveries = false,
+                 std::uint32_t capacity = 1024)
+        : out_(out), format_(format), num_nodes_(num_nodes), num_ports_(num_ports), num_flows_(num_flows), deliveries_(deliveries),
+          int_width_(std::max(num_nodes + (deliveries ? num_flows : 0), num_flows)),
+          capacity_(std::bit_ceil(std::max<std::uint32_t>(capacity, 2))),
+          kinds_(capacity_), ids_(capacity_), flags_(capacity_),
+          ints_(static_cast<std::size_t>(capacity_) * int_width_), doubles_(static_cast<std::size_t>(capacity_) * num_ports_) {
+        buffer_.reserve(FLUSH_SIZE + 4096);
+        thread_ = std::thread([this] { write_all(); });
+    }
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+    ~OutputWriter() { finish(); }
+
+    // The values of a step: packets_at_node(node) and port_utilization(port) (and delivered_at_egress(flow), when
+    // constructed with deliveries).
+    template <typename NodeFn, typename PortFn>
+    void push_step(int step, bool did_overflow, NodeFn&& packets_at_node, PortFn&& port_utilization) {
+        push_step(step, did_overflow, packets_at_node, port_utilization, [](flow_t) { return packet_t{0}; });
+    }
+    template <typename NodeFn, typename PortFn, typename FlowFn>
+    void push_step(int step, bool did_overflow, NodeFn&& packets_at_node, PortFn&& port_utilization, FlowFn&& delivered_at_egress) {
+        const std::uint32_t slot = acquire(Kind::step, step, did_overflow);
+        packet_t* values = &ints_[static_cast<std::size_t>(slot) * int_width_];
+        for (int node = 0; node < num_nodes_; ++node) values[node] = packets_at_node(node);
+        if (deliveries_) {
+            for (int flow = 0; flow < num_flows_; ++flow) values[num_nodes_ + flow] = delivered_at_egress(flow);
+        }
+        double* utilization = &doubles_[static_cast<std::size_t>(slot) * num_ports_];
+        for (int port = 0; port < num_ports_; ++port) utilization[port] = port_utilization(port);
+        publish();
+    }
+    // Separates the steps from the samples.
+    void push_separator() {
+        acquire(Kind::separator, 0, false);
+        publish();
+    }
+    // The latencies of a sample: sample_latency(flow).
+    template <typename FlowFn>
+    void push_sample(int sample_id, FlowFn&& sample_latency) {
+        const std::uint32_t slot = acquire(Kind::sample, sample_id, false);
+        packet_t* values = &ints_[static_cast<std::size_t>(slot) * int_width_];
+        for (int flow = 0; flow < num_flows_; ++flow) values[flow] = sample_latency(flow);
+        publish();
+    }
+
+    // Waits until everything pushed is written and flushed. Nothing can be pushed afterwards.
+    void finish() {
+        if (!thread_.joinable()) return;
+        acquire(Kind::end, 0, false);
+        publish();
+        thread_.join();
+        out_.flush();
+    }
+
+private:
+    enum class Kind : std::uint8_t { step = 0, separator = 1, sample = 2, end };
+    static constexpr std::size_t FLUSH_SIZE = 1 << 16;
+
+    // Waits for a free slot (back-pressure) and fills in its header.
+    std::uint32_t acquire(Kind kind, int id, bool flag) {
+        const std::uint32_t head = head_.load(std::memory_order_relaxed);
+        for (std::uint32_t tail = tail_.load(std::memory_order_acquire); head - tail == capacity_;
+             tail = tail_.load(std::memory_order_acquire)) {
+            tail_.wait(tail, std::memory_order_acquire);
+        }
+        const std::uint32_t slot = head & (capacity_ - 1);
+        kinds_[slot] = kind;
+        ids_[slot] = id;
+        flags_[slot] = flag;
+        return slot;
+    }
+    void publish() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        head_.notify_one();
+    }
+
+    // The writer thread.
+    void write_all() {
+        write_header();
+        std::uint32_t tail = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            std::uint32_t head = head_.load(std::memory_order_acquire);
+            if (head == tail) {
+                // Write what is formatted before sleeping, so the output does not lag behind a slow simulation.
+                write_buffer();
+                head_.wait(tail, std::memory_order_acquire);
+                continue;
+            }
+            for (; tail != head; ++tail) {
+                const std::uint32_t slot = tail & (capacity_ - 1);
+                if (kinds_[slot] == Kind::end) {
+                    write_buffer();
+                    tail_.store(tail + 1, std::memory_order_release);
+                    return;
+                }
+                format(slot);
+                if (buffer_.size() >= FLUSH_SIZE) write_buffer();
+            }
+            tail_.store(tail, std::memory_order_release);
+            tail_.notify_one();
+        }
+    }
+
+    void write_header() {
+        if (format_ == Format::binary) {
+            buffer_.append(MAGIC, sizeof(MAGIC));
+            const int flags = deliveries_ ? FLAG_DELIVERIES : 0;
+            for (const int dimension : {num_nodes_, num_ports_, num_flows_, flags}) append_binary(static_cast<std::uint32_t>(dimension));
+            return;
+        }
+        buffer_ += "step; gDidOverflow; ";
+        for (int node = 0; node < num_nodes_; ++node) buffer_ += "packetsAtNode(" + std::to_string(node) + "); ";
+        for (int port = 0; port < num_ports_; ++port) buffer_ += "portUtilization(" + std::to_string(port) + "); ";
+        if (deliveries_) {
+            for (int flow = 0; flow < num_flows_; ++flow) buffer_ += "deliveredAtEgress(" + std::to_string(flow) + "); ";
+        }
+        buffer_ += "\n";
+    }
+
+    void format(std::uint32_t slot) {
+        const packet_t* values = &ints_[static_cast<std::size_t>(slot) * int_width_];
+        const double* utilization = &doubles_[static_cast<std::size_t>(slot) * num_ports_];
+        const auto kind = kinds_[slot];
+        if (format_ == Format::binary) {
+            append_binary(static_cast<std::uint8_t>(kind));
+            if (kind == Kind::step) {
+                append_binary(static_cast<std::int32_t>(ids_[slot]));
+                append_binary(flags_[slot]);
+                buffer_.append(reinterpret_cast<const char*>(values), num_nodes_ * sizeof(packet_t));
+                buffer_.append(reinterpret_cast<const char*>(utilization), num_ports_ * sizeof(double));
+                if (deliveries_) buffer_.append(reinterpret_cast<const char*>(values + num_nodes_), num_flows_ * sizeof(packet_t));
+            } else if (kind == Kind::sample) {
+                append_binary(static_cast<std::int32_t>(ids_[slot]));
+                buffer_.append(reinterpret_cast<const char*>(values), num_flows_ * sizeof(packet_t));
+            }
+            return;
+        }
+        switch (kind) {
+            case Kind::step:
+                append_text(ids_[slot]);
+                buffer_ += flags_[slot] ? "true; " : "false; ";
+                for (int node = 0; node < num_nodes_; ++node) append_text(values[node]);
+                for (int port = 0; port < num_ports_; ++port) append_text(utilization[port]);
+                if (deliveries_) {
+                    for (int flow = 0; flow < num_flows_; ++flow) append_text(values[num_nodes_ + flow]);
+                }
+                buffer_ += "\n";
+                break;
+            case Kind::separator:
+                buffer_ += "@@@\n";
+                buffer_ += "sample_id; ";
+                for (int flow = 0; flow < num_flows_; ++flow) buffer_ += "sampleLatency[" + std::to_string(flow) + "]; ";
+                buffer_ += "\n";
+                break;
+            case Kind::sample:
+                append_text(ids_[slot]);
+                for (int flow = 0; flow < num_flows_; ++flow) append_text(values[flow]);
+                buffer_ += "\n";
+                break;
+            case Kind::end:
+                break;
+        }
+    }
+
+    // "<value>; ", as std::ostream writes it (6 significant digits for doubles).
+    template <typename T>
+    void append_text(T value) {
+        char text[32];
+        std::to_chars_result result;
+        if constexpr (std::is_floating_point_v<T>) {
+            result = std::to_chars(text, text + sizeof(text), value, std::chars_format::general, 6);
+        } else {
+            result = std::to_chars(text, text + sizeof(text), value);
+        }
+        buffer_.append(text, result.ptr);
+        buffer_ += "; ";
+    }
+    template <typename T>
+    void append_binary(T value) {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        buffer_.append(bytes, sizeof(T));
+    }
+    void write_buffer() {
+        if (buffer_.empty()) return;
+        out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+    }
+
+    std::ostream& out_;
+    const Format format_;
+    const int num_nodes_;
+    const int num_ports_;
+    const int num_flows_;
+    const bool deliveries_;
+    const int int_width_;
+    const std::uint32_t capacity_;  // A power of two, so slots are indexed by masking the free-running counters.
+
+    // The slots, written by the simulation between acquire and publish, read by the writer until it advances the tail.
+    std::vector<Kind> kinds_;
+    std::vector<int> ids_;
+    std::vector<std::uint8_t> flags_;  // Not vector<bool>, whose bits of neighbouring slots share bytes.
+    std::vector<packet_t> ints_;   // Packets at node (and delivered at egress) of steps, latencies of samples.
+    std::vector<double> doubles_;  // Port utilization of steps.
+
+    alignas(64) std::atomic<std::uint32_t> head_{0};  // Records published by the simulation.
+    alignas(64) std::atomic<std::uint32_t> tail_{0};  // Records written by the writer.
+    alignas(64) std::string buffer_;                  // Formatted by the writer, not written out yet.
+    std::thread thread_;
+};
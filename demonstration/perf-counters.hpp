@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+    A group of hardware counters of this thread (perf_event_open, user space only): cycles, instructions, cache misses
+    and branch misses, scheduled onto the PMU together so their ratios are consistent. Read in user space with rdpmc
+    when the kernel allows it (x86, cap_user_rdpmc), which costs tens of cycles, otherwise with one read() of the group.
+    When the counters cannot be opened (no PMU in a VM, perf_event_paranoid, not Linux), available() is false, error()
+    says why and read() returns zeros.
+*/
+class PerfCounters {
+public:
+    enum Counter { cycles, instructions, cache_misses, branch_misses, count };
+    static constexpr std::array<const char*, count> NAMES{"cycles", "instructions", "cache_misses", "branch_misses"};
+    using Values = std::array<std::uint64_t, count>;
+
+    PerfCounters() {
+#if defined(__linux__)
+        constexpr std::array<std::uint64_t, count> CONFIGS{
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int counter = 0; counter < count; ++counter) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = CONFIGS[counter];
+            attr.disabled = counter == 0;  // The group is enabled at once through the leader.
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            const int leader = counter == 0 ? -1 : fds_[0];
+            fds_[counter] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fds_[counter] < 0) {
+                error_ = std::string("perf_event_open(") + NAMES[counter] + "): " + std::strerror(errno);
+                close_all();
+                return;
+            }
+            // The first page of the mapping tells whether and how rdpmc can read the counter.
+            void* page = mmap(nullptr, static_cast<std::size_t>(sysconf(_SC_PAGESIZE)), PROT_READ, MAP_SHARED, fds_[counter], 0);
+            pages_[counter] = page == MAP_FAILED ? nullptr : static_cast<perf_event_mmap_page*>(page);
+        }
+        ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+        error_ = "perf_event_open is only available on Linux";
+#endif
+    }
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    ~PerfCounters() { close_all(); }
+
+    [[nodiscard]] bool available() const { return fds_[0] >= 0; }
+    [[nodiscard]] const std::string& error() const { return error_; }
+
+    // Counts since the counters were opened.
+    [[nodiscard]] Values read() const {
+        Values values{};
+        if (!available()) return values;
+#if defined(__linux__)
+        bool user_read = true;
+        for (int counter = 0; counter < count && user_read; ++counter) {
+            user_read = read_user(counter, values[counter]);
+        }
+        if (user_read) return values;
+        struct { std::uint64_t nr; std::uint64_t values[count]; } group{};
+        if (::read(fds_[0], &group, sizeof(group)) == static_cast<ssize_t>(sizeof(group))) {
+            std::memcpy(values.data(), group.values, sizeof(group.values));
+        }
+#endif
+        return values;
+    }
+
+private:
+#if defined(__linux__)
+    // The seqlock protocol of perf_event_mmap_page, false if the counter cannot be read in user space.
+    bool read_user(int counter, std::uint64_t& value) const {
+#if defined(__x86_64__) || defined(__i386__)
+        const volatile perf_event_mmap_page* page = pages_[counter];
+        if (page == nullptr || !page->cap_user_rdpmc) return false;
+        std::uint32_t seq;
+        do {
+            seq = page->lock;
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            const std::uint32_t index = page->index;
+            if (index == 0) return false;  // Not currently on the PMU.
+            const int shift = 64 - page->pmc_width;
+            const auto pmc = static_cast<std::int64_t>(static_cast<std::uint64_t>(__rdpmc(static_cast<int>(index - 1))) << shift) >> shift;
+            value = static_cast<std::uint64_t>(page->offset + pmc);
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        } while (page->lock != seq);
+        return true;
+#else
+        (void) counter;
+        (void) value;
+        return false;
+#endif
+    }
+#endif
+
+    void close_all() {
+#if defined(__linux__)
+        for (int counter = count - 1; counter >= 0; --counter) {
+            if (pages_[counter] != nullptr) munmap(pages_[counter], static_cast<std::size_t>(sysconf(_SC_PAGESIZE)));
+            if (fds_[counter] >= 0) ::close(fds_[counter]);
+            pages_[counter] = nullptr;
+            fds_[counter] = -1;
+        }
+#endif
+    }
+
+    std::array<int, count> fds_{-1, -1, -1, -1};
+#if defined(__linux__)
+    std::array<perf_event_mmap_page*, count> pages_{};
+#endif
+    std::string error_;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "adaptive-sampling.hpp"
+
+/*
+    The probability that a node overflows within a number of steps (the SMC query Pr[#<=steps](<> gDidOverflow)), by
+    fixed-effort multilevel splitting: instead of running independent simulations until enough of them overflow, which
+    for a probability of 1e-6 takes millions, the way to an overflow is cut into levels of the fullest node relative to
+    its capacity (Simulator::maxNodeOccupancy). Each stage runs the same number of simulations (the effort) from the
+    states in which the previous stage first reached its level, round-robin, until they reach the next level or run out
+    of steps. The probability is the product of the fractions that got through each stage.
+    The levels should be increasing and below 1 (the overflow is the last level), and close enough that a good fraction
+    of each stage gets through: the estimate is unbiased for any levels, its variance is smallest when the fractions
+    are about equal. The interval assumes independent stages (normal approximation of the relative error), so it is
+    narrower than the truth when a stage starts from few distinct states.
+    Every simulation of the first stage starts like a plain one (Simulator::reset_run), and a restored state continues
+    as the simulation it was saved from would have (Simulator::State), so the estimate is of the same probability as
+    plain Monte Carlo (check overflow compares them). Splitting only gains where a simulation draws after the split, as
+    the demand variance (Simulator::set_demand_variance) does every step. The scheduler's random numbers (valiant) are
+    drawn once at the start and kept, so without demand variance its trials from the same state all take the same path,
+    and the estimate is no better than plain runs of the first stage's effort.
+*/
+struct SplittingOptions {
+    int steps = 0;                                               // Of the query, counted from the start.
+    std::vector<double> levels{0.5, 0.6, 0.7, 0.8, 0.9, 0.95};  // Of maxNodeOccupancy.
+    int effort = 1000;                                           // Simulations per stage.
+    double confidence = 0.95;
+};
+
+// Comma separated, e.g. "0.6,0.8,0.9".
+inline std::vector<double> parse_splitting_levels(const std::string& text) {
+    std::vector<double> levels;
+    std::istringstream in(text);
+    std::string level;
+    while (std::getline(in, level, ',')) levels.push_back(std::stod(level));
+    for (std::size_t i = 0; i < levels.size(); ++i) {
+        if (!(levels[i] > 0 && levels[i] < 1) || (i > 0 && levels[i] <= levels[i - 1])) {
+            throw std::invalid_argument("Splitting levels must be increasing and between 0 and 1: " + text);
+        }
+    }
+    return levels;
+}
+
+struct OverflowEstimate {
+    struct Stage {
+        double level = 0;  // Reached by hits of the trials, infinity for the overflow.
+        int trials = 0;
+        int hits = 0;
+        std::int64_t steps = 0;  // Simulated in this stage.
+    };
+    std::vector<Stage> stages;
+    int steps = 0;
+    double confidence = 0;
+    double probability = 0;
+    double relative_error = 0;  // Standard deviation over the probability, 0 when no overflow was seen.
+
+    [[nodiscard]] std::int64_t simulated_steps() const {
+        std::int64_t total = 0;
+        for (const auto& stage : stages) total += stage.steps;
+        return total;
+    }
+    // Of independent simulations for the same relative error, each simulating all steps (as one that does not
+    // overflow does), -1 without an estimate.
+    [[nodiscard]] double monte_carlo_steps() const {
+        if (probability <= 0 || relative_error <= 0) return -1;
+        return (1 - probability) / (probability * relative_error * relative_error) * steps;
+    }
+
+    // {"steps": ..., "probability": ..., "relative_error": ..., "confidence": ..., "interval": [low, high],
+    //  "simulated_steps": ..., "monte_carlo_steps": ..., "stages": [{"level": ..., "trials": ..., "hits": ..., "steps": ...}, ...]}
+    // on one line; the level of the last stage (the overflow) is 1.
+    void write_json(std::ostream& out) const {
+        const double half_width = normal_quantile(0.5 + confidence / 2) * relative_error * probability;
+        out << "{\"steps\": " << steps << ", \"probability\": " << probability << ", \"relative_error\": " << relative_error
+            << ", \"confidence\": " << confidence << ", \"interval\": [" << std::fmax(0.0, probability - half_width) << ", "
+            << probability + half_width << "], \"simulated_steps\": " << simulated_steps()
+            << ", \"monte_carlo_steps\": " << monte_carlo_steps() << ", \"stages\": [";
+        for (std::size_t i = 0; i < stages.size(); ++i) {
+            out << (i == 0 ? "" : ", ") << "{\"level\": " << (std::isfinite(stages[i].level) ? stages[i].level : 1.0)
+                << ", \"trials\": " << stages[i].trials << ", \"hits\": " << stages[i].hits << ", \"steps\": " << stages[i].steps << "}";
+        }
+        out << "]}";
+    }
+};
+
+template <typename Sim>
+OverflowEstimate estimate_overflow_probability(Sim& sim, const SplittingOptions& options) {
+    if (options.steps < 1 || options.effort < 1) throw std::invalid_argument("Splitting needs steps and an effort of at least 1");
+    OverflowEstimate estimate;
+    estimate.steps = options.steps;
+    estimate.confidence = options.confidence;
+
+    // Runs the simulation on until it reaches the level (true) or the steps are used up (false).
+    auto reach = [&sim, &options](double level, std::int64_t& steps) {
+        auto reached = [&] { return sim.gDidOverflow || sim.maxNodeOccupancy() >= level; };
+        while (!reached()) {
+            if (sim.gCurrentStep >= options.steps) return false;
+            sim.simulatePhase();
+            steps++;
+        }
+        return true;
+    };
+
+    // Entrance states of the level reached last, and of the one being reached.
+    std::vector<typename Sim::State> entrances(options.effort), next(options.effort);
+    int num_entrances = 0;
+    double relative_variance = 0;
+    estimate.probability = 1;
+    for (std::size_t stage = 0; stage <= options.levels.size(); ++stage) {
+        OverflowEstimate::Stage result;
+        result.level = stage < options.levels.size() ? options.levels[stage] : std::numeric_limits<double>::infinity();
+        result.trials = options.effort;
+        for (int trial = 0; trial < options.effort; ++trial) {
+            if (stage == 0) {
+                sim.reset_run();
+            } else {
+                sim.restore_state(entrances[trial % num_entrances]);
+            }
+            if (reach(result.level, result.steps)) sim.save_state(next[result.hits++]);
+        }
+        estimate.stages.push_back(result);
+        const double fraction = static_cast<double>(result.hits) / result.trials;
+        estimate.probability *= fraction;
+        if (result.hits == 0) {
+            relative_variance = 0;
+            break;
+        }
+        relative_variance += (1 - fraction) / (fraction * result.trials);
+        std::swap(entrances, next);
+        num_entrances = result.hits;
+    }
+    estimate.relative_error = std::sqrt(relative_variance);
+    return estimate;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <dlfcn.h>
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include "sim-engine.hpp"
+
+/*
+    A scheduler library (libfixed.so, librotor_lb.so, ...) loaded at runtime.
+    Each library is opened with RTLD_LOCAL, so several schedulers can be loaded side by side, each with its own network
+    state. That state is global per library, unless it was built with EXT_THREAD_LOCAL_STATE: a simulation must hold
+    lock() while it uses a scheduler without thread_local_state(). The libraries are kept in a registry of the process
+    by their real path, so every SchedulerLibrary of the same library (also through another path or a symlink) shares
+    one handle, and with it one state and one lock. The library is closed with its last SchedulerLibrary.
+*/
+class SchedulerLibrary {
+public:
+    explicit SchedulerLibrary(std::string path) : path_(std::move(path)), loaded_(load(path_)) {}
+
+    [[nodiscard]] const std::string& path() const { return path_; }
+    [[nodiscard]] const SchedulerApi& api() const { return loaded_->api; }
+    [[nodiscard]] bool thread_local_state() const { return loaded_->thread_local_state; }
+    [[nodiscard]] std::unique_lock<std::mutex> lock() { return std::unique_lock(loaded_->mutex); }
+
+    // Replaces the environment as the source of the settings of the scheduler (e.g. CHOICE_APPROACH) by settings, or
+    // goes back to it with nullopt (extConfigure), from the next simulation. Under lock(), or on the thread of the
+    // simulations with thread_local_state(). Throws std::invalid_argument for settings a library built before
+    // extConfigure cannot take.
+    void configure(const std::optional<std::map<std::string, std::string>>& settings) const {
+        const auto configure = loaded_->api.configure;
+        if (configure == nullptr) {
+            if (settings) throw std::invalid_argument("Scheduler library " + path_ + " cannot be configured (extConfigure)");
+            return;
+        }
+        if (!settings) {
+            configure(nullptr);
+            return;
+        }
+        std::string text;
+        for (const auto& [name, value] : *settings) {
+            if (name.empty() || name.find_first_of("=\n") != std::string::npos || value.find('\n') != std::string::npos) {
+                throw std::invalid_argument("Bad scheduler setting: " + name);
+            }
+            text += name + "=" + value + "\n";
+        }
+        configure(text.c_str());
+    }
+
+private:
+    struct Loaded {
+        explicit Loaded(const std::string& path) : handle(dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL)) {
+            if (handle == nullptr) {
+                throw std::runtime_error("Could not load scheduler library: " + std::string(dlerror()));
+            }
+            try {
+                api.push_network = resolve<decltype(api.push_network)>(path, "extPushNetwork");
+                api.push_topology = resolve<decltype(api.push_topology)>(path, "extPushTopology");
+                api.push_flow = resolve<decltype(api.push_flow)>(path, "extPushFlow");
+                api.scheduler_init = resolve<decltype(api.scheduler_init)>(path, "extSchedulerInit");
+                api.get_schedule_choice_all = resolve<decltype(api.get_schedule_choice_all)>(path, "extGetScheduleChoiceAll");
+                // Optional, libraries built before they were added keep global state and cannot be seeded.
+                api.seed = reinterpret_cast<decltype(api.seed)>(dlsym(handle, "extSeed"));
+                api.report = reinterpret_cast<decltype(api.report)>(dlsym(handle, "extSchedulerReport"));
+                api.static_schedule = reinterpret_cast<decltype(api.static_schedule)>(dlsym(handle, "extStaticSchedule"));
+                api.configure = reinterpret_cast<decltype(api.configure)>(dlsym(handle, "extConfigure"));
+                if (auto* local_state = reinterpret_cast<int32_t (*)()>(dlsym(handle, "extThreadLocalState"))) {
+                    thread_local_state = local_state() != 0;
+                }
+            } catch (...) {
+                dlclose(handle);
+                throw;
+            }
+        }
+        ~Loaded() { dlclose(handle); }
+        Loaded(const Loaded&) = delete;
+        Loaded& operator=(const Loaded&) = delete;
+
+        template <typename Fn>
+        Fn resolve(const std::string& path, const char* name) {
+            void* symbol = dlsym(handle, name);
+            if (symbol == nullptr) {
+                throw std::runtime_error("Scheduler library " + path + " does not define " + name);
+            }
+            return reinterpret_cast<Fn>(symbol);
+        }
+
+        void* handle;
+        SchedulerApi api;
+        bool thread_local_state = false;
+        std::mutex mutex;  // Held by the simulation using the library, unless thread_local_state.
+    };
+
+    // The library at the path from the registry, loaded if no SchedulerLibrary holds it.
+    static std::shared_ptr<Loaded> load(const std::string& path) {
+        static std::mutex registry_mutex;
+        static std::map<std::string, std::weak_ptr<Loaded>> registry;  // By real path.
+        std::error_code error;
+        auto key = std::filesystem::canonical(path, error).string();
+        if (error) key = path;  // Not a file, left to dlopen (which also searches the library path).
+        const std::lock_guard guard(registry_mutex);
+        auto& entry = registry[key];
+        auto loaded = entry.lock();
+        if (!loaded) {
+            loaded = std::make_shared<Loaded>(key);
+            entry = loaded;
+        }
+        return loaded;
+    }
+
+    std::string path_;
+    std::shared_ptr<Loaded> loaded_;
+};
@@ -0,0 +1,220 @@
+// Microbenchmarks of the schedulers and their building blocks on synthetic rotor networks (Google Benchmark).
+// Networks are parameterized by nodes N, flows F, switches S and phases P (benchmark_network in generators.hpp, shared
+// with sim_bench): in phase p, switch sw connects node n to n + 1 + ((p * S + sw) mod (N - 1)), and the flows are
+// between random node pairs. Benchmarks "per phase" or "per destination" time one phase or destination per iteration,
+// the N/F/S/P counters make the JSON output easy to plot:
+//     scheduler_bench --benchmark_out=schedulers.json --benchmark_out_format=json
+//
+// extGetScheduleChoiceAll is measured for every scheduler library (fixed, valiant and rotor_lb, loaded as the simulator
+// loads them, see scheduler-library.hpp); TemporalGraph construction, computeToDestination, fairshare_1d and
+// accept_offers directly. Schedulers are configured through their usual environment variables, e.g.
+// ROTORLB_INCREMENTAL. The time per phase of RotorLB alone:
+//     scheduler_bench --benchmark_filter=ScheduleChoiceAll/rotor_lb
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "generators.hpp"
+#include "route_table.hpp"
+#include "rotor_lb.hpp"
+#include "scheduler-library.hpp"
+#include "temporal_graph.hpp"
+
+constexpr int NUM_BUFFER_SNAPSHOTS = 8;
+
+// The network state of this binary is only used directly (TemporalGraph, RotorLbTable), never as a scheduler.
+void init_scheduler() {}
+void prepare_scheduler_choices() {}
+int32_t scheduler_choice(node_t, flow_t, phase_t, switch_t) { return 0; }
+void scheduler_report(std::ostream&) {}
+bool scheduler_static_choices() { return false; }
+
+// The benchmark network of the N, F, S and P arguments.
+struct Scenario {
+    node_t num_nodes;
+    flow_t num_flows;
+    switch_t num_switches;
+    phase_t num_phases;
+    GeneratedModel network;
+
+    explicit Scenario(const benchmark::State& state)
+    : num_nodes(state.range(0)), num_flows(state.range(1)), num_switches(state.range(2)), num_phases(state.range(3)),
+      network(benchmark_network(num_nodes, num_flows, num_switches, num_phases, 0)) {}
+
+    [[nodiscard]] const node_t* targets(phase_t phase) const {
+        return &network.topology.targets[static_cast<std::size_t>(phase) * num_nodes * num_switches];
+    }
+    [[nodiscard]] Topology topology() const {
+        Topology topology(num_phases, num_nodes, num_switches);
+        topology.resizeLimits();
+        std::ranges::fill(topology.capacities, network.capacity);
+        std::ranges::fill(topology.bandwidths, network.bandwidth);
+        for (phase_t phase = 0; phase < num_phases; ++phase) topology.pushTopology(phase, targets(phase));
+        return topology;
+    }
+    [[nodiscard]] const std::vector<Flow>& flows() const { return network.traffic.flows; }
+    // Buffer contents to cycle through. Transit traffic (at nodes other than the ingress) is kept small enough to be
+    // sent directly, as RotorLB ensures when it accepts offers.
+    [[nodiscard]] std::vector<std::vector<packet_t>> buffer_snapshots() const {
+        const auto& flows = this->flows();
+        std::vector<int> flows_to_egress(num_nodes);
+        for (const auto& flow : flows) flows_to_egress[flow.egress]++;
+        std::mt19937 gen(654321);
+        std::uniform_int_distribution<packet_t> amount_dist(0, 200);
+        std::vector<std::vector<packet_t>> buffers(NUM_BUFFER_SNAPSHOTS, std::vector<packet_t>(num_nodes * num_flows));
+        for (auto& snapshot : buffers) {
+            for (node_t node = 0; node < num_nodes; ++node) {
+                for (flow_t flow = 0; flow < num_flows; ++flow) {
+                    const auto& [ingress, egress] = flows[flow];
+                    const packet_t transit_limit = network.bandwidth / flows_to_egress[egress] / 2;
+                    snapshot[node * num_flows + flow] = node == ingress ? amount_dist(gen) : amount_dist(gen) % (transit_limit + 1);
+                }
+            }
+        }
+        return buffers;
+    }
+    void set_counters(benchmark::State& state) const {
+        state.counters["N"] = num_nodes;
+        state.counters["F"] = num_flows;
+        state.counters["S"] = num_switches;
+        state.counters["P"] = num_phases;
+    }
+};
+
+void network_sizes(benchmark::internal::Benchmark* b) {
+    for (const auto& [n, f, s, p] : benchmark_network_sizes()) b->Args({n, f, s, p});
+    b->ArgNames({"N", "F", "S", "P"});
+}
+
+/*** SCHEDULERS ***/
+
+void BM_ScheduleChoiceAll(benchmark::State& state, const std::string& path) {
+    const Scenario scenario(state);
+    std::unique_ptr<SchedulerLibrary> library;
+    try {
+        library = std::make_unique<SchedulerLibrary>(path);
+    } catch (const std::exception& e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+    const auto& scheduler = library->api();
+    const auto topology = scenario.topology();
+    scheduler.push_network(scenario.num_phases, scenario.num_nodes, scenario.num_flows, scenario.num_switches,
+                           topology.capacities.data(), topology.bandwidths.data());
+    for (phase_t phase = 0; phase < scenario.num_phases; ++phase) scheduler.push_topology(phase, scenario.targets(phase));
+    const auto& flows = scenario.flows();
+    for (flow_t flow = 0; flow < scenario.num_flows; ++flow) scheduler.push_flow(flow, flows[flow].ingress, flows[flow].egress);
+    scheduler.scheduler_init();
+
+    const auto buffers = scenario.buffer_snapshots();
+    std::vector<int32_t> output(scenario.num_nodes * scenario.num_flows * (scenario.num_switches + 1));
+    int64_t calls = 0;
+    for (auto _ : state) {
+        scheduler.get_schedule_choice_all(calls % scenario.num_phases, buffers[calls % NUM_BUFFER_SNAPSHOTS].data(), output.data());
+        benchmark::DoNotOptimize(output.data());
+        calls++;
+    }
+    state.SetItemsProcessed(calls);
+    scenario.set_counters(state);
+}
+
+/*** BUILDING BLOCKS ***/
+
+void BM_TemporalGraph(benchmark::State& state) {
+    const Scenario scenario(state);
+    const auto topology = scenario.topology();
+    for (auto _ : state) {
+        tg::TemporalGraph graph(topology);
+        benchmark::DoNotOptimize(graph.graph);
+    }
+    scenario.set_counters(state);
+}
+
+// Per destination.
+void BM_ComputeToDestination(benchmark::State& state) {
+    const Scenario scenario(state);
+    tg::TemporalGraph graph(scenario.topology());
+    std::vector<ScheduleChoice> choices(scenario.num_phases * scenario.num_nodes * scenario.num_nodes);
+    node_t destination = 0;
+    for (auto _ : state) {
+        tg::computeToDestination(graph, tg::RouteWeight::quickest, destination, choices);
+        benchmark::DoNotOptimize(choices.data());
+        destination = (destination + 1) % scenario.num_nodes;
+    }
+    state.SetItemsProcessed(state.iterations());
+    scenario.set_counters(state);
+}
+
+// A vector of N demands shared fairly over half of their total.
+void BM_FairShare1d(benchmark::State& state) {
+    const auto size = state.range(0);
+    std::mt19937 gen(123456);
+    std::uniform_int_distribution<packet_t> amount_dist(0, 200);
+    std::vector<packet_t> demands(size);
+    for (auto& demand : demands) demand = amount_dist(gen);
+    const packet_t capacity = std::reduce(demands.begin(), demands.end()) / 2;
+    std::vector<packet_t> v;
+    for (auto _ : state) {
+        v = demands;
+        fairshare_1d(v, capacity);
+        benchmark::DoNotOptimize(v.data());
+    }
+    state.counters["N"] = static_cast<double>(size);
+}
+
+// Acceptance of the offers of all nodes, per phase (as in one RotorLB call). Offers are rebuilt outside the timing.
+void BM_AcceptOffers(benchmark::State& state) {
+    const Scenario scenario(state);
+    const auto topology = scenario.topology();
+    extPushNetwork(scenario.num_phases, scenario.num_nodes, scenario.num_flows, scenario.num_switches,
+                   topology.capacities.data(), topology.bandwidths.data());
+    for (phase_t phase = 0; phase < scenario.num_phases; ++phase) extPushTopology(phase, scenario.targets(phase));
+    const auto& flows = scenario.flows();
+    for (flow_t flow = 0; flow < scenario.num_flows; ++flow) extPushFlow(flow, flows[flow].ingress, flows[flow].egress);
+    const auto buffers = scenario.buffer_snapshots();
+
+    int64_t calls = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        network.buffers.pushAllBuffers(buffers[calls % NUM_BUFFER_SNAPSHOTS].data());
+        std::vector<RotorLbTable> tables;
+        std::vector<std::vector<RotorLbTable::Offer>> offers;
+        build_tables(calls % scenario.num_phases, tables, offers);
+        state.ResumeTiming();
+        for (auto& table : tables) table.accept_offers(offers);
+        benchmark::DoNotOptimize(offers.data());
+        calls++;
+    }
+    state.SetItemsProcessed(calls);
+    scenario.set_counters(state);
+}
+
+BENCHMARK(BM_TemporalGraph)->Apply(network_sizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ComputeToDestination)->Apply(network_sizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_FairShare1d)->RangeMultiplier(2)->Range(16, 1024)->ArgName("N");
+BENCHMARK(BM_AcceptOffers)->Apply(network_sizes)->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char** argv) {
+    // Library paths are set by CMake, each can be overridden by an environment variable (e.g. ROSSA_BENCH_FIXED).
+    const std::pair<const char*, const char*> schedulers[] = {
+        {"fixed", std::getenv("ROSSA_BENCH_FIXED") ? std::getenv("ROSSA_BENCH_FIXED") : FIXED_LIBRARY},
+        {"valiant", std::getenv("ROSSA_BENCH_VALIANT") ? std::getenv("ROSSA_BENCH_VALIANT") : VALIANT_LIBRARY},
+        {"rotor_lb", std::getenv("ROSSA_BENCH_ROTOR_LB") ? std::getenv("ROSSA_BENCH_ROTOR_LB") : ROTOR_LB_LIBRARY},
+    };
+    for (const auto& [name, path] : schedulers) {
+        benchmark::RegisterBenchmark((std::string("BM_ScheduleChoiceAll/") + name).c_str(), BM_ScheduleChoiceAll, std::string(path))
+            ->Apply(network_sizes)
+            ->Unit(benchmark::kMicrosecond);
+    }
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
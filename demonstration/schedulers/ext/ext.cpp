@@ -1,10 +1,42 @@
 #include "ext.hpp"
+#include "route_table.hpp"
 
 #include <cassert>
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
 #include <vector>
 
-Network network;
+EXT_STATE Network network;
+EXT_STATE std::mt19937 schedulerRandom{std::random_device{}()};
+// Replace the environment when configured (extConfigure).
+EXT_STATE std::optional<std::map<std::string, std::string, std::less<>>> settings;
+
+void extConfigure(const char* text) {
+    if (text == nullptr) {
+        settings.reset();
+        return;
+    }
+    settings.emplace();
+    std::istringstream lines(text);
+    for (std::string line; std::getline(lines, line);) {
+        const auto equals = line.find('=');
+        if (equals == std::string::npos) continue;
+        (*settings)[line.substr(0, equals)] = line.substr(equals + 1);
+    }
+}
+
+const char* ext_setting(const char* name) {
+    if (!settings) return std::getenv(name);
+    const auto setting = settings->find(std::string_view(name));
+    return setting == settings->end() ? nullptr : setting->second.c_str();
+}
 
 int32_t Buffers::operator()(node_t node, flow_t flow) const {
     return values_[node * flows_ + flow];
@@ -82,6 +114,7 @@ void extPushNetwork(int32_t num_phases, int32_t num_nodes, int32_t num_flows, in
     network.topology.resizeLimits();
     network.flows.resize(num_flows);
     network.buffers = Buffers(num_nodes, num_flows);
+    network.revision++;
 
     for (node_t node = 0; node < num_nodes; ++node) {
         network.topology.capacities[node] = node_capacities[node];
@@ -93,18 +126,132 @@ void extPushNetwork(int32_t num_phases, int32_t num_nodes, int32_t num_flows, in
 
 void extPushTopology(phase_t phase, const node_t* targets) {
     network.topology.pushTopology(phase, targets);
+    network.revision++;
+}
+
+/*
+    The deadline of a call. A rotor switch has one slot to decide the next phase in: with EXT_TIME_BUDGET_US set, a
+    call to extGetScheduleChoiceAll that takes longer is discarded and the fallback (EXT_FALLBACK) served instead, as a
+    controller that misses its deadline would. Overruns, how far over the budget they were, how many choices the
+    fallback changed and how the buffers grew after on-time and fallback choices are counted per simulation
+    (extSchedulerReport). This makes any scheduler non-deterministic, so do not use it with UPPAAL.
+*/
+enum class Fallback {
+    previous,  // The choices served in the same phase one rotor cycle earlier (none before the first).
+    quickest,  // Fixed quickest routes, as the fixed scheduler.
+    hold       // No choices, nothing is sent.
+};
+struct Deadline {
+    std::chrono::microseconds budget{0};  // 0: unbounded.
+    Fallback fallback = Fallback::previous;
+};
+EXT_STATE Deadline deadline;
+// The fallback choices of every phase, each num_nodes x num_flows x (num_switches + 1) as served.
+EXT_STATE std::vector<int32_t> fallbackChoices;
+EXT_STATE uint64_t fallbackRevision = 0;
+EXT_STATE Fallback fallbackFilled = Fallback::hold;
+
+struct DeadlineReport {
+    uint64_t calls = 0;
+    uint64_t overruns = 0;
+    std::chrono::nanoseconds over_budget{0};  // Summed over the overruns.
+    std::chrono::nanoseconds max_over_budget{0};
+    uint64_t changed_choices = 0;  // Entries in which the fallback differs from the late choices.
+    // Growth of the buffered packets over the phase following on-time and fallback choices.
+    int64_t growth_on_time = 0;
+    uint64_t phases_on_time = 0;
+    int64_t growth_fallback = 0;
+    uint64_t phases_fallback = 0;
+    // Of the last call of the simulation, -1 before the first.
+    int64_t last_buffered = -1;
+    bool last_overrun = false;
+
+    // {"budget_us": ..., "calls": ..., "overruns": ..., "mean_over_budget_us": ..., "max_over_budget_us": ...,
+    //  "changed_choices": ..., "growth_on_time": ..., "growth_fallback": ...} with the growth in packets per phase.
+    void write_json(std::ostream& out) const {
+        using micros = std::chrono::duration<double, std::micro>;
+        out << "{\"budget_us\": " << deadline.budget.count() << ", \"calls\": " << calls << ", \"overruns\": " << overruns
+            << ", \"mean_over_budget_us\": " << (overruns > 0 ? micros(over_budget).count() / overruns : 0.0)
+            << ", \"max_over_budget_us\": " << micros(max_over_budget).count() << ", \"changed_choices\": " << changed_choices
+            << ", \"growth_on_time\": " << (phases_on_time > 0 ? static_cast<double>(growth_on_time) / phases_on_time : 0.0)
+            << ", \"growth_fallback\": " << (phases_fallback > 0 ? static_cast<double>(growth_fallback) / phases_fallback : 0.0)
+            << "}";
+    }
+};
+EXT_STATE DeadlineReport deadlineReport;
+
+void readDeadlineEnvVars() {
+    deadline = {};
+    if (const auto *envVal = ext_setting("EXT_TIME_BUDGET_US")) {
+        char *end = nullptr;
+        const long value = std::strtol(envVal, &end, 10);
+        if (end == envVal || *end != '\0' || value <= 0 || value > INT32_MAX) {
+            throw EnvVarException(std::string("Bad EXT_TIME_BUDGET_US: ") + envVal);
+        }
+        deadline.budget = std::chrono::microseconds(value);
+    }
+    if (const auto *envVal = ext_setting("EXT_FALLBACK")) {
+        if (std::strcmp(envVal, "PREVIOUS") == 0) {
+            deadline.fallback = Fallback::previous;
+        } else if (std::strcmp(envVal, "QUICKEST") == 0) {
+            deadline.fallback = Fallback::quickest;
+        } else if (std::strcmp(envVal, "HOLD") == 0) {
+            deadline.fallback = Fallback::hold;
+        } else {
+            throw EnvVarException(std::string("Bad EXT_FALLBACK: ") + envVal);
+        }
+    }
 }
 
+size_t choicesPerPhase() {
+    return static_cast<size_t>(network.topology.num_nodes) * network.num_flows() * (network.topology.num_switches + 1);
+}
+
+// The fallback of every phase, before a simulation. Quickest routes are kept while the network is unchanged.
+void prepareFallback() {
+    const auto size = choicesPerPhase() * network.topology.num_phases;
+    if (deadline.fallback == Fallback::quickest) {
+        if (fallbackFilled == Fallback::quickest && fallbackRevision == network.revision && fallbackChoices.size() == size) return;
+        const auto routes = tg::sharedRouteTable(network.topology, tg::RouteWeight::quickest);
+        fallbackChoices.resize(size);
+        int32_t *output = fallbackChoices.data();
+        for (phase_t phase = 0; phase < network.topology.num_phases; ++phase) {
+            for (node_t node = 0; node < network.topology.num_nodes; ++node) {
+                for (flow_t flow = 0; flow < network.num_flows(); ++flow) {
+                    const auto choice = (*routes)(phase, node, network.flows[flow].egress);
+                    *output++ = 0;
+                    for (switch_t sw = 0; sw < network.topology.num_switches; ++sw) {
+                        *output++ = phase == choice.phase && network.topology.port_of(node, sw) == choice.port ? 1 : 0;
+                    }
+                }
+            }
+        }
+        fallbackRevision = network.revision;
+    } else {
+        fallbackChoices.assign(size, 0);
+    }
+    fallbackFilled = deadline.fallback;
+}
+
+bool ext_deadline_active() { return deadline.budget.count() > 0; }
+
 void extSchedulerInit() {
     network.buffers.fill(0);
+    readDeadlineEnvVars();
+    if (deadline.budget.count() > 0) {
+        prepareFallback();
+        deadlineReport = {};
+    }
     init_scheduler();
 }
 
 void extPushFlow(flow_t flow, node_t ingress, node_t egress) {
     network.flows[flow] = Flow{ingress, egress};
+    network.revision++;
 }
 
-void extGetScheduleChoiceAll(phase_t phase, const packet_t* buffer_data, int32_t* schedule_choice_output) {
+// The choices of the scheduler, however long they take.
+void getScheduleChoiceAll(phase_t phase, const packet_t* buffer_data, int32_t* schedule_choice_output) {
     network.buffers.pushAllBuffers(buffer_data);
     prepare_scheduler_choices();
     int i = 0;
@@ -117,3 +264,69 @@ void extGetScheduleChoiceAll(phase_t phase, const packet_t* buffer_data, int32_t
         }
     }
 }
+
+void extGetScheduleChoiceAll(phase_t phase, const packet_t* buffer_data, int32_t* schedule_choice_output) {
+    if (deadline.budget.count() == 0) {
+        getScheduleChoiceAll(phase, buffer_data, schedule_choice_output);
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    getScheduleChoiceAll(phase, buffer_data, schedule_choice_output);
+    const auto over_budget = std::chrono::steady_clock::now() - start - deadline.budget;
+
+    auto& report = deadlineReport;
+    const auto size = choicesPerPhase();
+    int64_t buffered = 0;
+    for (size_t i = 0; i < static_cast<size_t>(network.topology.num_nodes) * network.num_flows(); ++i) buffered += buffer_data[i];
+    if (report.last_buffered >= 0) {
+        (report.last_overrun ? report.growth_fallback : report.growth_on_time) += buffered - report.last_buffered;
+        (report.last_overrun ? report.phases_fallback : report.phases_on_time)++;
+    }
+    report.last_buffered = buffered;
+    report.calls++;
+    report.last_overrun = over_budget.count() > 0;
+
+    int32_t *fallback = &fallbackChoices[phase * size];
+    if (report.last_overrun) {
+        report.overruns++;
+        report.over_budget += over_budget;
+        report.max_over_budget = std::max<std::chrono::nanoseconds>(report.max_over_budget, over_budget);
+        for (size_t i = 0; i < size; ++i) report.changed_choices += schedule_choice_output[i] != fallback[i];
+        std::copy_n(fallback, size, schedule_choice_output);
+    } else if (deadline.fallback == Fallback::previous) {
+        std::copy_n(schedule_choice_output, size, fallback);
+    }
+}
+
+int32_t extThreadLocalState() {
+#ifdef EXT_THREAD_LOCAL_STATE
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int32_t extStaticSchedule() {
+    return scheduler_static_choices() && deadline.budget.count() == 0 ? 1 : 0;
+}
+
+void extSeed(uint32_t seed) {
+    schedulerRandom.seed(seed);
+}
+
+const char* extSchedulerReport() {
+    static EXT_STATE std::string report;
+    std::ostringstream scheduler;
+    scheduler_report(scheduler);
+    const std::string members = scheduler.str();
+    std::ostringstream out;
+    out << "{";
+    if (deadline.budget.count() > 0) {
+        out << "\"deadline\": ";
+        deadlineReport.write_json(out);
+        if (!members.empty()) out << ", ";
+    }
+    out << members << "}";
+    report = out.str();
+    return report.c_str();
+}
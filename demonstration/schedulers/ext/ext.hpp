@@ -1,6 +1,11 @@
 #pragma once
 
 #include <cstdint>
+#include <exception>
+#include <iosfwd>
+#include <random>
+#include <string>
+#include <utility>
 #include <vector>
 
 // These match the types used in UPPAALs C-like language.
@@ -75,12 +80,37 @@ struct Network {
     Topology topology;
     std::vector<Flow> flows;
     Buffers buffers;
+    // Incremented whenever the network (not the buffers) is pushed, so schedulers know when to rebuild derived data.
+    uint64_t revision = 0;
 
     [[nodiscard]] flow_t num_flows() const { return flows.size(); }
 };
 
+// Storage of scheduler state. Built with EXT_THREAD_LOCAL_STATE, each thread has its own network and scheduler state,
+// such that independent simulations can run concurrently on different threads (see sweep.cpp). A single simulation
+// must then make all its calls from the same thread.
+#ifdef EXT_THREAD_LOCAL_STATE
+    #define EXT_STATE thread_local
+#else
+    #define EXT_STATE
+#endif
+
+// Thrown for an environment variable set to a value the scheduler does not understand.
+class EnvVarException : public std::exception {
+public:
+    EnvVarException() = default;
+    explicit EnvVarException(std::string message) : message_(std::move(message)) {}
+    [[nodiscard]] const char *what() const noexcept override { return message_.c_str(); }
+
+private:
+    std::string message_ = "Bad ENV var set";
+};
+
 // Schedulers can access topology, flow, and buffer data through this instance
-extern Network network;
+extern EXT_STATE Network network;
+// Randomized schedulers draw from this generator. Seeded from std::random_device, unless the simulator seeds it
+// (extSeed) to make runs reproducible, e.g. to compare schedulers on common random numbers.
+extern EXT_STATE std::mt19937 schedulerRandom;
 
 #ifdef __cplusplus
 extern "C" {
@@ -91,9 +121,31 @@ void extPushTopology(phase_t phase, const node_t *targets);
 void extPushFlow(flow_t flow, node_t ingress, node_t egress);
 void extSchedulerInit(); // Called before each query. Calls scheduler_init()
 void extGetScheduleChoiceAll(phase_t phase, const packet_t* buffer_data, int32_t* schedule_choice_output);
+// Returns 1 if built with EXT_THREAD_LOCAL_STATE, 0 otherwise.
+int32_t extThreadLocalState();
+// Seeds schedulerRandom.
+void extSeed(uint32_t seed);
+// The counters of the scheduler since the last extSchedulerInit, as a JSON object ("{}" without any), e.g. for the sim
+// binary to report per simulation. Valid until the next call.
+const char* extSchedulerReport();
+// Replaces the environment as the source of the settings of the scheduler (ext_setting) by settings, "NAME=VALUE"
+// lines, e.g. for simulations in one process with different settings; nullptr goes back to the environment. Applies
+// from the next extSchedulerInit.
+void extConfigure(const char* settings);
+// Returns 1 if the choices in a phase are always the same (scheduler_static_choices and no EXT_TIME_BUDGET_US), so
+// they can be asked for once per phase with any buffers, 0 otherwise. After extSchedulerInit.
+int32_t extStaticSchedule();
 }
 #endif
 
+// A setting of the scheduler (e.g. CHOICE_APPROACH): the environment variable, or the configured value (extConfigure);
+// nullptr if unset. Schedulers read their settings in init_scheduler, every simulation.
+const char* ext_setting(const char* name);
+
+// Whether the deadline (EXT_TIME_BUDGET_US) may serve the fallback instead of the choices of the scheduler, so that the
+// buffers need not be what its own choices lead to. Set by extSchedulerInit.
+bool ext_deadline_active();
+
 // Schedulers must implement:
 // Called before each UPPAAL query is run.
 void init_scheduler();
@@ -104,3 +156,11 @@ void prepare_scheduler_choices();
 // Called each simulation step, for all node, flow and switch combinations in the current phase.
 // REQUIREMENT: Calls to get_scheduler_choice must be deterministic given the function parameters as well as the content of network
 int32_t scheduler_choice(node_t node, flow_t flow, phase_t phase_i, switch_t sw);
+
+// Whether scheduler_choice depends on nothing but its parameters and the network pushed: not on the buffers, the
+// randomness or anything else that changes in a simulation.
+bool scheduler_static_choices();
+
+// Writes the counters of the scheduler since init_scheduler as members of a JSON object ("name": value, ...), nothing
+// without any.
+void scheduler_report(std::ostream& out);
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ext.hpp"
+
+/*
+    A recording of the choices a scheduler made (the output of extGetScheduleChoiceAll) in the calls of the simulations
+    of a run, written by the sim binary (--record-schedule) and served again by the replay scheduler (schedulers/replay),
+    so simulator-side settings can be varied without paying for the scheduler.
+    Every simulation is recorded on its own, as the choices differ between the simulations of a randomized scheduler
+    (valiant, seeded per simulation), with demand variance or with a deadline fallback (EXT_TIME_BUDGET_US). A
+    simulation without any call is not recorded. The choices of a call are stored as the difference to the last call in
+    the same phase (all zeros before the first, across simulations), so a schedule that repeats every rotor cycle costs
+    two bytes per call. Little-endian layout:
+        char magic[8] = "RSCHED02"
+        uint32 num_phases
+        uint32 num_nodes
+        uint32 num_flows
+        uint32 num_switches
+        uint64 num_simulations
+        simulations, each:
+            calls, each:
+                varint phase + 1
+                varint num_changes (0: the same choices as the last call in the phase)
+                num_changes x (varint gap, zigzag varint choice): a changed entry of the output (num_nodes x num_flows x
+                    (num_switches + 1)), gap unchanged entries after the previous change (or the start)
+            varint 0 (the end of the simulation)
+    The varints are LEB128. Replay serves the simulations in the order they were recorded, the next one from the first
+    call after the scheduler was initialized (extSchedulerInit), so the replaying run must make the same simulations in
+    the same order, none longer than recorded. It is exact as long as the simulations are (the same traffic, seed and
+    demand variance); the buffers are not looked at.
+    Recording and replay stream the file, keeping the last choices of every phase: num_phases copies of the output.
+*/
+namespace schedule_trace {
+
+constexpr char MAGIC[8] = {'R', 'S', 'C', 'H', 'E', 'D', '0', '2'};
+constexpr std::size_t HEADER_SIZE = 32;
+
+struct Dimensions {
+    uint32_t num_phases = 0;
+    uint32_t num_nodes = 0;
+    uint32_t num_flows = 0;
+    uint32_t num_switches = 0;
+
+    [[nodiscard]] std::size_t choices_per_call() const {
+        return static_cast<std::size_t>(num_nodes) * num_flows * (num_switches + 1);
+    }
+    bool operator==(const Dimensions& other) const {
+        return num_phases == other.num_phases && num_nodes == other.num_nodes && num_flows == other.num_flows &&
+               num_switches == other.num_switches;
+    }
+};
+
+class Writer {
+public:
+    Writer(const std::string& path, const Dimensions& dimensions)
+    : path_(path), out_(path, std::ios::binary), dimensions_(dimensions),
+      last_(dimensions.num_phases * dimensions.choices_per_call(), 0) {
+        if (!out_) throw std::runtime_error("Could not open schedule trace: " + path);
+        char header[HEADER_SIZE] = {};  // num_simulations is written by finish.
+        std::memcpy(header, MAGIC, sizeof(MAGIC));
+        const uint32_t sizes[] = {dimensions_.num_phases, dimensions_.num_nodes, dimensions_.num_flows, dimensions_.num_switches};
+        std::memcpy(header + 8, sizes, sizeof(sizes));
+        out_.write(header, sizeof(header));
+    }
+
+    // The following calls are of a new simulation.
+    void begin() {
+        if (in_simulation_) append_varint(0);
+        in_simulation_ = false;
+    }
+
+    // The choices of the next call.
+    void record(phase_t phase, const int32_t* choices) {
+        if (!in_simulation_) {
+            in_simulation_ = true;
+            num_simulations_++;
+        }
+        int32_t* last = &last_[phase * dimensions_.choices_per_call()];
+        changes_.clear();
+        std::size_t next = 0;  // The index following the last change.
+        for (std::size_t i = 0; i < dimensions_.choices_per_call(); ++i) {
+            if (choices[i] == last[i]) continue;
+            changes_.push_back(i - next);
+            changes_.push_back(zigzag(choices[i]));
+            last[i] = choices[i];
+            next = i + 1;
+        }
+        append_varint(static_cast<uint64_t>(phase) + 1);
+        append_varint(changes_.size() / 2);
+        for (const uint64_t value : changes_) append_varint(value);
+    }
+
+    [[nodiscard]] uint64_t num_simulations() const { return num_simulations_; }
+
+    // Ends the last simulation and completes the file.
+    void finish() {
+        begin();
+        out_.seekp(24);
+        out_.write(reinterpret_cast<const char*>(&num_simulations_), sizeof(num_simulations_));
+        out_.close();
+        if (!out_) throw std::runtime_error("Could not write schedule trace: " + path_);
+    }
+
+private:
+    static uint64_t zigzag(int32_t value) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(value)) << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(value >> 31));
+    }
+    void append_varint(uint64_t value) {
+        while (value >= 0x80) {
+            out_.put(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out_.put(static_cast<char>(value));
+    }
+
+    std::string path_;
+    std::ofstream out_;
+    Dimensions dimensions_;
+    std::vector<int32_t> last_;  // The choices of the last recorded call in each phase.
+    std::vector<uint64_t> changes_;
+    uint64_t num_simulations_ = 0;
+    bool in_simulation_ = false;  // A call of the current simulation was recorded.
+};
+
+class Reader {
+public:
+    explicit Reader(const std::string& path) : in_(path, std::ios::binary), buffer_(1 << 16) {
+        if (!in_) throw std::runtime_error("Could not open schedule trace: " + path);
+        char header[HEADER_SIZE];
+        if (!in_.read(header, sizeof(header)) || std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0) {
+            throw std::runtime_error("Bad schedule trace: " + path);
+        }
+        uint32_t sizes[4];
+        std::memcpy(sizes, header + 8, sizeof(sizes));
+        std::memcpy(&num_simulations_, header + 24, sizeof(num_simulations_));
+        dimensions_ = {sizes[0], sizes[1], sizes[2], sizes[3]};
+        last_.resize(dimensions_.num_phases * dimensions_.choices_per_call());
+    }
+
+    [[nodiscard]] const Dimensions& dimensions() const { return dimensions_; }
+    [[nodiscard]] uint64_t num_simulations() const { return num_simulations_; }
+
+    // The next call is the first of the next simulation; the calls of the current one not asked for are skipped.
+    void begin() { begin_ = true; }
+
+    // The choices of the next call into output, which must be in the phase it was recorded in.
+    void next(phase_t phase, int32_t* output) {
+        if (begin_) {
+            while (in_simulation_) read_call();
+            if (simulation_ == num_simulations_) {
+                throw std::runtime_error("Schedule trace holds only " + std::to_string(num_simulations_) + " simulations");
+            }
+            simulation_++;
+            call_ = 0;
+            in_simulation_ = true;
+            begin_ = false;
+        }
+        const int64_t recorded_phase = in_simulation_ ? read_call() : -1;
+        if (recorded_phase < 0) {
+            throw std::runtime_error("Simulation " + std::to_string(simulation_) + " of the schedule trace ends after " +
+                                     std::to_string(call_) + " calls");
+        }
+        call_++;
+        if (recorded_phase != phase) {
+            throw std::runtime_error("Schedule trace recorded phase " + std::to_string(recorded_phase) + " at call " +
+                                     std::to_string(call_) + " of simulation " + std::to_string(simulation_) + ", not " +
+                                     std::to_string(phase));
+        }
+        std::memcpy(output, &last_[phase * dimensions_.choices_per_call()], dimensions_.choices_per_call() * sizeof(int32_t));
+    }
+
+private:
+    // Applies the next call of the current simulation to last_ and returns its phase, -1 at the end of the simulation.
+    int64_t read_call() {
+        const uint64_t phase_plus_one = read_varint();
+        if (phase_plus_one == 0) {
+            in_simulation_ = false;
+            return -1;
+        }
+        const uint64_t phase = phase_plus_one - 1;
+        if (phase >= dimensions_.num_phases) throw std::runtime_error("Bad schedule trace");
+        int32_t* last = &last_[phase * dimensions_.choices_per_call()];
+        uint64_t index = 0;
+        for (uint64_t changes = read_varint(); changes > 0; --changes) {
+            index += read_varint();
+            const uint64_t value = read_varint();
+            if (index >= dimensions_.choices_per_call()) throw std::runtime_error("Bad schedule trace");
+            last[index++] = static_cast<int32_t>(static_cast<uint32_t>(value >> 1) ^ (0u - static_cast<uint32_t>(value & 1)));
+        }
+        return static_cast<int64_t>(phase);
+    }
+
+    uint64_t read_varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (position_ == end_) {
+                in_.read(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+                position_ = 0;
+                end_ = static_cast<std::size_t>(in_.gcount());
+                if (end_ == 0) throw std::runtime_error("Bad schedule trace");
+            }
+            const auto byte = static_cast<uint8_t>(buffer_[position_++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+        throw std::runtime_error("Bad schedule trace");
+    }
+
+    std::ifstream in_;
+    std::vector<char> buffer_;  // Read ahead of position_ in the file.
+    std::size_t position_ = 0;
+    std::size_t end_ = 0;
+    Dimensions dimensions_;
+    uint64_t num_simulations_ = 0;
+    std::vector<int32_t> last_;  // The choices of the last call in each phase.
+    uint64_t simulation_ = 0;    // Begun, counted from 1.
+    uint64_t call_ = 0;          // Of the current simulation.
+    bool in_simulation_ = false;  // Its end was not read yet.
+    bool begin_ = true;
+};
+
+}  // namespace schedule_trace
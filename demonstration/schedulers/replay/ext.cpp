@@ -0,0 +1,66 @@
+#include "ext.hpp"
+
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "schedule_trace.hpp"
+
+// Serves the choices recorded in the schedule trace named by REPLAY_SCHEDULE_TRACE (see schedule_trace.hpp) instead of
+// computing them. The buffers are ignored.
+
+EXT_STATE std::unique_ptr<schedule_trace::Reader> trace = nullptr;
+EXT_STATE std::optional<std::string> configuredTrace;  // REPLAY_SCHEDULE_TRACE of the settings (extConfigure).
+EXT_STATE bool configured = false;
+
+void extConfigure(const char* settings) {
+    configured = settings != nullptr;
+    configuredTrace.reset();
+    std::istringstream lines(configured ? settings : "");
+    for (std::string line; std::getline(lines, line);) {
+        if (line.rfind("REPLAY_SCHEDULE_TRACE=", 0) == 0) configuredTrace = line.substr(line.find('=') + 1);
+    }
+}
+
+void extPushNetwork(int32_t num_phases, int32_t num_nodes, int32_t num_flows, int32_t num_switches,
+                    const packet_t*, const packet_t*) {
+    const auto* path = configured ? (configuredTrace ? configuredTrace->c_str() : nullptr) : std::getenv("REPLAY_SCHEDULE_TRACE");
+    if (path == nullptr) throw std::runtime_error("REPLAY_SCHEDULE_TRACE is not set");
+    trace = std::make_unique<schedule_trace::Reader>(path);
+    const schedule_trace::Dimensions network{static_cast<uint32_t>(num_phases), static_cast<uint32_t>(num_nodes),
+                                             static_cast<uint32_t>(num_flows), static_cast<uint32_t>(num_switches)};
+    if (!(trace->dimensions() == network)) {
+        throw std::runtime_error(std::string("Schedule trace of another network: ") + path);
+    }
+}
+
+void extPushTopology(phase_t, const node_t*) {}
+
+void extPushFlow(flow_t, node_t, node_t) {}
+
+// Every simulation initializes the scheduler (as does the simulator once before them), the next call with choices is
+// the first of the next recorded simulation.
+void extSchedulerInit() {
+    trace->begin();
+}
+
+void extGetScheduleChoiceAll(phase_t phase, const packet_t*, int32_t* schedule_choice_output) {
+    trace->next(phase, schedule_choice_output);
+}
+
+int32_t extThreadLocalState() {
+#ifdef EXT_THREAD_LOCAL_STATE
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void extSeed(uint32_t) {}
+
+const char* extSchedulerReport() {
+    return "{}";
+}
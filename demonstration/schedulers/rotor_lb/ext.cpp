@@ -1,28 +1,19 @@
-#include "ext.hpp"
+#include "rotor_lb.hpp"
 
-#include <algorithm>
-#include <iostream>
-#include <memory>
-#include <random>
-#include <unordered_map>
-#include <vector>
-#include <ranges>
-namespace views = std::views;
+#include <cstdlib>
+#include <cstring>
 
-#include <boost/container_hash/hash.hpp>
-
-enum APPROACH { uniform, quickest };
-struct Params {
-    APPROACH approach = uniform;
-};
-Params params{uniform};
-
-class EnvVarException : public std::exception {
-public:
-    virtual const char *what() const noexcept { return "Bad ENV var set"; }
-};
+int readPositiveEnvVar(const char *envVal) {
+    char *end = nullptr;
+    const long value = std::strtol(envVal, &end, 10);
+    if (end == envVal || *end != '\0' || value <= 0 || value > INT32_MAX) {
+        throw EnvVarException{};
+    }
+    return static_cast<int>(value);
+}
 void readEnvVars() {
-    if (const auto *envVal = std::getenv("CHOICE_APPROACH")) {
+    params = {};
+    if (const auto *envVal = ext_setting("CHOICE_APPROACH")) {
         if (std::strcmp(envVal, "QUICKEST") == 0) {
             params.approach = quickest;
         } else if (std::strcmp(envVal, "UNIFORM") == 0) {
@@ -31,349 +22,169 @@ void readEnvVars() {
             throw EnvVarException{};
         }
     }
-}
-
-struct ChoiceArgs {
-    node_t node;
-    flow_t flow;
-
-    [[nodiscard]] auto as_tuple() const -> decltype(auto) {
-        return std::tie(node, flow);
+    if (const auto *envVal = ext_setting("ROTORLB_INCREMENTAL")) {
+        if (std::strcmp(envVal, "TRUE") == 0) {
+            params.incremental = true;
+        } else if (std::strcmp(envVal, "FALSE") == 0) {
+            params.incremental = false;
+        } else {
+            throw EnvVarException{};
+        }
     }
-    bool operator==(const ChoiceArgs &other) const {
-        return as_tuple() == other.as_tuple();
+    if (const auto *envVal = ext_setting("ROTORLB_MAX_ITERATIONS")) {
+        params.max_iterations = readPositiveEnvVar(envVal);
     }
-    bool operator!=(const ChoiceArgs &other) const {
-        return !(*this == other);
+    if (const auto *envVal = ext_setting("ROTORLB_TIME_BUDGET_US")) {
+        params.time_budget = std::chrono::microseconds(readPositiveEnvVar(envVal));
+    }
+    if (const auto *envVal = ext_setting("ROTORLB_REPORT_SHORTFALL")) {
+        if (std::strcmp(envVal, "TRUE") == 0) {
+            params.report_shortfall = true;
+        } else if (std::strcmp(envVal, "FALSE") == 0) {
+            params.report_shortfall = false;
+        } else {
+            throw EnvVarException{};
+        }
     }
-};
-std::size_t hash_value(const ChoiceArgs& v) {
-    return boost::hash_value(v.as_tuple());
-}
-namespace std {
-    template<> struct hash<::ChoiceArgs> : boost::hash<::ChoiceArgs> {};
 }
 
-struct PortWeight {
-    PortWeight(port_t port, packet_t weight) : port(port), weight(weight) {}
-    explicit PortWeight(port_t port) : port(port), weight(1) {}
-    port_t port;
-    packet_t weight;
-};
-struct SchedulerChoice : std::vector<PortWeight> {
-    SchedulerChoice() = default;
-    SchedulerChoice(std::initializer_list<PortWeight> port_weights) : std::vector<PortWeight>{port_weights} {}
-    explicit SchedulerChoice(PortWeight port_weight) : std::vector<PortWeight>{port_weight} {}
-    explicit SchedulerChoice(port_t port) : std::vector<PortWeight>{PortWeight(port)} {}
-    explicit SchedulerChoice(port_t port, packet_t weight) : std::vector<PortWeight>{PortWeight(port, weight)} {}
-};
+// Choices of the current call (node * num_flows + flow), computed on the first scheduler_choice after
+// prepare_scheduler_choices. Point into the per-phase state when incremental.
+EXT_STATE const std::vector<SchedulerChoice>* currentChoices = nullptr;
 
+// Tables, offers and choices of compute_rotor_lb, kept such that a phase does not allocate once warmed up.
+EXT_STATE std::vector<RotorLbTable> tables;
+EXT_STATE std::vector<std::vector<RotorLbTable::Offer>> offers;
+EXT_STATE std::vector<SchedulerChoice> choices;
 
-// std::mt19937 random_gen;
-// Random number chosen for this simulation step.
-// uint32_t random_num;
-
-std::unique_ptr<std::unordered_map<ChoiceArgs, SchedulerChoice>> pChoiceCache = nullptr;
-
+// Room for the most port weights of a choice: one per switch and the dummy port.
+void reserve_choices(std::vector<SchedulerChoice>& flow_choices) {
+    flow_choices.resize(network.topology.num_nodes * network.num_flows());
+    for (auto& choice : flow_choices) choice.reserve(network.topology.num_switches + 1);
+}
 
-inline void fairshare_1d(std::vector<packet_t>& v, packet_t capacity) {
-    std::vector<packet_t> input = v;
-    for (auto& e : v) e = 0;
-    while(true) {
-        packet_t count_none_zero = std::ranges::count_if(input, [](const auto& e){ return e > 0; });
-        if (count_none_zero == 0) break;
-        packet_t fair_share = capacity / count_none_zero;
-        if (fair_share == 0) break;
-        for (const auto i : views::iota(static_cast<decltype(input.size())>(0), input.size())) {
-            if (input[i] >= fair_share) {
-                input[i] -= fair_share;
-                v[i] += fair_share;
-                capacity -= fair_share;
-            } else if (input[i] > 0) {
-                capacity -= input[i];
-                v[i] += input[i];
-                input[i] = 0;
-            }
-        }
+void compute_rotor_lb(phase_t phase_i) {
+    build_tables(phase_i, tables, offers);
+    // Accept offers
+    for (auto& table : tables) {
+        table.accept_offers(offers);
     }
-    if (capacity > 0) {
-        for (const auto i : views::iota(static_cast<decltype(input.size())>(0), input.size())) {
-            if (input[i] > 0) {
-                input[i]--;
-                v[i]++;
-                capacity--;
-            }
-            if (capacity == 0) break;
+    // Convert accepted offers to scheduling choices
+    const flow_t n_flows = network.num_flows();
+    for (const node_t node : views::iota(0, network.topology.num_nodes)) {
+        for (const flow_t flow : views::iota(0, n_flows)) {
+            tables[node].get_choice(flow, offers, phase_i, choices[node * n_flows + flow]);
         }
     }
+    currentChoices = &choices;
 }
 
-class RotorLbTable {
-public:
-    RotorLbTable(node_t n_nodes, node_t local) : n_nodes_(n_nodes), table_(n_nodes_ * n_nodes_), direct_traffic_(n_nodes_ * n_nodes_), local_(local) {}
-
-    packet_t& traffic(node_t source, node_t destination) {
-        return table_[source * n_nodes_ + destination];
-    }
-    [[nodiscard]] const packet_t& traffic(node_t source, node_t destination) const {
-        return table_[source * n_nodes_ + destination];
-    }
-    packet_t& operator()(flow_t flow) { return traffic(network.flows[flow].ingress, network.flows[flow].egress); }
-    [[nodiscard]] const packet_t& operator()(flow_t flow) const { return traffic(network.flows[flow].ingress, network.flows[flow].egress); }
-    packet_t& operator()(node_t source, node_t destination) { return traffic(source, destination); }
-    [[nodiscard]] const packet_t& operator()(node_t source, node_t destination) const { return traffic(source, destination); }
-
-    [[nodiscard]] packet_t& local_traffic(node_t destination) {
-        return (*this)(local_, destination);
-    }
-    [[nodiscard]] const packet_t& local_traffic(node_t destination) const {
-        return (*this)(local_, destination);
-    }
-    packet_t& direct_traffic(node_t source, node_t destination) {
-        return direct_traffic_[source * n_nodes_ + destination];
-    }
-    const packet_t& direct_traffic(node_t source, node_t destination) const {
-        return direct_traffic_[source * n_nodes_ + destination];
-    }
-    [[nodiscard]] auto non_local() const {
-        return views::iota(0, n_nodes_)
-             | views::filter([this](node_t node){ return node != local_; });
-    }
-    [[nodiscard]] auto non_local_traffic(node_t destination) const {
-        return non_local() | views::transform([destination, this](node_t node){ return std::make_pair(node, traffic(node, destination)); });
-    }
-    void add_target(node_t node, port_t port) {
-        targets_.emplace_back(node, port);
-    }
-    [[nodiscard]] const std::vector<std::pair<node_t,port_t>>& targets() const {
-        return targets_;
-    }
-    [[nodiscard]] bool is_target(node_t node) const {
-        return std::ranges::any_of(targets() | views::keys, [node](auto&& target){ return target == node; });
-    }
-    struct Offer {
-        Offer(const RotorLbTable& parent, port_t port, node_t target)
-        : offer(parent.n_nodes_), capacity(network.topology.bandwidths[port]), source(parent.local_), target(target) {}
-        std::vector<packet_t> offer;
-        packet_t capacity;
-        node_t source;
-        node_t target;
-    };
-    std::vector<Offer> get_offer() {
-        std::vector<Offer> offers;
-        for (const auto& [target, port] : targets()) {
-            auto& offer = offers.emplace_back(*this, port, target);
-            // Prioritize direct non-local traffic
-            for (const auto node : non_local()) {
-                direct_traffic(node, target) = traffic(node, target);
-                traffic(node, target) = 0;
-                offer.capacity -= direct_traffic(node, target);
-                assert(offer.capacity >= 0);
-            }
-            // Next prioritize direct local traffic (use as much as possible)
-            if (offer.capacity < local_traffic(target)) {
-                direct_traffic(local_, target) = offer.capacity;
-                local_traffic(target) -= offer.capacity;
-            } else {
-                direct_traffic(local_, target) = local_traffic(target);
-                local_traffic(target) = 0;
-            }
-            offer.capacity -= direct_traffic(local_, target);
-            assert(offer.capacity >= 0);
-        }
-        for (auto& offer : offers) {
-            for (const auto node : non_local()) {
-                if (!is_target(node)) {
-                    // Offer remaining local traffic to all targets (Algorithm in RotorNet2017 paper does not specify the case of multiple targets...)
-                    offer.offer[node] = local_traffic(node);
-                }
+// Incremental RotorLB.
+// The targets of a node only depend on the phase, so we keep the tables, offers and choices of each phase.
+// When the phase comes around again, only the buffer entries that changed since then are applied, and offers,
+// acceptance and choices are only recomputed for nodes whose inputs changed.
+struct RotorLbPhaseState {
+    bool initialized = false;
+    std::vector<packet_t> buffers;  // Buffers (node * num_flows + flow) when this phase was last computed.
+    std::vector<RotorLbTable> tables;  // Per node, traffic table mirroring the buffers.
+    std::vector<RotorLbTable> worked;  // Per node, table after get_offer has extracted the direct traffic.
+    std::vector<std::vector<RotorLbTable::Offer>> proposals;  // Per node, offers before acceptance.
+    std::vector<std::vector<RotorLbTable::Offer>> offers;  // Per node, offers after acceptance.
+    std::vector<SchedulerChoice> choices;  // Indexed by node * num_flows + flow.
+};
+EXT_STATE std::vector<RotorLbPhaseState> phaseStates;
+// Flows sharing (ingress, egress) share a table entry. The last of them is the one stored (as in compute_rotor_lb).
+EXT_STATE std::vector<flow_t> tableFlow;
+// Per node, whether its offers and whether its acceptance must be recomputed.
+EXT_STATE std::vector<bool> offerChanged;
+EXT_STATE std::vector<bool> acceptChanged;
+
+void init_incremental() {
+    phaseStates.clear();
+    phaseStates.resize(network.topology.num_phases);
+    tableFlow.resize(network.num_flows());
+    for (const flow_t flow : views::iota(0, network.num_flows())) {
+        tableFlow[flow] = flow;
+        for (const flow_t other : views::iota(flow + 1, network.num_flows())) {
+            if (network.flows[other].ingress == network.flows[flow].ingress && network.flows[other].egress == network.flows[flow].egress) {
+                tableFlow[flow] = other;
             }
         }
-        return offers;
     }
+}
 
-    void accept_offers(std::vector<std::vector<Offer>>& offers, const phase_t phase_i) {
-        // Find offers to local
-        std::vector<std::reference_wrapper<Offer>> offers_to_local;  // Could work, as indirect representation of matrix.
-        for (auto& offer_vector : offers) {
-            for (auto& offer : offer_vector) {
-                if (offer.target == local_) {
-                    offers_to_local.emplace_back(offer);
-                    assert(offer.offer[local_] == 0);  // Since this is about indirect traffic, we only use non_local destinations. We verify that here.
-                }
+void compute_rotor_lb_incremental(phase_t phase_i) {
+    const node_t n_nodes = network.topology.num_nodes;
+    const flow_t n_flows = network.num_flows();
+    auto& state = phaseStates[phase_i];
+    if (!state.initialized) {
+        state.buffers.assign(n_nodes * n_flows, 0);
+        state.tables.clear();
+        for (const node_t node : views::iota(0, n_nodes)) {
+            auto& table = state.tables.emplace_back(n_nodes, node, phase_i);
+            for (const switch_t sw : views::iota(0, network.topology.num_switches)) {
+                port_t port = network.topology.port_of(node, sw);
+                table.add_target(network.topology(phase_i, port), port);
             }
         }
-
-        // For each destination, find how much traffic can be accepted
-        std::vector<packet_t> destination_capacity(n_nodes_);
-        for (const node_t destination : non_local()) {
-            packet_t remaining_traffic = 0;
-            for (const node_t source : views::iota(0, n_nodes_)) {
-                remaining_traffic += traffic(source, destination);
+        state.worked = state.tables;
+        state.proposals.resize(n_nodes);
+        state.offers.resize(n_nodes);
+        reserve_choices(state.choices);
+    }
+
+    // Apply buffer deltas to the tables.
+    auto& offer_changed = offerChanged;
+    offer_changed.assign(n_nodes, !state.initialized);
+    for (const node_t node : views::iota(0, n_nodes)) {
+        for (const flow_t flow : views::iota(0, n_flows)) {
+            auto& last = state.buffers[node * n_flows + flow];
+            if (const packet_t value = network.buffers(node, flow); value != last) {
+                last = value;
+                state.tables[node].set(flow, network.buffers(node, tableFlow[flow]));
+                offer_changed[node] = true;
             }
-            packet_t available = network.topology.bandwidths[network.topology.next_port_to(local_, destination, phase_i)] - remaining_traffic;
-            destination_capacity[destination] = available >= 0 ? available : 0;
         }
-
-        // Fairshare offers among available buffer capacity and link capacity.
-        std::vector<std::vector<packet_t>> input(n_nodes_);
-        for (const auto offer : offers_to_local) {
-            input[offer.get().source] = offer.get().offer;  // Copy offer to input matrix
+    }
+    // Offers of nodes whose table changed. Acceptance must be redone at their targets.
+    auto& accept_changed = acceptChanged;
+    accept_changed.assign(n_nodes, false);
+    for (const node_t node : views::iota(0, n_nodes)) {
+        if (!offer_changed[node]) continue;
+        state.worked[node] = state.tables[node];
+        state.worked[node].get_offer(state.proposals[node]);
+        accept_changed[node] = true;
+        for (const auto& offer : state.proposals[node]) {
+            accept_changed[offer.target] = true;
         }
-        for (auto& offer : offers_to_local) for (auto& e : offer.get().offer) e = 0;  // Reset, so we can build it up
-
-        do {
-            std::vector<std::vector<packet_t>> offer_matrix(n_nodes_);  // (offer.source) x (traffic destination)
-            for (const auto& offer : offers_to_local) {
-                offer_matrix[offer.get().source] = input[offer.get().source];  // Copy offer and calculate fairshare over link capacity
-                fairshare_1d(offer_matrix[offer.get().source], offer.get().capacity);
-            }
-            for (const node_t destination : non_local()) {
-                std::vector<packet_t> destination_offers(n_nodes_);
-                for (const auto& offer : offers_to_local) {
-                    destination_offers[offer.get().source] = offer_matrix[offer.get().source][destination];
-                }
-                fairshare_1d(destination_offers, destination_capacity[destination]);
-                for (auto& offer : offers_to_local) {
-                    // Update accepted offer
-                    offer.get().offer[destination] += destination_offers[offer.get().source];
-                    input[offer.get().source][destination] -= destination_offers[offer.get().source];
-                    // Update capacity info
-                    destination_capacity[destination] -= destination_offers[offer.get().source];
-                    offer.get().capacity -= destination_offers[offer.get().source];
-                }
-            }
-            // Clear rows with no more capacity
-            for (const auto& offer : offers_to_local) {
-                assert(offer.get().capacity >= 0);
-                if (offer.get().capacity == 0) {
-                    for (const node_t destination : non_local()) {
-                        input[offer.get().source][destination] = 0;
-                    }
-                }
-            }
-            // Clear columns with no more capacity
-            for (const node_t destination : non_local()) {
-                assert(destination_capacity[destination] >= 0);
-                if (destination_capacity[destination] == 0) {
-                    for (const auto& offer : offers_to_local) {
-                        input[offer.get().source][destination] = 0;
-                    }
-                }
-            }
-        } while (std::ranges::any_of(input, [](auto&& v){ return std::ranges::any_of(v, [](auto&& e){ return e > 0; }); }));
     }
-
-    [[nodiscard]] SchedulerChoice get_choice(flow_t flow, const std::vector<std::vector<Offer>>& offers, phase_t phase_i) const {
-        node_t source = network.flows[flow].ingress;
-        node_t destination = network.flows[flow].egress;
-        SchedulerChoice scheduler_choice;
-        // Check if this flow can be sent as direct traffic to destination (in this phase)
-        for (const auto& [target, port] : targets()) {
-            if (target == destination) {
-                // 1st and 2nd priority: Direct traffic (local and non-local)
-                scheduler_choice.emplace_back(port, direct_traffic(source, target));
-                if (traffic(source, target) > 0) {  // Any remaining traffic in buffer after sending direct_traffic(source, target)?
-                    // Only sending some of the buffered flow, so adding a dummy port for the rest.
-                    scheduler_choice.emplace_back(-1, traffic(source, target));
-                }
-                return scheduler_choice;
-            }
+    // Reset the offers to targets that must accept again, then accept.
+    for (const node_t node : views::iota(0, n_nodes)) {
+        if (state.offers[node].size() != state.proposals[node].size()) {
+            state.offers[node] = state.proposals[node];
+            continue;
         }
-        // If we get here, the flow is indirect (destination is not a target).
-        // Check if flow is local, else ignore in this phase.
-        if (source == local_) {
-            // 3rd priority: Sending local indirect traffic, based on how much was accepted by target
-            std::vector<std::pair<PortWeight,phase_t>> options;
-            for (const auto& [target, port] : targets()) {
-                assert(target != destination);
-                auto it = std::ranges::find(offers[local_], target, [](const auto& offer){ return offer.target; });
-                if (it != std::ranges::end(offers[local_]) && it->offer[destination] > 0) {
-                    auto priority = params.approach == uniform ? 0 : network.topology.phase_offset_next_connection(target, destination, phase_i);
-                    options.emplace_back(PortWeight(port, it->offer[destination]), priority);
-                }
-            }
-
-            // If the targets in total accept more traffic than we have, prioritize sending to targets that sooner has connection to the destination.
-            std::ranges::sort(options, std::less<phase_t>(), [](const auto& e){ return e.second; });
-            packet_t buffered = network.buffers(source, flow);
-            phase_t last_offset = -1;
-            std::vector<PortWeight> options_with_same_offset;
-            auto handle_equal_priority_options = [&buffered, &scheduler_choice](const std::vector<PortWeight>& equal_priority_options) -> bool {
-                auto choice_weights = equal_priority_options | views::transform([](const auto& c){ return c.weight; }) | std::ranges::to<std::vector>();
-                if (const auto sum = std::ranges::fold_left(choice_weights, 0, std::plus<packet_t>()); buffered >= sum) {
-                    buffered -= sum;
-                    for (const auto& choice : equal_priority_options) {
-                        scheduler_choice.emplace_back(choice);
-                    }
-                } else {
-                    fairshare_1d(choice_weights, buffered);
-                    for (const auto& [choice, weight] : std::views::zip(equal_priority_options, choice_weights)) {
-                        scheduler_choice.emplace_back(choice.port, weight);
-                    }
-                    buffered = 0;
-                    return true;
-                }
-                return false;
-            };
-            int count = 0;
-            for (const auto& [option, offset] : options) {
-                if (offset != last_offset) {
-                    count++;
-                    if (!options_with_same_offset.empty()) {
-                        if (handle_equal_priority_options(options_with_same_offset)) break;
-                    }
-                    last_offset = offset;
-                    options_with_same_offset.clear();
-                }
-                options_with_same_offset.emplace_back(option);
-            }
-            if (buffered > 0) {
-                handle_equal_priority_options(options_with_same_offset);
-            }
-            if (buffered > 0) {
-                // Any remaining traffic in buffer will use the dummy port
-                scheduler_choice.emplace_back(-1, buffered);
+        for (const auto& [offer, proposal] : views::zip(state.offers[node], state.proposals[node])) {
+            if (accept_changed[proposal.target]) {
+                offer = proposal;
             }
         }
-        return scheduler_choice;
     }
-
-private:
-    node_t n_nodes_ = 0;
-    std::vector<packet_t> table_;
-    std::vector<packet_t> direct_traffic_;
-    node_t local_ = 0;
-    std::vector<std::pair<node_t,port_t>> targets_;  // (node,port) \in targets: In current phase, we can send traffic to node through port.
-};
-
-void compute_rotor_lb(phase_t phase_i) {
-    std::vector<RotorLbTable> tables;
-    std::vector<std::vector<RotorLbTable::Offer>> offers;
-    tables.reserve(network.topology.num_nodes);
-    // Build tables from port load data
-    for (const node_t node : views::iota(0, network.topology.num_nodes)) {
-        auto& table = tables.emplace_back(network.topology.num_nodes, node);
-        for (const switch_t sw : views::iota(0, network.topology.num_switches)) {
-            port_t port = network.topology.port_of(node, sw);
-            node_t target = network.topology(phase_i, port);
-            table.add_target(target, port);
-            for (const flow_t flow : views::iota(0, network.num_flows())) {
-                table(flow) = network.buffers(node, flow);
-            }
+    for (const node_t node : views::iota(0, n_nodes)) {
+        if (accept_changed[node]) {
+            state.worked[node].accept_offers(state.offers);
         }
-        offers.emplace_back(table.get_offer());
     }
-    // Accept offers
-    for (auto& table : tables) {
-        table.accept_offers(offers, phase_i);
-    }
-    // Convert accepted offers to scheduling choices
-    for (const node_t node : views::iota(0, network.topology.num_nodes)) {
-        for (const flow_t flow : views::iota(0, network.num_flows())) {
-            (*pChoiceCache)[{node, flow}] = tables[node].get_choice(flow, offers, phase_i);
+    // Choices of nodes whose table or accepted offers changed.
+    for (const node_t node : views::iota(0, n_nodes)) {
+        const bool changed = offer_changed[node] || std::ranges::any_of(state.offers[node], [&accept_changed](const auto& offer){ return accept_changed[offer.target]; });
+        if (!changed) continue;
+        for (const flow_t flow : views::iota(0, n_flows)) {
+            state.worked[node].get_choice(flow, state.offers, phase_i, state.choices[node * n_flows + flow]);
         }
     }
+    state.initialized = true;
+    currentChoices = &state.choices;
 }
 
 // local data per destination
@@ -381,24 +192,36 @@ void compute_rotor_lb(phase_t phase_i) {
 // = table per node of traffic enqueued per (source,destination)-pair except diagonal and self-destination.
 
 packet_t scheduler_choice(node_t node, flow_t flow, phase_t phase_i, switch_t sw) {
-    auto key = ChoiceArgs{node, flow};
-    auto iter = pChoiceCache->find(key);
-    if (iter == pChoiceCache->end()) {
-        compute_rotor_lb(phase_i);
-        iter = pChoiceCache->find(key);
+    if (!currentChoices) {
+        if (params.incremental) {
+            compute_rotor_lb_incremental(phase_i);
+        } else {
+            compute_rotor_lb(phase_i);
+        }
     }
-    auto& choice = iter->second;
+    const auto& choice = (*currentChoices)[node * network.num_flows() + flow];
     const port_t port = sw == -1 ? -1 : network.topology.port_of(node, sw);
     auto port_choice = std::ranges::find(choice, port, [](const auto& pw){ return pw.port; });
     return port_choice == choice.end() ? 0 : port_choice->weight;
 }
 
 void prepare_scheduler_choices() {
-    pChoiceCache->clear();
+    currentChoices = nullptr;
+}
+bool scheduler_static_choices() { return false; }  // Balances the buffered packets.
+void scheduler_report(std::ostream& out) {
+    if (!params.bounded()) return;
+    out << "\"bounded_acceptance\": ";
+    shortfallReport.write_json(out);
 }
 void init_scheduler() {
-    if (!pChoiceCache) {
-        readEnvVars();
-        pChoiceCache = std::make_unique<std::unordered_map<ChoiceArgs, SchedulerChoice>>();
+    readEnvVars();
+    currentChoices = nullptr;
+    shortfallReport = {};
+    RotorLbTable::reserve_scratch(network.topology.num_nodes, network.topology.num_switches);
+    if (params.incremental) {
+        init_incremental();
+    } else {
+        reserve_choices(choices);
     }
 }
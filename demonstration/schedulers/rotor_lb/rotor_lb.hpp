@@ -0,0 +1,478 @@
+#pragma once
+
+// The RotorLB algorithm (RotorNet 2017): per-phase tables of buffered traffic, offers of indirect traffic to the
+// nodes connected in the phase and their fair share acceptance. ext.cpp implements the scheduler interface on top of
+// it, the schedulers benchmark uses it directly.
+#include "ext.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <ranges>
+#include <utility>
+#include <vector>
+namespace views = std::views;
+
+enum APPROACH { uniform, quickest };
+struct Params {
+    APPROACH approach = uniform;
+    bool incremental = false;  // Reuse per-phase tables between calls and only recompute what changed.
+    int max_iterations = 0;  // Cap on fair share iterations in accept_offers (0: until no input remains).
+    std::chrono::microseconds time_budget{0};  // Cap on time spent in each accept_offers (0: unbounded).
+    bool report_shortfall = false;  // Also compute the exact allocation and report the difference.
+
+    [[nodiscard]] bool bounded() const { return max_iterations > 0 || time_budget.count() > 0; }
+};
+inline EXT_STATE Params params{uniform};
+
+// Accumulated effect of bounding the acceptance over a simulation (since init_scheduler), see scheduler_report.
+struct ShortfallReport {
+    uint64_t acceptances = 0;  // Calls to accept_offers that had offers.
+    uint64_t truncated = 0;  // ... that were stopped by the cap before the allocation was complete.
+    uint64_t iterations = 0;
+    int64_t accepted = 0;  // Packets accepted by the bounded allocation.
+    int64_t exact_accepted = 0;  // Packets accepted by the exact allocation (only with ROTORLB_REPORT_SHORTFALL).
+
+    // {"acceptances": ..., "truncated": ..., "iterations": ..., "accepted": ...[, "exact_accepted": ..., "shortfall": ...]}
+    void write_json(std::ostream& out) const {
+        out << "{\"acceptances\": " << acceptances << ", \"truncated\": " << truncated << ", \"iterations\": " << iterations
+            << ", \"accepted\": " << accepted;
+        if (params.report_shortfall) {
+            out << ", \"exact_accepted\": " << exact_accepted << ", \"shortfall\": " << exact_accepted - accepted;
+        }
+        out << "}";
+    }
+};
+inline EXT_STATE ShortfallReport shortfallReport;
+
+struct PortWeight {
+    PortWeight(port_t port, packet_t weight) : port(port), weight(weight) {}
+    explicit PortWeight(port_t port) : port(port), weight(1) {}
+    port_t port;
+    packet_t weight;
+};
+struct SchedulerChoice : std::vector<PortWeight> {
+    SchedulerChoice() = default;
+    SchedulerChoice(std::initializer_list<PortWeight> port_weights) : std::vector<PortWeight>{port_weights} {}
+    explicit SchedulerChoice(PortWeight port_weight) : std::vector<PortWeight>{port_weight} {}
+    explicit SchedulerChoice(port_t port) : std::vector<PortWeight>{PortWeight(port)} {}
+    explicit SchedulerChoice(port_t port, packet_t weight) : std::vector<PortWeight>{PortWeight(port, weight)} {}
+};
+
+
+// input is scratch memory, so repeated calls need not allocate.
+inline void fairshare_1d(std::vector<packet_t>& v, packet_t capacity, std::vector<packet_t>& input) {
+    input = v;
+    for (auto& e : v) e = 0;
+    while(true) {
+        packet_t count_none_zero = std::ranges::count_if(input, [](const auto& e){ return e > 0; });
+        if (count_none_zero == 0) break;
+        packet_t fair_share = capacity / count_none_zero;
+        if (fair_share == 0) break;
+        for (const auto i : views::iota(static_cast<decltype(input.size())>(0), input.size())) {
+            if (input[i] >= fair_share) {
+                input[i] -= fair_share;
+                v[i] += fair_share;
+                capacity -= fair_share;
+            } else if (input[i] > 0) {
+                capacity -= input[i];
+                v[i] += input[i];
+                input[i] = 0;
+            }
+        }
+    }
+    if (capacity > 0) {
+        for (const auto i : views::iota(static_cast<decltype(input.size())>(0), input.size())) {
+            if (input[i] > 0) {
+                input[i]--;
+                v[i]++;
+                capacity--;
+            }
+            if (capacity == 0) break;
+        }
+    }
+}
+inline void fairshare_1d(std::vector<packet_t>& v, packet_t capacity) {
+    std::vector<packet_t> input;
+    fairshare_1d(v, capacity, input);
+}
+
+class RotorLbTable {
+public:
+    RotorLbTable(node_t n_nodes, node_t local, phase_t phase)
+    : n_nodes_(n_nodes), table_(n_nodes_ * n_nodes_), direct_traffic_(n_nodes_ * n_nodes_), column_sum_(n_nodes_), link_capacity_(n_nodes_), local_(local) {
+        reset(phase);
+    }
+
+    // Empties the table (and its targets) for the given phase, keeping the memory.
+    void reset(phase_t phase) {
+        std::ranges::fill(table_, 0);
+        std::ranges::fill(direct_traffic_, 0);
+        std::ranges::fill(column_sum_, 0);
+        targets_.clear();
+        // Bandwidth of the next port connecting local to each destination (as Topology::next_port_to, but in one sweep).
+        // Destinations not yet connected are marked -1.
+        std::ranges::fill(link_capacity_, -1);
+        for (phase_t offset = 0; offset < network.topology.num_phases; offset++) {
+            const phase_t next_phase = (phase + offset) % network.topology.num_phases;
+            for (switch_t sw = 0; sw < network.topology.num_switches; sw++) {
+                const port_t port = network.topology.port_of(local_, sw);
+                const node_t destination = network.topology(next_phase, port);
+                if (link_capacity_[destination] == -1) {
+                    link_capacity_[destination] = network.topology.bandwidths[port];
+                }
+            }
+        }
+        for (auto& capacity : link_capacity_) {
+            if (capacity == -1) capacity = 0;
+        }
+    }
+
+    // Sizes the scratch memory shared by all tables (of this thread) for networks of n_nodes nodes with num_switches
+    // switches, such that computing a phase does not allocate.
+    static void reserve_scratch(node_t n_nodes, switch_t num_switches) {
+        scratch_.offers_to_local.reserve(n_nodes * num_switches);
+        scratch_.destination_capacity.reserve(n_nodes);
+        scratch_.destination_offers.reserve(n_nodes);
+        scratch_.fairshare.reserve(n_nodes);
+        for (auto* rows : {&scratch_.input, &scratch_.offer_matrix}) {
+            rows->resize(std::max<std::size_t>(rows->size(), n_nodes));
+            for (auto& row : *rows) row.reserve(n_nodes);
+        }
+        scratch_.options.reserve(num_switches);
+        scratch_.options_with_same_offset.reserve(num_switches);
+        scratch_.choice_weights.reserve(num_switches);
+    }
+
+    [[nodiscard]] const packet_t& traffic(node_t source, node_t destination) const {
+        return table_[source * n_nodes_ + destination];
+    }
+    // All writes go through here to keep the destination column sums up to date.
+    void set_traffic(node_t source, node_t destination, packet_t value) {
+        auto& entry = table_[source * n_nodes_ + destination];
+        column_sum_[destination] += value - entry;
+        entry = value;
+    }
+    void set(flow_t flow, packet_t value) { set_traffic(network.flows[flow].ingress, network.flows[flow].egress, value); }
+    [[nodiscard]] const packet_t& operator()(flow_t flow) const { return traffic(network.flows[flow].ingress, network.flows[flow].egress); }
+    [[nodiscard]] const packet_t& operator()(node_t source, node_t destination) const { return traffic(source, destination); }
+
+    [[nodiscard]] const packet_t& local_traffic(node_t destination) const {
+        return (*this)(local_, destination);
+    }
+    packet_t& direct_traffic(node_t source, node_t destination) {
+        return direct_traffic_[source * n_nodes_ + destination];
+    }
+    const packet_t& direct_traffic(node_t source, node_t destination) const {
+        return direct_traffic_[source * n_nodes_ + destination];
+    }
+    [[nodiscard]] auto non_local() const {
+        return views::iota(0, n_nodes_)
+             | views::filter([this](node_t node){ return node != local_; });
+    }
+    [[nodiscard]] auto non_local_traffic(node_t destination) const {
+        return non_local() | views::transform([destination, this](node_t node){ return std::make_pair(node, traffic(node, destination)); });
+    }
+    void add_target(node_t node, port_t port) {
+        targets_.emplace_back(node, port);
+    }
+    [[nodiscard]] const std::vector<std::pair<node_t,port_t>>& targets() const {
+        return targets_;
+    }
+    [[nodiscard]] bool is_target(node_t node) const {
+        return std::ranges::any_of(targets() | views::keys, [node](auto&& target){ return target == node; });
+    }
+    struct Offer {
+        Offer() = default;
+        Offer(const RotorLbTable& parent, port_t port, node_t target) { reset(parent, port, target); }
+        void reset(const RotorLbTable& parent, port_t port, node_t target_node) {
+            offer.assign(parent.n_nodes_, 0);
+            capacity = network.topology.bandwidths[port];
+            source = parent.local_;
+            target = target_node;
+        }
+        std::vector<packet_t> offer;
+        packet_t capacity = 0;
+        node_t source = 0;
+        node_t target = 0;
+    };
+    // Replaces offers with one offer per target, reusing their memory.
+    void get_offer(std::vector<Offer>& offers) {
+        const bool clamp_direct = ext_deadline_active();
+        offers.resize(targets().size());
+        for (std::size_t i = 0; i < targets().size(); ++i) {
+            const auto& [target, port] = targets()[i];
+            auto& offer = offers[i];
+            offer.reset(*this, port, target);
+            // Prioritize direct non-local traffic. It fits when it was accepted by RotorLB, not necessarily when the
+            // deadline fallback was followed instead (ext_deadline_active); then the rest waits for the next connection.
+            for (const auto node : non_local()) {
+                direct_traffic(node, target) = clamp_direct ? std::min(traffic(node, target), offer.capacity) : traffic(node, target);
+                set_traffic(node, target, traffic(node, target) - direct_traffic(node, target));
+                offer.capacity -= direct_traffic(node, target);
+                assert(offer.capacity >= 0);
+            }
+            // Next prioritize direct local traffic (use as much as possible)
+            if (offer.capacity < local_traffic(target)) {
+                direct_traffic(local_, target) = offer.capacity;
+                set_traffic(local_, target, local_traffic(target) - offer.capacity);
+            } else {
+                direct_traffic(local_, target) = local_traffic(target);
+                set_traffic(local_, target, 0);
+            }
+            offer.capacity -= direct_traffic(local_, target);
+            assert(offer.capacity >= 0);
+        }
+        for (auto& offer : offers) {
+            for (const auto node : non_local()) {
+                if (!is_target(node)) {
+                    // Offer remaining local traffic to all targets (Algorithm in RotorNet2017 paper does not specify the case of multiple targets...)
+                    offer.offer[node] = local_traffic(node);
+                }
+            }
+        }
+    }
+
+    void accept_offers(std::vector<std::vector<Offer>>& offers) {
+        // Find offers to local
+        auto& offers_to_local = scratch_.offers_to_local;  // Could work, as indirect representation of matrix.
+        offers_to_local.clear();
+        for (auto& offer_vector : offers) {
+            for (auto& offer : offer_vector) {
+                if (offer.target == local_) {
+                    offers_to_local.emplace_back(offer);
+                    assert(offer.offer[local_] == 0);  // Since this is about indirect traffic, we only use non_local destinations. We verify that here.
+                }
+            }
+        }
+
+        // For each destination, find how much traffic can be accepted
+        auto& destination_capacity = scratch_.destination_capacity;
+        destination_capacity.assign(n_nodes_, 0);
+        for (const node_t destination : non_local()) {
+            packet_t available = link_capacity_[destination] - column_sum_[destination];
+            destination_capacity[destination] = available >= 0 ? available : 0;
+        }
+
+        if (offers_to_local.empty()) return;
+        if (params.bounded() && params.report_shortfall) {
+            // Diagnostic only, allocates.
+            std::vector<Offer> exact_offers(offers_to_local.begin(), offers_to_local.end());
+            std::vector<std::reference_wrapper<Offer>> exact_offers_to_local(exact_offers.begin(), exact_offers.end());
+            auto exact_capacity = destination_capacity;
+            fairshare_offers(exact_offers_to_local, exact_capacity, false);
+            shortfallReport.exact_accepted += accepted_traffic(exact_offers_to_local);
+        }
+        shortfallReport.acceptances++;
+        fairshare_offers(offers_to_local, destination_capacity, params.bounded());
+        shortfallReport.accepted += accepted_traffic(offers_to_local);
+    }
+
+    // Fairshare offers among available buffer capacity and link capacity.
+    // If bounded, stops after params.max_iterations iterations or when params.time_budget is spent. The accepted offers
+    // are then a valid, but possibly smaller, allocation.
+    // destination_capacity is used up.
+    void fairshare_offers(std::vector<std::reference_wrapper<Offer>>& offers_to_local, std::vector<packet_t>& destination_capacity, bool bounded) const {
+        const auto start = std::chrono::steady_clock::now();
+        int iterations = 0;
+        auto& input = scratch_.input;
+        input.resize(std::max<std::size_t>(input.size(), n_nodes_));
+        for (auto& row : input) row.clear();
+        for (const auto offer : offers_to_local) {
+            input[offer.get().source] = offer.get().offer;  // Copy offer to input matrix
+        }
+        for (auto& offer : offers_to_local) for (auto& e : offer.get().offer) e = 0;  // Reset, so we can build it up
+
+        do {
+            auto& offer_matrix = scratch_.offer_matrix;  // (offer.source) x (traffic destination), rows of offering sources.
+            offer_matrix.resize(std::max<std::size_t>(offer_matrix.size(), n_nodes_));
+            for (const auto& offer : offers_to_local) {
+                offer_matrix[offer.get().source] = input[offer.get().source];  // Copy offer and calculate fairshare over link capacity
+                fairshare_1d(offer_matrix[offer.get().source], offer.get().capacity, scratch_.fairshare);
+            }
+            auto& destination_offers = scratch_.destination_offers;
+            for (const node_t destination : non_local()) {
+                destination_offers.assign(n_nodes_, 0);
+                for (const auto& offer : offers_to_local) {
+                    destination_offers[offer.get().source] = offer_matrix[offer.get().source][destination];
+                }
+                fairshare_1d(destination_offers, destination_capacity[destination], scratch_.fairshare);
+                for (auto& offer : offers_to_local) {
+                    // Update accepted offer
+                    offer.get().offer[destination] += destination_offers[offer.get().source];
+                    input[offer.get().source][destination] -= destination_offers[offer.get().source];
+                    // Update capacity info
+                    destination_capacity[destination] -= destination_offers[offer.get().source];
+                    offer.get().capacity -= destination_offers[offer.get().source];
+                }
+            }
+            // Clear rows with no more capacity
+            for (const auto& offer : offers_to_local) {
+                assert(offer.get().capacity >= 0);
+                if (offer.get().capacity == 0) {
+                    for (const node_t destination : non_local()) {
+                        input[offer.get().source][destination] = 0;
+                    }
+                }
+            }
+            // Clear columns with no more capacity
+            for (const node_t destination : non_local()) {
+                assert(destination_capacity[destination] >= 0);
+                if (destination_capacity[destination] == 0) {
+                    for (const auto& offer : offers_to_local) {
+                        input[offer.get().source][destination] = 0;
+                    }
+                }
+            }
+            iterations++;
+            if (bounded && ((params.max_iterations > 0 && iterations >= params.max_iterations) ||
+                            (params.time_budget.count() > 0 && std::chrono::steady_clock::now() - start >= params.time_budget))) {
+                if (has_input(input)) shortfallReport.truncated++;
+                break;
+            }
+        } while (has_input(input));
+        if (bounded) shortfallReport.iterations += iterations;
+    }
+
+    [[nodiscard]] static bool has_input(const std::vector<std::vector<packet_t>>& input) {
+        return std::ranges::any_of(input, [](auto&& v){ return std::ranges::any_of(v, [](auto&& e){ return e > 0; }); });
+    }
+    [[nodiscard]] static int64_t accepted_traffic(const std::vector<std::reference_wrapper<Offer>>& offers_to_local) {
+        int64_t sum = 0;
+        for (const auto& offer : offers_to_local) {
+            for (const auto e : offer.get().offer) sum += e;
+        }
+        return sum;
+    }
+
+    // Replaces scheduler_choice with the choice for the flow, reusing its memory.
+    void get_choice(flow_t flow, const std::vector<std::vector<Offer>>& offers, phase_t phase_i, SchedulerChoice& scheduler_choice) const {
+        node_t source = network.flows[flow].ingress;
+        node_t destination = network.flows[flow].egress;
+        scheduler_choice.clear();
+        // Check if this flow can be sent as direct traffic to destination (in this phase)
+        for (const auto& [target, port] : targets()) {
+            if (target == destination) {
+                // 1st and 2nd priority: Direct traffic (local and non-local)
+                scheduler_choice.emplace_back(port, direct_traffic(source, target));
+                if (traffic(source, target) > 0) {  // Any remaining traffic in buffer after sending direct_traffic(source, target)?
+                    // Only sending some of the buffered flow, so adding a dummy port for the rest.
+                    scheduler_choice.emplace_back(-1, traffic(source, target));
+                }
+                return;
+            }
+        }
+        // If we get here, the flow is indirect (destination is not a target).
+        // Check if flow is local, else ignore in this phase.
+        if (source == local_) {
+            // 3rd priority: Sending local indirect traffic, based on how much was accepted by target
+            auto& options = scratch_.options;
+            options.clear();
+            for (const auto& [target, port] : targets()) {
+                assert(target != destination);
+                auto it = std::ranges::find(offers[local_], target, [](const auto& offer){ return offer.target; });
+                if (it != std::ranges::end(offers[local_]) && it->offer[destination] > 0) {
+                    auto priority = params.approach == uniform ? 0 : network.topology.phase_offset_next_connection(target, destination, phase_i);
+                    options.emplace_back(PortWeight(port, it->offer[destination]), priority);
+                }
+            }
+
+            // If the targets in total accept more traffic than we have, prioritize sending to targets that sooner has connection to the destination.
+            std::ranges::sort(options, std::less<phase_t>(), [](const auto& e){ return e.second; });
+            packet_t buffered = network.buffers(source, flow);
+            phase_t last_offset = -1;
+            auto& options_with_same_offset = scratch_.options_with_same_offset;
+            options_with_same_offset.clear();
+            auto handle_equal_priority_options = [&buffered, &scheduler_choice](const std::vector<PortWeight>& equal_priority_options) -> bool {
+                auto& choice_weights = scratch_.choice_weights;
+                choice_weights.clear();
+                for (const auto& c : equal_priority_options) choice_weights.push_back(c.weight);
+                if (const auto sum = std::ranges::fold_left(choice_weights, 0, std::plus<packet_t>()); buffered >= sum) {
+                    buffered -= sum;
+                    for (const auto& choice : equal_priority_options) {
+                        scheduler_choice.emplace_back(choice);
+                    }
+                } else {
+                    fairshare_1d(choice_weights, buffered, scratch_.fairshare);
+                    for (const auto& [choice, weight] : std::views::zip(equal_priority_options, choice_weights)) {
+                        scheduler_choice.emplace_back(choice.port, weight);
+                    }
+                    buffered = 0;
+                    return true;
+                }
+                return false;
+            };
+            int count = 0;
+            for (const auto& [option, offset] : options) {
+                if (offset != last_offset) {
+                    count++;
+                    if (!options_with_same_offset.empty()) {
+                        if (handle_equal_priority_options(options_with_same_offset)) break;
+                    }
+                    last_offset = offset;
+                    options_with_same_offset.clear();
+                }
+                options_with_same_offset.emplace_back(option);
+            }
+            if (buffered > 0) {
+                handle_equal_priority_options(options_with_same_offset);
+            }
+            if (buffered > 0) {
+                // Any remaining traffic in buffer will use the dummy port
+                scheduler_choice.emplace_back(-1, buffered);
+            }
+        }
+    }
+
+private:
+    // Scratch memory of accept_offers and get_choice. Shared by the tables, which are computed one at a time.
+    struct Scratch {
+        std::vector<std::reference_wrapper<Offer>> offers_to_local;
+        std::vector<packet_t> destination_capacity;
+        std::vector<packet_t> destination_offers;
+        std::vector<packet_t> fairshare;
+        std::vector<std::vector<packet_t>> input;
+        std::vector<std::vector<packet_t>> offer_matrix;
+        std::vector<std::pair<PortWeight,phase_t>> options;
+        std::vector<PortWeight> options_with_same_offset;
+        std::vector<packet_t> choice_weights;
+    };
+    inline static EXT_STATE Scratch scratch_;
+
+    node_t n_nodes_ = 0;
+    std::vector<packet_t> table_;
+    std::vector<packet_t> direct_traffic_;
+    std::vector<packet_t> column_sum_;  // Per destination, the sum of traffic over all sources.
+    std::vector<packet_t> link_capacity_;  // Per destination, the bandwidth of the next port from local to it.
+    node_t local_ = 0;
+    std::vector<std::pair<node_t,port_t>> targets_;  // (node,port) \in targets: In current phase, we can send traffic to node through port.
+};
+
+// Builds the table of every node from the buffers in network and the offers each node makes in the phase. Tables and
+// offers of an earlier call (for the same network) are reused.
+inline void build_tables(phase_t phase_i, std::vector<RotorLbTable>& tables, std::vector<std::vector<RotorLbTable::Offer>>& offers) {
+    const node_t n_nodes = network.topology.num_nodes;
+    if (tables.size() != static_cast<std::size_t>(n_nodes)) {
+        tables.clear();
+        tables.reserve(n_nodes);
+        for (const node_t node : views::iota(0, n_nodes)) tables.emplace_back(n_nodes, node, phase_i);
+    }
+    offers.resize(n_nodes);
+    // Build tables from port load data
+    for (const node_t node : views::iota(0, n_nodes)) {
+        auto& table = tables[node];
+        table.reset(phase_i);
+        for (const switch_t sw : views::iota(0, network.topology.num_switches)) {
+            port_t port = network.topology.port_of(node, sw);
+            node_t target = network.topology(phase_i, port);
+            table.add_target(target, port);
+            for (const flow_t flow : views::iota(0, network.num_flows())) {
+                table.set(flow, network.buffers(node, flow));
+            }
+        }
+        table.get_offer(offers[node]);
+    }
+}
@@ -0,0 +1,89 @@
+#include "route_table.hpp"
+#include "temporal_graph.hpp"
+
+#include <cassert>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include <boost/graph/dijkstra_shortest_paths.hpp>
+#include <boost/graph/reverse_graph.hpp>
+
+namespace tg
+{
+    void computeToDestination(TemporalGraph &tgGraph, RouteWeight weight, node_t destination,
+                              std::vector<ScheduleChoice> &choices)
+    {
+        const auto &topology = tgGraph.topology;
+        auto destVertex = tgGraph.vNodes[tgGraph.nIndex(destination)];
+        // We reverse the graph to find all solutions to this node.
+        auto g = make_reverse_graph(tgGraph.graph);
+
+        std::vector<Graph::vertex_descriptor> p(num_vertices(g));
+        std::vector<int> d(num_vertices(g));
+
+        auto wmap = make_transform_value_property_map(
+            [weight](const TEdge &edge) {
+                if (weight == RouteWeight::fewest_hops) {
+                    return 10'000 * edge.hop + edge.time;
+                }
+                return 10'000 * edge.time + edge.hop;
+            },
+            get(edge_bundle, g));
+
+        dijkstra_shortest_paths(g, destVertex,
+            weight_map(wmap)
+                .predecessor_map(make_iterator_property_map(p.begin(), get(vertex_index, g)))
+                .distance_map(make_iterator_property_map(d.begin(), get(vertex_index, g))));
+
+        for (phase_t i = 0; i < topology.num_phases; ++i) {
+            for (node_t from_node = 0; from_node < topology.num_nodes; ++from_node) {
+                switch_t any_switch = 0;
+                port_t port = topology.port_of(from_node, any_switch);
+                phase_t phase = tgGraph.phaseAdd(i, 1);
+
+                auto currentVertex = tgGraph.vPN[tgGraph.pnIndex(i, from_node)];
+                auto next = p[currentVertex];
+                // Keep skipping phasenode until the hop.
+                assert(!std::holds_alternative<TPhaseNode>(g[next]));
+                for (; std::holds_alternative<TPhaseNode>(g[next]); next = p[next]) {
+                    assert(false); // Since we changed the temporal graph this should not be the case.
+                }
+                if (const auto *pNext = std::get_if<TPort>(&g[next])) {
+                    port = pNext->port;
+                    phase = pNext->phase;
+                }
+                choices[(i * topology.num_nodes + from_node) * topology.num_nodes + destination] = {port, phase};
+            }
+        }
+    }
+
+    RouteTable::RouteTable(const Topology &topology, RouteWeight weight)
+        : num_nodes(topology.num_nodes), choices(topology.num_phases * topology.num_nodes * topology.num_nodes)
+    {
+        TemporalGraph tgGraph(topology);
+        for (node_t destination = 0; destination < topology.num_nodes; ++destination) {
+            computeToDestination(tgGraph, weight, destination, choices);
+        }
+    }
+
+    std::shared_ptr<const RouteTable> sharedRouteTable(const Topology &topology, RouteWeight weight)
+    {
+        using Key = std::tuple<RouteWeight, int32_t, int32_t, int32_t, std::vector<node_t>>;
+        static std::mutex mutex;
+        static std::map<Key, std::weak_ptr<const RouteTable>> tables;
+
+        Key key{weight, topology.num_phases, topology.num_nodes, topology.num_switches, topology.topology};
+        std::lock_guard lock(mutex);
+        if (auto table = tables[key].lock()) {
+            return table;
+        }
+        // Forget tables no longer used by anyone.
+        for (auto it = tables.begin(); it != tables.end();) {
+            it = it->second.expired() ? tables.erase(it) : std::next(it);
+        }
+        auto table = std::make_shared<const RouteTable>(topology, weight);
+        tables[key] = table;
+        return table;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ext.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace tg
+{
+    enum class RouteWeight { quickest, fewest_hops };
+
+    struct TemporalGraph;
+
+    // Fills the choices of all phases and nodes towards destination, at (phase * num_nodes + node) * num_nodes +
+    // destination. RouteTable calls it for every destination.
+    void computeToDestination(TemporalGraph &tgGraph, RouteWeight weight, node_t destination,
+                              std::vector<ScheduleChoice> &choices);
+
+    // The next hop (port and phase to send in) from every phase and node towards every destination node, along the
+    // shortest path in the temporal graph of the topology.
+    class RouteTable
+    {
+    public:
+        RouteTable(const Topology &topology, RouteWeight weight);
+
+        [[nodiscard]] ScheduleChoice operator()(phase_t phase, node_t node, node_t destination) const
+        {
+            return choices[(phase * num_nodes + node) * num_nodes + destination];
+        }
+
+    private:
+        node_t num_nodes;
+        std::vector<ScheduleChoice> choices;
+    };
+
+    // Returns the route table of the topology, computed once per distinct topology and weight while it is in use.
+    // Thread-safe; the table is shared read-only between all schedulers (and threads) using the same topology.
+    std::shared_ptr<const RouteTable> sharedRouteTable(const Topology &topology, RouteWeight weight);
+}
@@ -86,7 +86,7 @@ def make_single_plots(folder, ex: Instance, segments_path, plot_cfg, plot_settin
 
     plot_latency_boxplot(folder / f"sampling_latencies_boxplot.{file_suffix}", seg_latency_packets, "Sampled Latency", xlabel="Flow", ylabel="Latency", ymax=latency_max, plot_setting=plot_setting)
 
-def run_for_instance(ex: Instance, folder, plotting_cfg, plot_setting, force=False, no_uppaal=False):
+def run_for_instance(ex: Instance, folder, plotting_cfg, plot_setting, force=False, no_uppaal=False, build_cache=None):
     # Ensure folder
     instance_folder = folder / ex.folder_name
     if not instance_folder.is_dir():
@@ -105,6 +105,7 @@ def run_for_instance(ex: Instance, folder, plotting_cfg, plot_setting, force=Fal
                 extension_library_name=ex.extension_name,
                 no_uppaal=True,
                 src_dir=local.cwd,
+                build_cache=build_cache,
             )
         log_name = instance_folder / "cpp-simulation.log"
         segments_name = instance_folder / "segments.json"
@@ -300,6 +301,7 @@ class CaseStudyCli(plumbum.cli.Application):
     
     pgf = plumbum.cli.Flag(["--pgf"], default=False, help="Output plots as PGF instead of PNG")
     pdf = plumbum.cli.Flag(["--pdf"], default=False, help="Output plots as PDF")
+    build_cache = plumbum.cli.SwitchAttr(["--build-cache"], str, default="build-cache", help="Directory caching simulator binaries for --fast. Empty to disable")
 
     directory = plumbum.cli.SwitchAttr(["-d", "--directory"], plumbum.cli.ExistingDirectory, default=local.path('.'))
     num_workers = plumbum.cli.SwitchAttr(['-j', '--num-workers'], int, default=1)
@@ -312,10 +314,11 @@ class CaseStudyCli(plumbum.cli.Application):
             plot_setting = plot_settings['pdf']
         base_folder = local.path(self.directory)
         print(f"Generating for folder {base_folder}")
+        build_cache = local.path(self.build_cache) if self.build_cache else None
         if self.num_workers > 1:
-            mp_main(base_folder, self.num_workers, plot_setting=plot_setting, force=self.force, no_uppaal=self.no_uppaal)
+            mp_main(base_folder, self.num_workers, plot_setting=plot_setting, force=self.force, no_uppaal=self.no_uppaal, build_cache=build_cache)
         else:
-            main(base_folder, plot_setting=plot_setting, force=self.force, no_uppaal=self.no_uppaal)
+            main(base_folder, plot_setting=plot_setting, force=self.force, no_uppaal=self.no_uppaal, build_cache=build_cache)
 
 
 if __name__ == "__main__":
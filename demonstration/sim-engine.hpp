@@ -0,0 +1,841 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <istream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+namespace views = std::views;
+#include "schedulers/ext/ext.hpp"
+#include "stage-timing.hpp"
+#include "traffic-trace.hpp"
+
+#define meta
+
+// A dimension of the simulator that is only known at runtime (from the loaded SimModel).
+constexpr int dynamic_extent = 0;
+
+/*** MODEL ***/
+
+// The network, traffic and query parameters of a simulation. Either built from the generated model header or read at
+// runtime with read_model.
+struct SimModel {
+    int num_phases = 0;
+    int num_nodes = 0;
+    int num_flows = 0;
+    int num_switches = 0;
+    int max_flow_time = 0;
+    int sim_steps = 0;
+    int sampling_steps = 0;
+    int sampling_count = 0;
+    std::vector<packet_t> node_capacities;  // Indexed by node
+    std::vector<packet_t> port_bandwidths;  // Indexed by port
+    std::vector<node_t> topology;  // Target node at phase * num_ports() + port
+    std::vector<Flow> flows;
+    std::vector<packet_t> amounts;  // Ingress amount at flow * max_flow_time + flow step
+    std::shared_ptr<const TrafficTrace> trace;  // If set, the ingress amounts are streamed from it instead.
+
+    [[nodiscard]] int num_ports() const { return num_nodes * num_switches; }
+
+    // Takes the ingress amounts from the trace (flows must match) instead of amounts.
+    void use_trace(std::shared_ptr<const TrafficTrace> traffic) {
+        if (traffic->num_flows() != num_flows) throw std::invalid_argument("Traffic trace does not match the number of flows of the model");
+        trace = std::move(traffic);
+        max_flow_time = trace->num_steps();
+        amounts.clear();
+    }
+};
+
+// The shared model, which simulators bind a reference to; throws std::invalid_argument for none.
+inline std::shared_ptr<const SimModel> require_model(std::shared_ptr<const SimModel> model) {
+    if (!model) throw std::invalid_argument("No model given to the simulator");
+    return model;
+}
+
+// Throws std::invalid_argument unless the model is consistent (dimensions, array sizes and node indices).
+inline void validate_model(const SimModel& model) {
+    auto check = [](bool ok, const char* what) {
+        if (!ok) throw std::invalid_argument(std::string("Invalid model: ") + what);
+    };
+    check(model.num_phases > 0 && model.num_nodes > 0 && model.num_flows >= 0 && model.num_switches > 0 && model.max_flow_time > 0, "dimensions");
+    check(model.sim_steps >= 0 && model.sampling_steps >= 0 && model.sampling_count >= 0, "query parameters");
+    check(static_cast<int>(model.node_capacities.size()) == model.num_nodes, "number of node capacities");
+    check(static_cast<int>(model.port_bandwidths.size()) == model.num_ports(), "number of port bandwidths");
+    check(static_cast<int>(model.topology.size()) == model.num_phases * model.num_ports(), "topology size");
+    check(static_cast<int>(model.flows.size()) == model.num_flows, "number of flows");
+    if (model.trace) {
+        check(model.trace->num_flows() == model.num_flows && model.trace->num_steps() == model.max_flow_time, "traffic trace size");
+    } else {
+        check(static_cast<int>(model.amounts.size()) == model.num_flows * model.max_flow_time, "number of flow amounts");
+    }
+    auto valid_node = [&model](node_t node) { return node >= 0 && node < model.num_nodes; };
+    check(std::ranges::all_of(model.topology, valid_node), "topology target out of range");
+    check(std::ranges::all_of(model.flows, [&](const Flow& flow) { return valid_node(flow.ingress) && valid_node(flow.egress); }), "flow node out of range");
+}
+
+/*
+    Reads the runtime model format written by rossa (cppsim.write_runtime_model). Whitespace separated integers:
+        rossa-model 1
+        num_phases num_nodes num_flows num_switches max_flow_time
+        sim_steps sampling_steps sampling_count
+        node capacities (num_nodes)
+        port bandwidths (num_ports)
+        topology (num_phases lines of num_ports targets)
+        flows (num_flows lines of: ingress egress amount_0 ... amount_{max_flow_time-1})
+*/
+inline SimModel read_model(std::istream& in) {
+    auto read = [&in](const char* what) {
+        int value;
+        if (!(in >> value)) throw std::runtime_error(std::string("Bad model file: could not read ") + what);
+        return value;
+    };
+    std::string magic;
+    if (!(in >> magic) || magic != "rossa-model" || read("version") != 1) {
+        throw std::runtime_error("Bad model file: expected 'rossa-model 1' header");
+    }
+    SimModel model;
+    model.num_phases = read("num_phases");
+    model.num_nodes = read("num_nodes");
+    model.num_flows = read("num_flows");
+    model.num_switches = read("num_switches");
+    model.max_flow_time = read("max_flow_time");
+    if (model.num_phases <= 0 || model.num_nodes <= 0 || model.num_flows < 0 || model.num_switches <= 0 || model.max_flow_time <= 0) {
+        throw std::runtime_error("Bad model file: invalid dimensions");
+    }
+    model.sim_steps = read("sim_steps");
+    model.sampling_steps = read("sampling_steps");
+    model.sampling_count = read("sampling_count");
+    for (int i = 0; i < model.num_nodes; ++i) model.node_capacities.push_back(read("node capacity"));
+    for (int i = 0; i < model.num_ports(); ++i) model.port_bandwidths.push_back(read("port bandwidth"));
+    for (int i = 0; i < model.num_phases * model.num_ports(); ++i) model.topology.push_back(read("topology"));
+    for (int flow = 0; flow < model.num_flows; ++flow) {
+        const node_t ingress = read("flow ingress");
+        const node_t egress = read("flow egress");
+        model.flows.push_back({ingress, egress});
+        for (int t = 0; t < model.max_flow_time; ++t) model.amounts.push_back(read("flow amount"));
+    }
+    validate_model(model);
+    return model;
+}
+
+/*** SCHEDULER ***/
+
+// The scheduler plugin interface (see ext.hpp). Either the functions linked into the binary or those of a scheduler
+// library loaded at runtime (scheduler-library.hpp).
+struct SchedulerApi {
+    decltype(&extPushNetwork) push_network = nullptr;
+    decltype(&extPushTopology) push_topology = nullptr;
+    decltype(&extPushFlow) push_flow = nullptr;
+    decltype(&extSchedulerInit) scheduler_init = nullptr;
+    decltype(&extGetScheduleChoiceAll) get_schedule_choice_all = nullptr;
+    decltype(&extSeed) seed = nullptr;  // Optional, not defined by libraries built before it was added.
+    decltype(&extSchedulerReport) report = nullptr;  // Optional, as seed.
+    decltype(&extStaticSchedule) static_schedule = nullptr;  // Optional, as seed (static-schedule.hpp).
+    decltype(&extConfigure) configure = nullptr;  // Optional, as seed.
+};
+
+/*** OBSERVERS ***/
+
+/*
+    What happened in a simulated phase, for observers (SimObserver). The arrays are the scratch memory of the simulator,
+    valid until the next phase.
+*/
+struct PhaseRecord {
+    const SimModel& model;
+    phase_t phase = 0;
+    int step = 0;                         // gCurrentStep of the phase.
+    std::int64_t buffered = 0;            // At all nodes, before the phase.
+    const int32_t* choices = nullptr;     // Of the scheduler, num_nodes x num_flows x (num_switches + 1).
+    const double* scheduled = nullptr;    // Per port, the packets the choices gave to it (fractional).
+    const packet_t* port_sent = nullptr;  // Per port.
+    const packet_t* sent = nullptr;       // Per port x flow.
+    const packet_t* delivered = nullptr;  // Per flow, at its egress.
+    const packet_t* arrived = nullptr;    // Per flow, at its ingress.
+    const packet_t* bandwidths = nullptr;  // Per port, those simulated (Simulator::set_port_bandwidths).
+
+    [[nodiscard]] node_t target(port_t port) const { return model.topology[phase * model.num_ports() + port]; }
+    [[nodiscard]] node_t port_owner(port_t port) const { return port / model.num_switches; }
+    [[nodiscard]] packet_t sent_by(port_t port, flow_t flow) const { return sent[port * model.num_flows + flow]; }
+};
+
+/*
+    Measures or records simulations from outside the engine, e.g. the latency curves (latency-curves.hpp). Observers
+    attached to a simulator (Simulator::attach) are called at the end of every phase; without any, a phase pays one
+    check for them.
+*/
+class SimObserver {
+public:
+    virtual ~SimObserver() = default;
+    // A simulation begins (ON_BEGIN).
+    virtual void begin() = 0;
+    // A simulation continues from a saved state (Simulator::restore_state) instead.
+    virtual void restored() { begin(); }
+    virtual void observe(const PhaseRecord& record) = 0;
+};
+
+/*** ENGINE ***/
+
+constexpr int static_product(int a, int b) {
+    return a == dynamic_extent || b == dynamic_extent ? dynamic_extent : a * b;
+}
+
+// Fixed-size storage when the size is known at compile time, otherwise heap memory sized once.
+template <typename T, int Size>
+using Storage = std::conditional_t<Size == dynamic_extent, std::vector<T>, std::array<T, Size>>;
+
+template <typename Container, typename T>
+void assign_storage(Container& container, std::size_t size, T value) {
+    if constexpr (requires { container.resize(size); }) {
+        container.assign(size, value);
+    } else {
+        assert(container.size() == size);
+        std::ranges::fill(container, value);
+    }
+}
+
+/*** Convenience functions/macros ***/
+#define loop(num, i, ...) for (const auto i : views::iota(0, num)) { __VA_ARGS__ }
+#define for_phases(i, ...) loop(num_phases(), i, __VA_ARGS__)
+#define for_nodes(i, ...) loop(num_nodes(), i, __VA_ARGS__)
+// Fully unrolled when the number of switches is known at compile time.
+#define for_switches(i, ...) _Pragma("GCC unroll 8") loop(num_switches(), i, __VA_ARGS__)
+#define for_ports(i, ...) loop(num_ports(), i, __VA_ARGS__)
+#define for_flows(i, ...) loop(num_flows(), i, __VA_ARGS__)
+
+/*
+    The simulator, mirroring the UPPAAL model (model_declarations.c).
+    Each of NODES, FLOWS and SWITCHES is either fixed at compile time, making loop bounds constant and the state and
+    scratch arrays fixed-size members, or dynamic_extent, in which case it is taken from the model at runtime.
+*/
+template <int NODES, int FLOWS, int SWITCHES>
+class Simulator {
+    static constexpr int STATIC_PORTS = static_product(NODES, SWITCHES);
+    static constexpr int STATIC_BUFFER_SIZE = static_product(NODES, FLOWS);
+    static constexpr int STATIC_SCHEDULE_SIZE = static_product(STATIC_BUFFER_SIZE, SWITCHES == dynamic_extent ? dynamic_extent : SWITCHES + 1);
+
+public:
+    // The model is only read, so simulators of the same model can share it.
+    Simulator(std::shared_ptr<const SimModel> model, const SchedulerApi& scheduler)
+    : sharedModel_(require_model(std::move(model))), scheduler_(scheduler) {
+        if ((NODES != dynamic_extent && NODES != model_.num_nodes) ||
+            (FLOWS != dynamic_extent && FLOWS != model_.num_flows) ||
+            (SWITCHES != dynamic_extent && SWITCHES != model_.num_switches)) {
+            throw std::invalid_argument("Model dimensions do not match the simulator");
+        }
+        assign_storage(capacities_, num_nodes(), 0);
+        assign_storage(bandwidths_, num_ports(), 0);
+        std::copy(model_.node_capacities.begin(), model_.node_capacities.end(), capacities_.begin());
+        std::copy(model_.port_bandwidths.begin(), model_.port_bandwidths.end(), bandwidths_.begin());
+        assign_storage(gNodeBuffers, num_nodes() * num_flows(), 0);
+        assign_storage(gPortSent, num_ports(), 0);
+        assign_storage(sampleIntroIndex, num_flows(), 0);
+        assign_storage(sampleEntryStep, num_flows(), 0);
+        assign_storage(sampleNodePosition, num_flows(), 0);
+        assign_storage(sampleNode, num_flows(), 0);
+        assign_storage(sampleLatency, num_flows(), 0);
+        assign_storage(sentPort_, num_ports() * num_flows(), 0);
+        assign_storage(recv_, num_nodes() * num_flows(), 0);
+        assign_storage(sentNode_, num_nodes() * num_flows(), 0);
+        assign_storage(delivered_, num_flows(), 0);
+        assign_storage(arrived_, num_flows(), 0);
+        assign_storage(scheduled_, num_ports(), 0.0);
+        assign_storage(schedule_, num_flows() * num_switches(), 0.0);
+        assign_storage(weights_, num_switches(), 0);
+        assign_storage(schedule_choice_output_, num_nodes() * num_flows() * (num_switches() + 1), 0);
+    }
+    Simulator(SimModel model, const SchedulerApi& scheduler)
+    : Simulator(std::make_shared<const SimModel>(std::move(model)), scheduler) {}
+
+    [[nodiscard]] const SimModel& model() const { return model_; }
+
+    [[nodiscard]] constexpr int num_phases() const { return model_.num_phases; }
+    [[nodiscard]] constexpr int num_nodes() const {
+        if constexpr (NODES != dynamic_extent) return NODES; else return model_.num_nodes;
+    }
+    [[nodiscard]] constexpr int num_flows() const {
+        if constexpr (FLOWS != dynamic_extent) return FLOWS; else return model_.num_flows;
+    }
+    [[nodiscard]] constexpr int num_switches() const {
+        if constexpr (SWITCHES != dynamic_extent) return SWITCHES; else return model_.num_switches;
+    }
+    [[nodiscard]] constexpr int num_ports() const { return num_nodes() * num_switches(); }
+
+    [[nodiscard]] constexpr port_t port_of(node_t node, switch_t sw) const { return node * num_switches() + sw; }
+    [[nodiscard]] constexpr node_t port_owner(port_t port) const { return port / num_switches(); }
+    [[nodiscard]] node_t target(phase_t phase, port_t port) const { return model_.topology[phase * num_ports() + port]; }
+    [[nodiscard]] packet_t node_capacity(node_t node) const { return capacities_[node]; }
+    [[nodiscard]] packet_t port_bandwidth(port_t port) const { return bandwidths_[port]; }
+    [[nodiscard]] packet_t flow_amount(flow_t flow, int flow_step) const {
+        return trace_ ? trace_->amount(flow_step, flow) : model_.amounts[flow * model_.max_flow_time + flow_step];
+    }
+
+    /*** STATE ***/
+    bool gDidOverflow = false; // Whether any port at any time overflowed
+    int gCurrentPhase = 0; // Current phase of the system (will cycle).
+    int gCurrentStep = 0; // Non-cyclic phase step counter.
+    int gCurrentFlowStep = 0;
+    Storage<packet_t, STATIC_BUFFER_SIZE> gNodeBuffers{};
+    Storage<packet_t, STATIC_PORTS> gPortSent{};
+    meta packet_t maxSendFromPortInPhase = 0;
+    StageTimings stageTimings;  // Only counting with SIM_STAGE_TIMING, see stage-timing.hpp.
+
+    // Sampling
+    static constexpr bool sampling = true;
+    Storage<int, FLOWS> sampleIntroIndex{}; // The sampled packets place in queue outside network (num packets before it)
+    Storage<int, FLOWS> sampleEntryStep{};
+    Storage<int32_t, FLOWS> sampleNodePosition{}; // The position of the packet in the flow (num packets before it)
+    Storage<node_t, FLOWS> sampleNode{}; // The node it is in.
+    Storage<int, FLOWS> sampleLatency{}; // The result latency.
+
+    [[nodiscard]] packet_t get_buffer(node_t node, flow_t flow) const {
+        return gNodeBuffers[node * num_flows() + flow];
+    }
+    void set_buffer(node_t node, flow_t flow, packet_t value) {
+        gNodeBuffers[node * num_flows() + flow] = value;
+    }
+
+    // Makes the random choices of the following simulations (sampling, and those of the scheduler) reproducible.
+    void seed(std::uint32_t value) {
+        seed_ = value;
+    }
+    // Mirrors every draw u of the sampling to 1 - u, making the simulations the antithetic twins of those with the
+    // same seed.
+    void set_antithetic(bool value) {
+        antithetic_ = value;
+    }
+    // Varies every ingress amount uniformly by +-variance (a fraction) of the model's amount, as the
+    // sampling_demand_variance_percent of the configuration does when generating traffic. Drawn per step and flow like
+    // the draws of sampling, so common to schedulers run with the same seed and mirrored by set_antithetic. 0 (the
+    // default) keeps the model's amounts.
+    void set_demand_variance(double variance) {
+        demand_variance_ = variance;
+    }
+    // Replace the capacity of every node or the bandwidth of every port of the model (which is left as is), before
+    // ON_CONSTRUCT.
+    void set_node_capacities(packet_t capacity) {
+        std::fill(capacities_.begin(), capacities_.end(), capacity);
+    }
+    void set_port_bandwidths(packet_t bandwidth) {
+        std::fill(bandwidths_.begin(), bandwidths_.end(), bandwidth);
+    }
+
+    /*
+        The random draws of sampling and of the demand variance. A draw is not the next number of a generator but a hash of the seed, the
+        simulation (counted by ON_BEGIN), the step, the flow and what it is for. Simulations with the same seed then get
+        the same number for the same decision even where different schedulers make them take different paths, so
+        schedulers compared with the same seeds see common random numbers and their differences are less noisy.
+    */
+    enum class Draw : std::uint64_t { intro, position, port, demand };
+    double random(double max, Draw draw, flow_t flow) const {
+        const std::uint64_t hash = mix(mix(mix(mix(seed_) ^ run_) ^ static_cast<std::uint64_t>(gCurrentStep)) ^
+                                       (static_cast<std::uint64_t>(flow) << 2 | static_cast<std::uint64_t>(draw)));
+        constexpr double UNIT = 0x1p-53;
+        double u = static_cast<double>(hash >> 11) * UNIT;  // In [0, 1) on a grid of 2^-53.
+        if (antithetic_) u = 1 - UNIT - u;
+        return u * max;
+    }
+
+    // The counters of the scheduler over the current simulation as a JSON object, "{}" without any.
+    [[nodiscard]] std::string schedulerReport() const {
+        return scheduler_.report ? scheduler_.report() : "{}";
+    }
+
+    // Calls the observer at the end of every phase of the following simulations, until detached.
+    void attach(SimObserver& observer) { observers_.push_back(&observer); }
+    void detach(SimObserver& observer) { std::erase(observers_, &observer); }
+
+    void ON_CONSTRUCT() {
+        // Copy network parameters and content to scheduler
+        scheduler_.push_network(num_phases(), num_nodes(), num_flows(), num_switches(), capacities_.data(), bandwidths_.data());
+        for_flows(flow, scheduler_.push_flow(flow, model_.flows[flow].ingress, model_.flows[flow].egress);)
+        for_phases(phase,
+            scheduler_.push_topology(phase, &model_.topology[phase * num_ports()]);
+        )
+        scheduler_.scheduler_init();
+    }
+
+    // The choices of the scheduler in the phase for the buffers (num_nodes x num_flows) into output (num_nodes x
+    // num_flows x (num_switches + 1)), as simulatePhase gets them, without simulating. After ON_CONSTRUCT.
+    void scheduleChoices(phase_t phase, const packet_t* buffers, packet_t* output) {
+        scheduler_.get_schedule_choice_all(phase, buffers, output);
+    }
+
+    void ON_BEGIN() {
+        // Initialize local data
+        gDidOverflow = false;
+        gCurrentPhase = 0;
+        gCurrentStep = 0;
+        for_nodes(node,
+            for_flows(flow,
+                set_buffer(node, flow, 0);
+            )
+        )
+        for_ports(port, gPortSent[port] = 0;)
+        maxSendFromPortInPhase = 0;
+        std::ranges::fill(delivered_, 0);
+        for (auto* observer : observers_) observer->begin();
+        run_++;
+
+        // Let the scheduler initialize itself, with a seed of its own in every simulation.
+        schedulerSeed_ = static_cast<std::uint32_t>(mix(mix(seed_) ^ run_) >> 32);
+        initScheduler();
+    }
+
+    /*
+        The state a simulation continues from, for rare-event simulation (rare-event.hpp): restoring a saved state and
+        simulating on is as if the simulation had continued from where it was saved, except that it draws its own
+        random numbers. The scheduler is initialized again with the seed of the simulation that was saved, which for
+        the schedulers here (whose choices depend on the phase, the buffers and that seed only) is the same as
+        continuing: a random one (valiant) keeps what it drew at the start.
+        Observers are not saved, they are told (SimObserver::restored).
+    */
+    struct State {
+        bool gDidOverflow = false;
+        int gCurrentPhase = 0;
+        int gCurrentStep = 0;
+        int gCurrentFlowStep = 0;
+        packet_t maxSendFromPortInPhase = 0;
+        std::uint32_t schedulerSeed = 0;
+        Storage<packet_t, STATIC_BUFFER_SIZE> gNodeBuffers{};
+        Storage<packet_t, STATIC_PORTS> gPortSent{};
+        Storage<int, FLOWS> sampleIntroIndex{};
+        Storage<int, FLOWS> sampleEntryStep{};
+        Storage<int32_t, FLOWS> sampleNodePosition{};
+        Storage<node_t, FLOWS> sampleNode{};
+        Storage<int, FLOWS> sampleLatency{};
+    };
+    // Copies into the memory of state, so saving into the same states again does not allocate.
+    void save_state(State& state) const {
+        state.gDidOverflow = gDidOverflow;
+        state.gCurrentPhase = gCurrentPhase;
+        state.gCurrentStep = gCurrentStep;
+        state.gCurrentFlowStep = gCurrentFlowStep;
+        state.maxSendFromPortInPhase = maxSendFromPortInPhase;
+        state.schedulerSeed = schedulerSeed_;
+        state.gNodeBuffers = gNodeBuffers;
+        state.gPortSent = gPortSent;
+        state.sampleIntroIndex = sampleIntroIndex;
+        state.sampleEntryStep = sampleEntryStep;
+        state.sampleNodePosition = sampleNodePosition;
+        state.sampleNode = sampleNode;
+        state.sampleLatency = sampleLatency;
+    }
+    void restore_state(const State& state) {
+        gDidOverflow = state.gDidOverflow;
+        gCurrentPhase = state.gCurrentPhase;
+        gCurrentStep = state.gCurrentStep;
+        gCurrentFlowStep = state.gCurrentFlowStep;
+        maxSendFromPortInPhase = state.maxSendFromPortInPhase;
+        schedulerSeed_ = state.schedulerSeed;
+        gNodeBuffers = state.gNodeBuffers;
+        gPortSent = state.gPortSent;
+        sampleIntroIndex = state.sampleIntroIndex;
+        sampleEntryStep = state.sampleEntryStep;
+        sampleNodePosition = state.sampleNodePosition;
+        sampleNode = state.sampleNode;
+        sampleLatency = state.sampleLatency;
+        for (auto* observer : observers_) observer->restored();
+        run_++;
+        initScheduler();
+    }
+
+    /*** CONSTRAINTS ***/
+
+    [[nodiscard]] bool verifyTopology() const {
+        // Check no self-flows
+        for_flows(flow,
+            if (model_.flows[flow].ingress == model_.flows[flow].egress) {
+                return false;
+            }
+        )
+        return true;
+    }
+    [[nodiscard]] bool verifyConstraints() const {
+        return verifyTopology();
+    }
+
+    /*** TRANSITION ***/
+
+    void setup() {
+        if (sampling) {
+            // Hardcoded assume 50 steps for good enough stabilisation
+            constexpr double fStepsToStable = 50.0;
+            for_flows(flow,
+                sampleLatency[flow] = -1;
+                sampleEntryStep[flow] = -1;
+                sampleNode[flow] = -1;
+                sampleNodePosition[flow] = -1;
+                sampleIntroIndex[flow] = static_cast<int>(trunc(fStepsToStable + random(fStepsToStable, Draw::intro, flow)));
+            )
+        }
+    }
+
+    /** SAMPLING **/
+
+    [[nodiscard]] double maxSampleLatency() const {
+        double max = 0.0;
+        for_flows(f,
+            max = fmax(max, sampleLatency[f]);
+        )
+        return max;
+    }
+    [[nodiscard]] double averageSampleLatency() const {
+        // double total = sum(f : flows_t) sampleLatency[f];
+        double total = std::accumulate(std::begin(sampleLatency), std::end(sampleLatency), 0.0);
+        return total / num_flows();
+    }
+
+    void sampleIngressAdded(flow_t flow, packet_t amount) {
+        // If the sampling packet has not entered the network yet.
+        if (sampleIntroIndex[flow] >= 0) {
+            sampleIntroIndex[flow]--;
+            if (sampleIntroIndex[flow] < 0) {
+                // Enter the network.
+                const node_t node = model_.flows[flow].ingress;
+                // We already just did this as part of normal scheduling:
+                //    get_buffer(node, flow) += amount;
+                // So add our now non-positive ingress position to the amount stored.
+                // E.g. if index is now -1 then we were the last to make it. -6 we are the 6th last etc.
+                sampleNodePosition[flow] = get_buffer(node, flow) + static_cast<packet_t>(trunc(random(amount, Draw::position, flow)));
+                sampleEntryStep[flow] = gCurrentStep;
+                sampleNode[flow] = node;
+            }
+        }
+    }
+
+    void samplePortTransfer(flow_t flow, node_t destNode, packet_t amountSendNode, packet_t amountDestNode) {
+        if (sampleLatency[flow] == -1 && sampleNodePosition[flow] >= 0) {
+            // We have not sampled the final latency value yet and have been injected.
+            sampleNodePosition[flow] -= amountSendNode;
+            if (sampleNodePosition[flow] < 0) {
+                // The packet leaves the port.
+                if (destNode == model_.flows[flow].egress) {
+                    // Packet leaves network
+                    sampleLatency[flow] = gCurrentStep - sampleEntryStep[flow];
+                    sampleNodePosition[flow] = -1;
+                    sampleNode[flow] = -1;
+                } else {
+                    // Goes to another port
+                    // Proportionally re-calculate position among packets arriving at destination (from back with negative position).
+                    sampleNodePosition[flow] *= static_cast<double>(amountDestNode) / static_cast<double>(amountSendNode);
+                    // Our new position is how much there is now "plus our negative position" since we subtracted above.
+                    // 0-index. If 10 packets was added, and were -10 then we are the first, if -9 we are the last.
+                    sampleNodePosition[flow] += get_buffer(destNode, flow);
+                    sampleNode[flow] = destNode;
+                }
+            }
+        }
+    }
+
+    /** NORMAL UPDATE **/
+
+    [[nodiscard]] double portUtilization(port_t p) const {
+        double dSent = gPortSent[p];
+        return dSent / bandwidths_[p];
+    }
+
+    // Packets of the flow that left the network at its egress in the last step.
+    [[nodiscard]] packet_t deliveredAtEgress(flow_t flow) const {
+        return delivered_[flow];
+    }
+
+    [[nodiscard]] packet_t packetsAtNode(node_t node) const {
+        packet_t sum = 0;
+        for_flows(flow,
+            sum += get_buffer(node, flow);
+        )
+        return sum;
+    }
+
+    [[nodiscard]] packet_t totalPacketsBuffered() const {
+        packet_t sum = 0;
+        for_nodes(node, sum += packetsAtNode(node);)
+        return sum;
+    }
+
+    void nextPhase() {
+        gCurrentPhase += 1;
+        if (gCurrentPhase == num_phases()) {
+            gCurrentPhase = 0;
+        }
+        gCurrentFlowStep += 1;
+        if (gCurrentFlowStep == model_.max_flow_time) {
+            gCurrentFlowStep = 0;
+        }
+        if (sampling) {
+            gCurrentStep += 1;
+        }
+    }
+
+    // The fullest node relative to its capacity, above 1 when a node overflows.
+    [[nodiscard]] double maxNodeOccupancy() const {
+        double max = 0.0;
+        for_nodes(node,
+            max = fmax(max, static_cast<double>(packetsAtNode(node)) / capacities_[node]);
+        )
+        return max;
+    }
+
+    [[nodiscard]] bool validNodeState(node_t n) const {
+        return packetsAtNode(n) <= capacities_[n];
+    }
+
+    bool updateValidState() {
+        for_nodes(node,
+            if (!validNodeState(node)) {
+                gDidOverflow = true;
+                return false;
+            }
+        )
+        return true;
+    }
+
+    void simulatePhase() {
+        // The current sending phase.
+        const phase_t phase = gCurrentPhase;
+        const int step = gCurrentStep;
+        stageTimings.start();
+        std::ranges::fill(sentPort_, 0);
+        std::ranges::fill(recv_, 0);
+        std::ranges::fill(sentNode_, 0);
+        std::ranges::fill(delivered_, 0);
+        stageTimings.lap(Stage::buffer_update);
+
+        scheduler_.get_schedule_choice_all(phase, gNodeBuffers.data(), schedule_choice_output_.data());
+        stageTimings.lap(Stage::scheduler);
+
+        bufferedBefore_ = 0;
+
+        // Calculate sent (only relevant for current phase 'i')
+        for_nodes(node,
+            for_flows(flow,
+                for_switches(sw,
+                    schedule(flow, sw) = 0;
+                )
+            )
+            for_flows(flow,
+                packet_t buffered = get_buffer(node, flow);
+                bufferedBefore_ += buffered;
+                const packet_t* choice = &schedule_choice_output_[(node * num_flows() + flow) * (num_switches() + 1)];
+                packet_t sum = choice[0];  // a dummy switch to allow not attempting to send all buffered packets in the flow.
+                for_switches(sw,
+                    packet_t choice_weight = choice[sw + 1];
+                    weights_[sw] = choice_weight;
+                    sum += choice_weight;
+                )
+                for_switches(sw,
+                    schedule(flow, sw) = sum == 0 ? 0 : buffered * (weights_[sw] / static_cast<double>(sum));
+                )
+            )
+            stageTimings.lap(Stage::normalization);
+
+            for_switches(sw,
+                port_t p = port_of(node, sw);
+                packet_t portSending = 0;
+                const packet_t bandwidth = bandwidths_[p];
+
+                // If port is a self-loop in the current phase, just keep the packets. (This is to avoid issues with latency sampling).
+                const bool self_loop = target(phase, p) == node;
+                double sum = 0;
+                for_flows(flow,
+                    sum += schedule(flow, sw);
+                )
+                scheduled_[p] = sum;
+                double flow_rate = 1;
+                if (!self_loop) {
+                    flow_rate = sum > 0.0 ? fmin(1.0, bandwidth / sum) : 0.0;
+
+                    for_flows(flow,
+                        const auto sending = static_cast<packet_t>(trunc(schedule(flow, sw) * flow_rate));
+                        portSending += sending;
+                        sentPort(p, flow) = sending;
+                    )
+                }
+                stageTimings.lap(Stage::rate_limit);
+                // If we send less that bandwidth due to rounding down to integer, add packets to the flows with the largest rounding errors.
+                if (!self_loop && flow_rate != 1) while (portSending < bandwidth) {
+                    double max_diff = 0;
+                    flow_t flow_with_max_diff = -1;
+                    for_flows(flow,
+                        double diff = schedule(flow, sw) * flow_rate - sentPort(p, flow);
+                        if (sentPort(p, flow) < schedule(flow, sw) && diff > max_diff) {
+                            max_diff = diff;
+                            flow_with_max_diff = flow;
+                        }
+                    )
+                    if (flow_with_max_diff == -1) break;  // If no flows can add packets, stop.
+                    portSending++;
+                    sentPort(p, flow_with_max_diff)++;
+                }
+                gPortSent[p] = portSending;
+                maxSendFromPortInPhase = portSending > maxSendFromPortInPhase ? portSending : maxSendFromPortInPhase;
+                stageTimings.lap(Stage::rounding_topup);
+            )
+            for_flows(flow,
+                for_switches(sw,
+                    sentNode(node, flow) += sentPort(port_of(node, sw), flow);
+                )
+            )
+            stageTimings.lap(Stage::buffer_update);
+        )
+        // Calculate received
+        for_flows(flow, // For all flows
+            for_ports(pSender,  // For any possible port sender
+                const node_t destNode = target(phase, pSender);  // Which node is the receiver
+                if (destNode != model_.flows[flow].egress) {  // Egress means packets leave.
+                    //Add the sent packages to the receiving node.
+                    recv(destNode, flow) += sentPort(pSender, flow);
+                } else {
+                    delivered_[flow] += sentPort(pSender, flow);
+                }
+            )
+        )
+        stageTimings.lap(Stage::receive);
+        // Update with send/recv
+        for_nodes(node,
+            for_flows(flow,
+                const packet_t toAdd = recv(node, flow) - sentNode(node, flow);
+                set_buffer(node, flow, get_buffer(node, flow) + toAdd);
+            )
+        )
+        stageTimings.lap(Stage::buffer_update);
+
+        if (sampling) {
+            // Must be here after buffers are modified, but before new ingress.
+            for_flows(flow,
+                if (sampleNode[flow] != -1 &&  // Sample for this flow did not yet ingress network.
+                    sentNode(sampleNode[flow], flow) != 0) {  // Nothing sent on this flow.
+                    // Weighted sampling (if flow is split here).
+                    node_t node = sampleNode[flow];
+                    double sampledWeight = random(sentNode(node, flow), Draw::port, flow);
+                    packet_t sum = 0;
+                    port_t sampledPort = -1;
+                    for_switches(sw,
+                        port_t port = port_of(node, sw);
+                        const auto w = sentPort(port, flow);
+                        if (sampledWeight >= sum && sampledWeight < sum + w) sampledPort = port;
+                        sum += w;
+                    )
+                    assert(sampledPort >= 0);
+                    node_t destNode = target(phase, sampledPort);
+                    samplePortTransfer(flow, destNode, sentNode(node, flow), recv(destNode, flow));
+                }
+            )
+            stageTimings.lap(Stage::sampling);
+        }
+
+        // Add ingress
+        for_flows(flow,
+            const node_t node = model_.flows[flow].ingress;
+            packet_t amount = flow_amount(flow, gCurrentFlowStep);
+            if (demand_variance_ > 0 && amount > 0) {
+                const double factor = 1 - demand_variance_ + random(2 * demand_variance_, Draw::demand, flow);
+                amount = std::max<packet_t>(1, static_cast<packet_t>(amount * factor));
+            }
+            set_buffer(node, flow, get_buffer(node, flow) + amount);
+            arrived_[flow] = amount;
+            if (sampling) {
+                sampleIngressAdded(flow, amount);
+            }
+        )
+        updateValidState();
+        nextPhase();
+        stageTimings.lap(Stage::ingress);
+
+        if (!observers_.empty()) {
+            const PhaseRecord record{model_, phase, step, bufferedBefore_, schedule_choice_output_.data(), scheduled_.data(),
+                                     gPortSent.data(), sentPort_.data(), delivered_.data(), arrived_.data(), bandwidths_.data()};
+            for (auto* observer : observers_) observer->observe(record);
+            stageTimings.lap(Stage::observers);
+        }
+    }
+
+    // Starts a simulation at step 0: an empty network, the traffic from its first step and newly drawn sampled packets.
+    // Every latency sample starts from the first step of the traffic, not where the previous simulation stopped.
+    void reset_run() {
+        ON_BEGIN();
+        gCurrentFlowStep = 0;
+        assert(verifyConstraints());
+        setup();
+    }
+
+    template<typename OutFn>
+    void run_one_simulation(int steps, OutFn&& output) {
+        reset_run();
+        int t = 0;
+        output(t);
+        while (t < steps) {
+            t++;
+            simulatePhase();
+            output(t);
+        }
+    }
+
+private:
+    static std::uint64_t mix(std::uint64_t x) {  // splitmix64
+        x += 0x9e3779b97f4a7c15;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    }
+    // Schedulers without extSeed draw from their own generator, anew after a restored state.
+    void initScheduler() {
+        if (scheduler_.seed) scheduler_.seed(schedulerSeed_);
+        scheduler_.scheduler_init();
+    }
+
+    packet_t& sentPort(port_t port, flow_t flow) { return sentPort_[port * num_flows() + flow]; }
+    packet_t& recv(node_t node, flow_t flow) { return recv_[node * num_flows() + flow]; }
+    packet_t& sentNode(node_t node, flow_t flow) { return sentNode_[node * num_flows() + flow]; }
+    double& schedule(flow_t flow, switch_t sw) { return schedule_[flow * num_switches() + sw]; }
+
+    std::shared_ptr<const SimModel> sharedModel_;
+    const SimModel& model_ = *sharedModel_;
+    const TrafficTrace* trace_ = model_.trace.get();
+    Storage<packet_t, NODES> capacities_{};   // Of the simulation, the model's unless replaced.
+    Storage<packet_t, STATIC_PORTS> bandwidths_{};
+    SchedulerApi scheduler_;
+    std::uint64_t seed_ = static_cast<std::uint64_t>(std::random_device{}()) << 32 | std::random_device{}();
+    std::uint64_t run_ = 0;  // Simulations begun (or restored), to draw differently in each.
+    std::uint32_t schedulerSeed_ = 0;  // Of the current simulation.
+    bool antithetic_ = false;
+    double demand_variance_ = 0;
+    std::vector<SimObserver*> observers_;
+
+    // Scratch memory of simulatePhase.
+    Storage<packet_t, static_product(STATIC_PORTS, FLOWS)> sentPort_{};
+    Storage<packet_t, STATIC_BUFFER_SIZE> recv_{};
+    Storage<packet_t, STATIC_BUFFER_SIZE> sentNode_{};
+    Storage<packet_t, FLOWS> delivered_{};  // At the egress, in the last step.
+    Storage<packet_t, FLOWS> arrived_{};  // At the ingress, in the last step.
+    Storage<double, STATIC_PORTS> scheduled_{};  // Packets the choices gave to each port, in the last step.
+    std::int64_t bufferedBefore_ = 0;  // At all nodes, before the last step.
+    Storage<double, static_product(FLOWS, SWITCHES)> schedule_{};
+    Storage<packet_t, SWITCHES> weights_{};
+    Storage<packet_t, STATIC_SCHEDULE_SIZE> schedule_choice_output_{};
+};
+
+// Calls fn with a Simulator for a model only known at runtime. Common switch counts get an instantiation with unrolled
+// per-switch loops.
+template <typename Fn>
+decltype(auto) with_runtime_simulator(std::shared_ptr<const SimModel> model, const SchedulerApi& scheduler, Fn&& fn) {
+    model = require_model(std::move(model));
+    switch (model->num_switches) {
+        case 2: { Simulator<dynamic_extent, dynamic_extent, 2> sim(std::move(model), scheduler); return fn(sim); }
+        case 4: { Simulator<dynamic_extent, dynamic_extent, 4> sim(std::move(model), scheduler); return fn(sim); }
+        case 8: { Simulator<dynamic_extent, dynamic_extent, 8> sim(std::move(model), scheduler); return fn(sim); }
+        default: { Simulator<dynamic_extent, dynamic_extent, dynamic_extent> sim(std::move(model), scheduler); return fn(sim); }
+    }
+}
+template <typename Fn>
+decltype(auto) with_runtime_simulator(SimModel model, const SchedulerApi& scheduler, Fn&& fn) {
+    return with_runtime_simulator(std::make_shared<const SimModel>(std::move(model)), scheduler, std::forward<Fn>(fn));
+}
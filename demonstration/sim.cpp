@@ -1,39 +1,36 @@
-#include <cassert>
-#include <cmath>
-#include <random>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
-#include <ranges>
-namespace views = std::views;
-#include "schedulers/ext/ext.hpp"
-
-#ifdef SIM_MODEL_PATH
-    #define STRINGIFY(X) STRINGIFY2(X)
-    #define STRINGIFY2(X) #X
-    #include STRINGIFY(SIM_MODEL_PATH)
-#else
-    #include "sim-model.hpp"
+#include <optional>
+#include <sstream>
+#include "adaptive-sampling.hpp"
+#include "efficiency-counters.hpp"
+#include "flow-throughput.hpp"
+#include "latency-curves.hpp"
+#include "output-writer.hpp"
+#include "rare-event.hpp"
+#include "schedulers/ext/schedule_trace.hpp"
+#include "sim-engine.hpp"
+
+#ifndef SIM_NO_COMPILED_MODEL
+    #ifdef SIM_MODEL_PATH
+        #define STRINGIFY(X) STRINGIFY2(X)
+        #define STRINGIFY2(X) #X
+        #include STRINGIFY(SIM_MODEL_PATH)
+    #else
+        #include "sim-model.hpp"
+    #endif
 #endif
 
-#define meta 
-
-
-std::mt19937 gen(std::random_device{}());
-
-double random(double max) {
-    std::uniform_real_distribution<> d(0, max);
-    return d(gen);
-}
-
 
 /*** MODEL ***/
+#ifndef SIM_NO_COMPILED_MODEL
 constexpr int NUM_PHASES = ROSSA_NUM_PHASES;
 constexpr int NUM_NODES = ROSSA_NUM_NODES;
 constexpr int NUM_FLOWS = ROSSA_NUM_FLOWS;
 constexpr int MAX_FLOW_TIME = ROSSA_MAX_FLOW_TIME;
 constexpr int NUM_SWITCHES = ROSSA_NUM_SWITCHES;
 constexpr int NUM_PORTS = NUM_NODES * NUM_SWITCHES;
-constexpr int BUFFER_SIZE = NUM_NODES * NUM_FLOWS;
-constexpr int SCHEDULE_SIZE = NUM_NODES * NUM_FLOWS * (NUM_SWITCHES + 1);
 
 typedef struct {
     node_t ingress;
@@ -41,408 +38,289 @@ typedef struct {
     packet_t amount_over_time[MAX_FLOW_TIME];
 } flow_with_amounts_t;
 
-const packet_t NODE_CAPACITIES[NUM_NODES] = ROSSA_GEN_NODE_CAPACITIES;
-
-const packet_t PORT_BANDWIDTHS[NUM_PORTS] = ROSSA_GEN_PORT_BANDWIDTHS;
-
-const node_t TOPOLOGY[NUM_PHASES][NUM_PORTS] = ROSSA_GEN_TOPOLOGY;
-
-const flow_with_amounts_t FLOWS[NUM_FLOWS] = ROSSA_GEN_FLOWS;
-
-/*** Convenience functions/macros ***/
-#define loop(num, i, ...) for (const auto i : views::iota(0, num)) { __VA_ARGS__ }
-#define for_phases(i, ...) loop(NUM_PHASES, i, __VA_ARGS__)
-#define for_nodes(i, ...) loop(NUM_NODES, i, __VA_ARGS__)
-#define for_switches(i, ...) loop(NUM_SWITCHES, i, __VA_ARGS__)
-#define for_ports(i, ...) loop(NUM_PORTS, i, __VA_ARGS__)
-#define for_flows(i, ...) loop(NUM_FLOWS, i, __VA_ARGS__)
-
-constexpr port_t port_of(node_t node, switch_t sw) { return node * NUM_SWITCHES + sw; }
-constexpr node_t port_owner(port_t port) { return port / NUM_SWITCHES; }
-
-/*** STATE ***/
-bool gDidOverflow = false; // Whether any port at any time overflowed
-int gCurrentPhase = 0; // Current phase of the system (will cycle).
-int gCurrentStep = 0; // Non-cyclic phase step counter.
-int gCurrentFlowStep = 0;
-packet_t gNodeBuffers[BUFFER_SIZE]{};
-packet_t gPortSent[NUM_PORTS]{};
-meta packet_t maxSendFromPortInPhase = 0;
-
-// Sampling
-constexpr bool sampling = true;
-int sampleIntroIndex[NUM_FLOWS]; // The sampled packets place in queue outside network (num packets before it)
-int sampleEntryStep[NUM_FLOWS];
-int32_t sampleNodePosition[NUM_FLOWS]; // The position of the packet in the flow (num packets before it)
-node_t sampleNode[NUM_FLOWS]; // The node it is in.
-int sampleLatency[NUM_FLOWS]; // The result latency.
-
-
-packet_t get_buffer(node_t node, flow_t flow) {
-    return gNodeBuffers[node * NUM_FLOWS + flow];
-}
-void set_buffer(node_t node, flow_t flow, packet_t value) {
-    gNodeBuffers[node * NUM_FLOWS + flow] = value;
-}
-
-void ON_CONSTRUCT() {
-    packet_t nodeData[NUM_NODES] = ROSSA_GEN_NODE_CAPACITIES;
-    packet_t portData[NUM_PORTS] = ROSSA_GEN_PORT_BANDWIDTHS;
-    node_t topoData[NUM_PORTS];
-
-    // Copy network parameters and content to scheduler
-    for_nodes(node, nodeData[node] = NODE_CAPACITIES[node];)
-    for_ports(port, portData[port] = PORT_BANDWIDTHS[port];)
-    extPushNetwork(NUM_PHASES, NUM_NODES, NUM_FLOWS, NUM_SWITCHES, nodeData, portData);
-    for_flows(flow, extPushFlow(flow, FLOWS[flow].ingress, FLOWS[flow].egress);)
-    // Topology is 2d-array, so copy piece by piece
-    for_phases(phase,
-        for_ports(port,
-            topoData[port] = TOPOLOGY[phase][port];
-        )
-        extPushTopology(phase, topoData);
-    )
-    extSchedulerInit();
-}
-
-void ON_BEGIN() {
-    // Initialize local data
-    gDidOverflow = false;
-    gCurrentPhase = 0;
-    gCurrentStep = 0;
-    for_nodes(node,
-        for_flows(flow,
-            set_buffer(node, flow, 0);
-        )
-    )
-    for_ports(port, gPortSent[port] = 0;)
-    maxSendFromPortInPhase = 0;
-
-    // Let the scheduler initialize itself
-    extSchedulerInit();
-}
-
-
-/*** CONSTRAINTS ***/
-
-bool verifyTopology() {
-    // Check no self-flows
-    for_flows(flow,
-        if (FLOWS[flow].ingress == FLOWS[flow].egress) {
-            return false;
-        }
-    )
-    return true;
-}
-bool verifyConstraints() {
-    return verifyTopology();
-}
-
-/*** TRANSITION ***/
-
-void setup() {
-    if (sampling) {
-        // Hardcoded assume 50 steps for good enough stabilisation
-        constexpr double fStepsToStable = 50.0;
-        for_flows(flow, 
-            sampleLatency[flow] = -1;
-            sampleEntryStep[flow] = -1;
-            sampleNode[flow] = -1;
-            sampleNodePosition[flow] = -1;
-            sampleIntroIndex[flow] = static_cast<int>(trunc(fStepsToStable + random(fStepsToStable)));
-        )
+SimModel compiled_model() {
+    static const packet_t NODE_CAPACITIES[NUM_NODES] = ROSSA_GEN_NODE_CAPACITIES;
+    static const packet_t PORT_BANDWIDTHS[NUM_PORTS] = ROSSA_GEN_PORT_BANDWIDTHS;
+    static const node_t TOPOLOGY[NUM_PHASES][NUM_PORTS] = ROSSA_GEN_TOPOLOGY;
+    static const flow_with_amounts_t FLOWS[NUM_FLOWS] = ROSSA_GEN_FLOWS;
+
+    SimModel model;
+    model.num_phases = NUM_PHASES;
+    model.num_nodes = NUM_NODES;
+    model.num_flows = NUM_FLOWS;
+    model.num_switches = NUM_SWITCHES;
+    model.max_flow_time = MAX_FLOW_TIME;
+    model.sim_steps = ROSSA_SIM_STEPS;
+    model.sampling_steps = ROSSA_SAMPLING_STEPS;
+    model.sampling_count = ROSSA_SAMPLING_COUNT;
+    model.node_capacities.assign(std::begin(NODE_CAPACITIES), std::end(NODE_CAPACITIES));
+    model.port_bandwidths.assign(std::begin(PORT_BANDWIDTHS), std::end(PORT_BANDWIDTHS));
+    for (const auto& phase_topology : TOPOLOGY) {
+        model.topology.insert(model.topology.end(), std::begin(phase_topology), std::end(phase_topology));
     }
+    for (const auto& flow : FLOWS) {
+        model.flows.push_back({flow.ingress, flow.egress});
+        model.amounts.insert(model.amounts.end(), std::begin(flow.amount_over_time), std::end(flow.amount_over_time));
+    }
+    return model;
 }
 
-/** SAMPLING **/
-
-double maxSampleLatency() {
-    double max = 0.0;
-    for_flows(f,
-        max = fmax(max, sampleLatency[f]);
-    )
-    return max;
-}
-double averageSampleLatency() {
-    // double total = sum(f : flows_t) sampleLatency[f];
-    double total = std::accumulate(std::begin(sampleLatency), std::end(sampleLatency), 0.0);
-    return total / NUM_FLOWS;
+// The traffic trace named by the generated header, relative to the directory of the binary.
+std::optional<std::string> compiled_trace_path() {
+#ifdef ROSSA_TRAFFIC_TRACE
+    std::error_code ec;
+    const auto binary = std::filesystem::read_symlink("/proc/self/exe", ec);
+    return ((ec ? std::filesystem::current_path() : binary.parent_path()) / ROSSA_TRAFFIC_TRACE).string();
+#else
+    return std::nullopt;
+#endif
 }
+#endif
 
-void sampleIngressAdded(flow_t flow, packet_t amount) {
-    // If the sampling packet has not entered the network yet.
-    if (sampleIntroIndex[flow] >= 0) {
-        sampleIntroIndex[flow]--;
-        if (sampleIntroIndex[flow] < 0) {
-            // Enter the network.
-            const node_t node = FLOWS[flow].ingress;
-            // We already just did this as part of normal scheduling:
-            //    get_buffer(node, flow) += amount;
-            // So add our now non-positive ingress position to the amount stored.
-            // E.g. if index is now -1 then we were the last to make it. -6 we are the 6th last etc.
-            sampleNodePosition[flow] = get_buffer(node, flow) + static_cast<packet_t>(trunc(random(amount)));
-            sampleEntryStep[flow] = gCurrentStep;
-            sampleNode[flow] = node;
-        }
+constexpr SchedulerApi LINKED_SCHEDULER{&extPushNetwork, &extPushTopology, &extPushFlow, &extSchedulerInit, &extGetScheduleChoiceAll, &extSeed, &extSchedulerReport};
+
+/*** OUTPUT ***/
+
+struct RunOptions {
+    OutputWriter::Format format = OutputWriter::Format::text;
+    bool latency_distribution = false;
+    bool efficiency = false;
+    bool throughput = false;
+    std::optional<SamplingTarget> sampling_target;
+    std::optional<std::uint32_t> seed;
+    bool antithetic = false;
+    double demand_variance = 0;
+    std::optional<SplittingOptions> splitting;
+    std::optional<std::string> record_schedule;
+};
+
+// Records the choices of the scheduler in every phase (see schedule_trace.hpp).
+class ScheduleRecorder : public SimObserver {
+public:
+    ScheduleRecorder(const std::string& path, const schedule_trace::Dimensions& dimensions) : trace_(path, dimensions) {}
+
+    void begin() override { trace_.begin(); }
+    // Replay starts simulations from ON_BEGIN, not from a saved state.
+    void restored() override { stopped_ = true; }
+    void observe(const PhaseRecord& record) override {
+        if (!stopped_) trace_.record(record.phase, record.choices);
     }
-}
 
-void samplePortTransfer(flow_t flow, node_t destNode, packet_t amountSendNode, packet_t amountDestNode) {
-    if (sampleLatency[flow] == -1 && sampleNodePosition[flow] >= 0) {
-        // We have not sampled the final latency value yet and have been injected.
-        sampleNodePosition[flow] -= amountSendNode;
-        if (sampleNodePosition[flow] < 0) {
-            // The packet leaves the port.
-            if (destNode == FLOWS[flow].egress) {
-                // Packet leaves network
-                sampleLatency[flow] = gCurrentStep - sampleEntryStep[flow];
-                sampleNodePosition[flow] = -1;
-                sampleNode[flow] = -1;
-            } else {
-                // Goes to another port
-                // Proportionally re-calculate position among packets arriving at destination (from back with negative position).
-                sampleNodePosition[flow] *= static_cast<double>(amountDestNode) / static_cast<double>(amountSendNode);
-                // Our new position is how much there is now "plus our negative position" since we subtracted above.
-                // 0-index. If 10 packets was added, and were -10 then we are the first, if -9 we are the last.
-                sampleNodePosition[flow] += get_buffer(destNode, flow);
-                sampleNode[flow] = destNode;
-            }
-        }
+    void finish() { trace_.finish(); }
+
+private:
+    schedule_trace::Writer trace_;
+    bool stopped_ = false;
+};
+
+// The JSON reports of a run, written to stderr as "<name>: <json>" lines, which rossa run reads into <name>.json.
+class JsonReports {
+public:
+    template <typename Report>
+    void add(const std::string& name, const Report& report) {
+        std::ostringstream json;
+        report.write_json(json);
+        add(name, json.str());
+    }
+    void add(const std::string& name, std::string json) {
+        reports_.emplace_back(name, std::move(json));
     }
-}
-
-
-/** NORMAL UPDATE **/
-
-double portUtilization(port_t p) {
-    double dSent = gPortSent[p];
-    return dSent / PORT_BANDWIDTHS[p];
-}
-
-packet_t packetsAtNode(node_t node) {
-    packet_t sum = 0;
-    for_flows(flow, 
-        sum += get_buffer(node, flow);
-    )
-    return sum;
-}
 
-packet_t totalPacketsBuffered() {
-    packet_t sum = 0;
-    for_nodes(node, sum += packetsAtNode(node);)
-    return sum;
-}
+    void write(std::ostream& out) const {
+        for (const auto& [name, json] : reports_) out << name << ": " << json << "\n";
+    }
 
-void nextPhase() {
-    gCurrentPhase += 1;
-    if (gCurrentPhase == NUM_PHASES) {
-        gCurrentPhase = 0;
+private:
+    std::vector<std::pair<std::string, std::string>> reports_;
+};
+
+template <typename Sim>
+void run(Sim& sim, const RunOptions& options) {
+    const auto& model = sim.model();
+    if (options.seed) sim.seed(*options.seed);
+    sim.set_antithetic(options.antithetic);
+    sim.set_demand_variance(options.demand_variance);
+    sim.ON_CONSTRUCT();
+    std::optional<LatencyCurves> latencies;
+    std::optional<FlowThroughput> throughput;
+    std::optional<EfficiencyCounters> efficiency;
+    std::optional<ScheduleRecorder> recorder;
+    if (options.latency_distribution) sim.attach(latencies.emplace(sim.num_flows()));
+    if (options.throughput) sim.attach(throughput.emplace(sim.num_flows()));
+    if (options.efficiency) sim.attach(efficiency.emplace(sim.num_phases(), sim.num_ports()));
+    if (options.record_schedule) {
+        sim.attach(recorder.emplace(*options.record_schedule, schedule_trace::Dimensions{
+            static_cast<std::uint32_t>(sim.num_phases()), static_cast<std::uint32_t>(sim.num_nodes()),
+            static_cast<std::uint32_t>(sim.num_flows()), static_cast<std::uint32_t>(sim.num_switches())}));
     }
-    gCurrentFlowStep += 1;
-    if (gCurrentFlowStep == MAX_FLOW_TIME) {
-        gCurrentFlowStep = 0;
+    JsonReports reports;
+    // Formats and writes the results on its own thread (see output-writer.hpp).
+    OutputWriter writer(std::cout, options.format, sim.num_nodes(), sim.num_ports(), sim.num_flows(), options.throughput);
+    sim.run_one_simulation(model.sim_steps, [&sim, &writer, &model, &throughput](int step) {
+        sim.stageTimings.start();
+        writer.push_step(step, sim.gDidOverflow,
+                         [&sim](node_t node) { return sim.packetsAtNode(node); },
+                         [&sim](port_t port) { return sim.portUtilization(port); },
+                         [&sim](flow_t flow) { return sim.deliveredAtEgress(flow); });
+        sim.stageTimings.lap(Stage::output);
+        // The second half is taken as the steady state, after the network filled up.
+        if (step == model.sim_steps / 2 && throughput) throughput->start_steady_state();
+    });
+
+    // Of the simulation above, not of the shorter sampling runs.
+    if (const auto report = sim.schedulerReport(); report != "{}") reports.add("scheduler-report", report);
+    if (latencies) {
+        sim.detach(*latencies);
+        reports.add("latency-distribution", *latencies);
     }
-    if (sampling) {
-        gCurrentStep += 1;
+    if (throughput) {
+        sim.detach(*throughput);
+        reports.add("throughput", *throughput);
     }
-}
-
-bool validNodeState(node_t n) {
-    return packetsAtNode(n) <= NODE_CAPACITIES[n];
-}
-
-bool updateValidState() {
-    for_nodes(node, 
-        if (!validNodeState(node)) {
-            gDidOverflow = true;
-            return false;
-        }
-    )
-    return true;
-}
-
-void simulatePhase() {
-    // The current sending phase.
-    const phase_t phase = gCurrentPhase;
-    packet_t sentPort[NUM_PORTS][NUM_FLOWS]{};
-    packet_t recv[NUM_NODES][NUM_FLOWS]{};
-    packet_t sentNode[NUM_NODES][NUM_FLOWS]{};
-    double schedule[NUM_FLOWS][NUM_SWITCHES];
-
-    packet_t schedule_choice_output[SCHEDULE_SIZE];
-    extGetScheduleChoiceAll(phase, gNodeBuffers, schedule_choice_output);
-
-    // Calculate sent (only relevant for current phase 'i')
-    for_nodes(node, 
-        for_flows(flow,
-            for_switches(sw, 
-                schedule[flow][sw] = 0;
-            )
-        )
-        for_flows(flow,
-            packet_t buffered = get_buffer(node, flow);
-            packet_t weights[NUM_SWITCHES];
-            packet_t sum = schedule_choice_output[(node * NUM_FLOWS + flow) * (NUM_SWITCHES + 1)];  // a dummy switch to allow not attempting to send all buffered packets in the flow.
-            for_switches(sw, 
-                packet_t choice_weight = schedule_choice_output[(node * NUM_FLOWS + flow) * (NUM_SWITCHES + 1) + sw + 1];
-                weights[sw] = choice_weight;
-                sum += choice_weight;
-            )
-            for_switches(sw, 
-                schedule[flow][sw] = sum == 0 ? 0 : buffered * (weights[sw] / static_cast<double>(sum));
-            )
-        )
-
-        for_switches(sw,
-            port_t p = port_of(node, sw);
-            packet_t portSending = 0;
-
-            // If port is a self-loop in the current phase, just keep the packets. (This is to avoid issues with latency sampling).
-            if (TOPOLOGY[phase][p] != node) {
-                double sum = 0;
-                for_flows(flow,
-                    sum += schedule[flow][sw];
-                )
-                double flow_rate = sum > 0.0 ? fmin(1.0, PORT_BANDWIDTHS[p] / sum) : 0.0;
-
-                for_flows(flow,
-                    const auto sending = static_cast<packet_t>(trunc(schedule[flow][sw] * flow_rate));
-                    portSending += sending;
-                    sentPort[p][flow] = sending;
-                )
-                // If we send less that bandwidth due to rounding down to integer, add packets to the flows with the largest rounding errors.
-                if (flow_rate != 1) while (portSending < PORT_BANDWIDTHS[p]) {
-                    double max_diff = 0;
-                    flow_t flow_with_max_diff = -1;
-                    for_flows(flow,
-                        double diff = schedule[flow][sw] * flow_rate - sentPort[p][flow];
-                        if (sentPort[p][flow] < schedule[flow][sw] && diff > max_diff) {
-                            max_diff = diff;
-                            flow_with_max_diff = flow;
-                        }
-                    )
-                    if (flow_with_max_diff == -1) break;  // If no flows can add packets, stop.
-                    portSending++;
-                    sentPort[p][flow_with_max_diff]++;
-                }
-            }
-            gPortSent[p] = portSending;
-            maxSendFromPortInPhase = portSending > maxSendFromPortInPhase ? portSending : maxSendFromPortInPhase;
-        )
-        for_flows(flow,
-            for_switches(sw,
-                sentNode[node][flow] += sentPort[port_of(node, sw)][flow];
-            )
-        )
-    )
-    // Calculate received
-    for_flows(flow, // For all flows
-        for_ports(pSender,  // For any possible port sender
-            const node_t destNode = TOPOLOGY[phase][pSender];  // Which node is the receiver
-            if (destNode != FLOWS[flow].egress) {  // Egress means packets leave.
-                //Add the sent packages to the receiving node.
-                recv[destNode][flow] += sentPort[pSender][flow];
-            }
-        )
-    )
-    // Update with send/recv
-    for_nodes(node, 
-        for_flows(flow,
-            const packet_t toAdd = recv[node][flow] - sentNode[node][flow];
-            set_buffer(node, flow, get_buffer(node, flow) + toAdd);
-        )
-    )
-
-    if (sampling) {
-        // Must be here after buffers are modified, but before new ingress.
-        for_flows(flow, 
-            if (sampleNode[flow] != -1 &&  // Sample for this flow did not yet ingress network.
-                sentNode[sampleNode[flow]][flow] != 0) {  // Nothing sent on this flow.
-                // Weighted sampling (if flow is split here).
-                node_t node = sampleNode[flow];
-                double sampledWeight = random(sentNode[node][flow]);
-                packet_t sum = 0;
-                port_t sampledPort = -1;
-                for_switches(sw,
-                    port_t port = port_of(node, sw);
-                    const auto w = sentPort[port][flow];
-                    if (sampledWeight >= sum && sampledWeight < sum + w) sampledPort = port;
-                    sum += w;
-                )
-                assert(sampledPort >= 0);
-                node_t destNode = TOPOLOGY[phase][sampledPort];
-                samplePortTransfer(flow, destNode, sentNode[node][flow], recv[destNode][flow]);
-            }
-        )
+    if (efficiency) {
+        sim.detach(*efficiency);
+        reports.add("efficiency", *efficiency);
     }
 
-    // Add ingress
-    for_flows(flow, 
-        const node_t node = FLOWS[flow].ingress;
-        packet_t amount = FLOWS[flow].amount_over_time[gCurrentFlowStep];
-        set_buffer(node, flow, get_buffer(node, flow) + amount);
-        if (sampling) {
-            sampleIngressAdded(flow, amount);
+    writer.push_separator();
+
+    // A fixed number of samples, or until the target precision is reached (see adaptive-sampling.hpp).
+    std::optional<SamplingController> controller;
+    if (options.sampling_target) controller.emplace(*options.sampling_target, sim.num_flows());
+    for (int sample_id = 0; controller ? !controller->done() : sample_id < model.sampling_count; ++sample_id) {
+        sim.run_one_simulation(model.sampling_steps, [](int){});
+        sim.stageTimings.start();
+        writer.push_sample(sample_id, [&sim](flow_t flow) { return sim.sampleLatency[flow]; });
+        sim.stageTimings.lap(Stage::output);
+        if (controller) controller->add(sim.sampleLatency.data());
+    }
+    writer.finish();
+    if (recorder) {
+        // The simulation and every sample.
+        sim.detach(*recorder);
+        recorder->finish();
+    }
+    if (controller) reports.add("sampling-precision", *controller);
+    if (options.splitting) reports.add("overflow-probability", estimate_overflow_probability(sim, *options.splitting));
+    if constexpr (stage_timing) {
+        if (const auto error = sim.stageTimings.perf_error(); !error.empty()) {
+            std::cerr << "Hardware counters unavailable, only counting cycles: " << error << "\n";
         }
-    )
-    updateValidState();
-    nextPhase();
-}
-
-void print_node_and_port_header() {
-    std::cout << "step; gDidOverflow; ";
-    for_nodes(node, std::cout << "packetsAtNode(" << node << "); ";)
-    for_ports(port, std::cout << "portUtilization(" << port << "); ";)
-    std::cout << "\n";
-}
-
-void print_node_and_port(int step) {
-    std::cout << step << "; " << std::boolalpha << gDidOverflow << "; ";
-    for_nodes(node, std::cout << packetsAtNode(node) << "; ";)
-    for_ports(port, std::cout << portUtilization(port) << "; ";)
-    std::cout << "\n";
-}
-
-void print_sampling_header() {
-    std::cout << "sample_id; ";
-    for_flows(flow,
-        std::cout << "sampleLatency[" << flow << "]; ";
-    )
-    std::cout << "\n";
-}
-
-void print_sampling_line(int sample_id) {
-    std::cout << sample_id << "; ";
-    for_flows(flow,
-        std::cout << sampleLatency[flow] << "; ";
-    )
-    std::cout << "\n";
-}
-
-template<typename OutFn>
-void run_one_simulation(int steps, OutFn&& output) {
-    ON_BEGIN();
-    assert(verifyConstraints());
-    setup();
-    int t = 0;
-    output(t);
-    while (t < steps) {
-        t++;
-        simulatePhase();
-        output(t);
+        // Read into timings.json.
+        reports.add("stage-timings", sim.stageTimings);
     }
+    reports.write(std::cerr);
 }
 
-int main() {
-    ON_CONSTRUCT();
-    print_node_and_port_header();
-    run_one_simulation(ROSSA_SIM_STEPS, print_node_and_port);
-
-    std::cout << "@@@\n";  // Print seperator
-
-    print_sampling_header();
-    for (int sample_id = 0; sample_id < ROSSA_SAMPLING_COUNT; ++sample_id) {
-        run_one_simulation(ROSSA_SAMPLING_STEPS, [](int step){});
-        print_sampling_line(sample_id);
+// Usage: sim [--trace <trace-file>] [--binary-output] [--latency-distribution] [--throughput] [--efficiency]
+//            [--sampling-precision <steps> [--sampling-statistic mean|p99|max] [--sampling-confidence <level>]
+//             [--sampling-min <count>] [--sampling-budget <count>]] [--seed <seed> [--antithetic]]
+//            [--demand-variance <percent>] [--overflow-probability <steps> [--splitting-levels <l1,l2,...>]
+//             [--splitting-effort <count>]] [--record-schedule <trace-file>] [model-file]
+// Without a model file the model compiled into the binary is simulated with all dimensions fixed at compile time.
+// With a model file (as written by rossa generate --fast) any model can be simulated by the same binary.
+// A traffic trace (see traffic-trace.hpp) replaces the ingress amounts of the model.
+// With --binary-output the results are written in the binary format of output-writer.hpp instead of as text.
+// With --latency-distribution the latency of every packet of the simulation is derived from the arrival and departure
+// curves of the flows (see latency-curves.hpp) and written to stderr as JSON per flow.
+// With --throughput, the steps of the output also have the packets of every flow delivered at its egress (the goodput),
+// and the offered and delivered packets, goodput and time to drain of every flow (see flow-throughput.hpp) are
+// written to stderr as JSON.
+// With --efficiency, where the packets and the bandwidth of the simulation went (held back, rate limited, delivered
+// directly or over several hops, unused bandwidth by cause, see efficiency-counters.hpp) is written to stderr as JSON.
+// With --sampling-precision, latency samples are taken until the confidence interval of the sampling statistic (default:
+// the mean latency of every flow, at 95% confidence) is within +- that many steps, or the budget (default 1000) is used
+// up, instead of the sampling_count of the model; the achieved precision is written to stderr as JSON.
+// --seed makes the random draws of the simulator and the scheduler reproducible; binaries of different schedulers run
+// with the same seed draw common random numbers (see Simulator::random). --antithetic mirrors the draws of the
+// simulator, for the antithetic twin of the run with the same seed.
+// --demand-variance varies every ingress amount uniformly by +- that percentage, drawn per step and flow like the other
+// draws of the simulator (common with the same seed, mirrored by --antithetic).
+// With --overflow-probability, the probability of an overflow within that many steps (the SMC query) is estimated by
+// multilevel splitting on the fullest node (see rare-event.hpp) and written to stderr as JSON.
+// --record-schedule writes the choices of the scheduler in every simulation (the one written and the samples, not those
+// of --overflow-probability) to a schedule trace (see schedulers/ext/schedule_trace.hpp), which the replay scheduler
+// library serves again.
+// Counters the scheduler keeps over the simulation (extSchedulerReport), e.g. of a bounded RotorLB, are written to
+// stderr as JSON.
+int main(int argc, char** argv) {
+    std::optional<std::string> trace_path;
+    std::optional<std::string> model_path;
+    RunOptions options;
+    SamplingTarget sampling;
+    SplittingOptions splitting;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_value = i + 1 < argc;
+            if (arg == "--trace" && has_value) {
+                trace_path = argv[++i];
+            } else if (arg == "--binary-output") {
+                options.format = OutputWriter::Format::binary;
+            } else if (arg == "--latency-distribution") {
+                options.latency_distribution = true;
+            } else if (arg == "--throughput") {
+                options.throughput = true;
+            } else if (arg == "--efficiency") {
+                options.efficiency = true;
+            } else if (arg == "--sampling-precision" && has_value) {
+                sampling.half_width = std::stod(argv[++i]);
+            } else if (arg == "--sampling-statistic" && has_value) {
+                sampling.statistic = parse_sampling_statistic(argv[++i]);
+            } else if (arg == "--sampling-confidence" && has_value) {
+                sampling.confidence = std::stod(argv[++i]);
+            } else if (arg == "--sampling-min" && has_value) {
+                sampling.min_samples = std::stoi(argv[++i]);
+            } else if (arg == "--sampling-budget" && has_value) {
+                sampling.max_samples = std::stoi(argv[++i]);
+            } else if (arg == "--seed" && has_value) {
+                options.seed = static_cast<std::uint32_t>(std::stoul(argv[++i]));
+            } else if (arg == "--antithetic") {
+                options.antithetic = true;
+            } else if (arg == "--demand-variance" && has_value) {
+                options.demand_variance = std::stod(argv[++i]) / 100.0;
+            } else if (arg == "--overflow-probability" && has_value) {
+                splitting.steps = std::stoi(argv[++i]);
+            } else if (arg == "--splitting-levels" && has_value) {
+                splitting.levels = parse_splitting_levels(argv[++i]);
+            } else if (arg == "--splitting-effort" && has_value) {
+                splitting.effort = std::stoi(argv[++i]);
+            } else if (arg == "--record-schedule" && has_value) {
+                options.record_schedule = argv[++i];
+            } else if (!model_path && arg.rfind("--", 0) != 0) {
+                model_path = arg;
+            } else {
+                std::cerr << "Usage: " << argv[0] << " [--trace <trace-file>] [--binary-output] [--latency-distribution] [--throughput] [--efficiency] "
+                          << "[--sampling-precision <steps> [--sampling-statistic mean|p99|max] [--sampling-confidence <level>] "
+                          << "[--sampling-min <count>] [--sampling-budget <count>]] [--seed <seed> [--antithetic]] "
+                          << "[--demand-variance <percent>] [--overflow-probability <steps> [--splitting-levels <l1,l2,...>] [--splitting-effort <count>]] "
+                          << "[--record-schedule <trace-file>] [model-file]\n";
+                return 2;
+            }
+        }
+        if (sampling.half_width > 0) options.sampling_target = sampling;
+        if (splitting.steps > 0) options.splitting = splitting;
+
+        if (model_path) {
+            std::ifstream in(*model_path);
+            if (!in) throw std::runtime_error("Could not open model file: " + *model_path);
+            auto model = read_model(in);
+            if (trace_path) model.use_trace(std::make_shared<const TrafficTrace>(*trace_path));
+            with_runtime_simulator(std::move(model), LINKED_SCHEDULER, [&options](auto& sim) { run(sim, options); });
+            return 0;
+        }
+#ifndef SIM_NO_COMPILED_MODEL
+        auto model = compiled_model();
+        if (!trace_path) trace_path = compiled_trace_path();
+        if (trace_path) model.use_trace(std::make_shared<const TrafficTrace>(*trace_path));
+        Simulator<NUM_NODES, NUM_FLOWS, NUM_SWITCHES> sim(std::move(model), LINKED_SCHEDULER);
+        run(sim, options);
+        return 0;
+#else
+        throw std::runtime_error("No model compiled into this binary, give a model file.");
+#endif
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 2;
     }
 }
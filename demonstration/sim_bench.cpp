@@ -0,0 +1,228 @@
+// Microbenchmark of simulatePhase on synthetic rotor networks (Google Benchmark), one phase per iteration.
+// Networks are parameterized by nodes N, flows F, switches S and phases P (benchmark_network in generators.hpp, shared
+// with schedulers/bench/scheduler_bench.cpp), with a constant ingress amount per flow. Runs with the runtime model path
+// (with_runtime_simulator), so S = 2, 4 and 8 use the specialized instantiations.
+//     sim_bench --benchmark_out=sim.json --benchmark_out_format=json
+//
+// "engine" sends every flow directly to its egress without a scheduler library, to time the engine on its own. The
+// scheduler libraries are those built alongside (fixed, valiant, rotor_lb) or, if set, the paths in the environment
+// variable ROSSA_BENCH_SCHEDULERS (separated by ':').
+//
+// For the runtime models in ROSSA_BENCH_MODELS (separated by ':', e.g. the instances in bench/instances) there are
+// also, per scheduler library, BM_InstancePhase (simulatePhase, restarting after sim_steps phases as a simulation
+// query does) and BM_InstanceSchedule (extGetScheduleChoiceAll alone, on the buffers recorded from a simulation).
+// Every benchmark reports the peak RSS of the process, see bench/compare.py for the regression gate using them.
+#include <sys/resource.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "generators.hpp"
+#include "scheduler-library.hpp"
+#include "sim-engine.hpp"
+
+constexpr packet_t AMOUNT = 10;
+
+SimModel synthetic_model(const benchmark::State& state) {
+    return to_sim_model(benchmark_network(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)),
+                                          static_cast<int>(state.range(2)), static_cast<int>(state.range(3)), AMOUNT));
+}
+
+void network_sizes(benchmark::internal::Benchmark* b) {
+    for (const auto& [n, f, s, p] : benchmark_network_sizes()) b->Args({n, f, s, p});
+    b->ArgNames({"N", "F", "S", "P"});
+}
+
+void set_peak_rss(benchmark::State& state) {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    state.counters["peak_rss_kb"] = static_cast<double>(usage.ru_maxrss);
+}
+
+std::vector<std::string> split_paths(const char* paths) {
+    std::vector<std::string> result;
+    std::istringstream in(paths);
+    for (std::string path; std::getline(in, path, ':');) {
+        if (!path.empty()) result.push_back(path);
+    }
+    return result;
+}
+
+std::string file_stem(const std::string& path) {
+    const auto name = path.substr(path.find_last_of('/') + 1);
+    return name.substr(0, name.find('.'));
+}
+
+/*** ENGINE-ONLY SCHEDULER ***/
+
+// Sends every flow directly once its egress is connected and keeps it buffered until then.
+namespace direct {
+    int32_t num_nodes = 0;
+    int32_t num_switches = 0;
+    std::vector<node_t> topology;
+    std::vector<Flow> flows;
+
+    void push_network(int32_t num_phases, int32_t nodes, int32_t num_flows, int32_t switches, const packet_t*, const packet_t*) {
+        num_nodes = nodes;
+        num_switches = switches;
+        topology.assign(num_phases * nodes * switches, 0);
+        flows.assign(num_flows, {});
+    }
+    void push_topology(phase_t phase, const node_t* targets) {
+        std::copy_n(targets, num_nodes * num_switches, &topology[phase * num_nodes * num_switches]);
+    }
+    void push_flow(flow_t flow, node_t ingress, node_t egress) { flows[flow] = {ingress, egress}; }
+    void scheduler_init() {}
+    void get_schedule_choice_all(phase_t phase, const packet_t*, int32_t* output) {
+        const node_t* targets = &topology[phase * num_nodes * num_switches];
+        for (node_t node = 0; node < num_nodes; ++node) {
+            for (flow_t flow = 0; flow < static_cast<flow_t>(flows.size()); ++flow) {
+                int32_t* choice = &output[(node * flows.size() + flow) * (num_switches + 1)];
+                choice[0] = 1;
+                for (switch_t sw = 0; sw < num_switches; ++sw) {
+                    choice[sw + 1] = targets[node * num_switches + sw] == flows[flow].egress ? 1 : 0;
+                    if (choice[sw + 1] == 1) choice[0] = 0;
+                }
+            }
+        }
+    }
+    constexpr SchedulerApi api{&push_network, &push_topology, &push_flow, &scheduler_init, &get_schedule_choice_all};
+}
+
+void BM_SimulatePhase(benchmark::State& state, const std::string& library_path) {
+    std::unique_ptr<SchedulerLibrary> library;
+    if (!library_path.empty()) {
+        try {
+            library = std::make_unique<SchedulerLibrary>(library_path);
+        } catch (const std::exception& e) {
+            state.SkipWithError(e.what());
+            return;
+        }
+    }
+    auto model = synthetic_model(state);
+    with_runtime_simulator(std::move(model), library ? library->api() : direct::api, [&state](auto& sim) {
+        sim.seed(1);
+        sim.ON_CONSTRUCT();
+        sim.reset_run();
+        for (auto _ : state) {
+            sim.simulatePhase();
+            benchmark::DoNotOptimize(sim.gNodeBuffers.data());
+        }
+        state.counters["overflow"] = sim.gDidOverflow;
+    });
+    state.SetItemsProcessed(state.iterations());
+    state.counters["N"] = static_cast<double>(state.range(0));
+    state.counters["F"] = static_cast<double>(state.range(1));
+    state.counters["S"] = static_cast<double>(state.range(2));
+    state.counters["P"] = static_cast<double>(state.range(3));
+    set_peak_rss(state);
+}
+
+/*** INSTANCES ***/
+
+std::unique_ptr<SchedulerLibrary> load_library(benchmark::State& state, const std::string& path) {
+    try {
+        return std::make_unique<SchedulerLibrary>(path);
+    } catch (const std::exception& e) {
+        state.SkipWithError(e.what());
+        return nullptr;
+    }
+}
+
+void BM_InstancePhase(benchmark::State& state, const std::shared_ptr<const SimModel>& model, const std::string& library_path) {
+    const auto library = load_library(state, library_path);
+    if (!library) return;
+    with_runtime_simulator(model, library->api(), [&state, &model](auto& sim) {
+        sim.seed(1);
+        sim.ON_CONSTRUCT();
+        int step = model->sim_steps;
+        for (auto _ : state) {
+            if (step == model->sim_steps) {
+                state.PauseTiming();
+                sim.reset_run();
+                step = 0;
+                state.ResumeTiming();
+            }
+            sim.simulatePhase();
+            benchmark::DoNotOptimize(sim.gNodeBuffers.data());
+            step++;
+        }
+    });
+    state.SetItemsProcessed(state.iterations());
+    set_peak_rss(state);
+}
+
+void BM_InstanceSchedule(benchmark::State& state, const std::shared_ptr<const SimModel>& model, const std::string& library_path) {
+    constexpr int MAX_SNAPSHOTS = 256;
+    const auto library = load_library(state, library_path);
+    if (!library) return;
+    const auto& api = library->api();
+    // The scheduler state is left as after the recording simulation, as when the simulator calls it.
+    std::vector<std::pair<phase_t, std::vector<packet_t>>> snapshots;
+    with_runtime_simulator(model, api, [&](auto& sim) {
+        sim.seed(1);
+        sim.ON_CONSTRUCT();
+        sim.run_one_simulation(std::min(model->sim_steps, MAX_SNAPSHOTS), [&](int) {
+            snapshots.emplace_back(sim.gCurrentPhase, std::vector<packet_t>(sim.gNodeBuffers.begin(), sim.gNodeBuffers.end()));
+        });
+    });
+    std::vector<int32_t> output(model->num_nodes * model->num_flows * (model->num_switches + 1));
+    std::size_t call = 0;
+    for (auto _ : state) {
+        const auto& [phase, buffers] = snapshots[call % snapshots.size()];
+        api.get_schedule_choice_all(phase, buffers.data(), output.data());
+        benchmark::DoNotOptimize(output.data());
+        call++;
+    }
+    state.SetItemsProcessed(state.iterations());
+    set_peak_rss(state);
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> libraries;
+    if (const char* paths = std::getenv("ROSSA_BENCH_SCHEDULERS")) {
+        libraries = split_paths(paths);
+    } else {
+#ifdef SCHEDULER_LIBRARIES
+        libraries = split_paths(SCHEDULER_LIBRARIES);
+#endif
+    }
+    benchmark::RegisterBenchmark("BM_SimulatePhase/engine", BM_SimulatePhase, std::string())
+        ->Apply(network_sizes)
+        ->Unit(benchmark::kMicrosecond);
+    for (const auto& path : libraries) {
+        const auto name = path.substr(path.find_last_of('/') + 1);
+        benchmark::RegisterBenchmark(("BM_SimulatePhase/" + name).c_str(), BM_SimulatePhase, path)
+            ->Apply(network_sizes)
+            ->Unit(benchmark::kMicrosecond);
+    }
+    if (const char* paths = std::getenv("ROSSA_BENCH_MODELS")) {
+        for (const auto& model_path : split_paths(paths)) {
+            std::ifstream in(model_path);
+            if (!in) {
+                std::cerr << "Could not open model file: " << model_path << "\n";
+                return 2;
+            }
+            const auto model = std::make_shared<const SimModel>(read_model(in));
+            for (const auto& path : libraries) {
+                const auto suffix = "/" + file_stem(model_path) + "/" + file_stem(path);
+                benchmark::RegisterBenchmark(("BM_InstancePhase" + suffix).c_str(), BM_InstancePhase, model, path)
+                    ->Unit(benchmark::kMicrosecond);
+                benchmark::RegisterBenchmark(("BM_InstanceSchedule" + suffix).c_str(), BM_InstanceSchedule, model, path)
+                    ->Unit(benchmark::kMicrosecond);
+            }
+        }
+    }
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
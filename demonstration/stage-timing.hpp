@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "alloc-count.hpp"
+#include "perf-counters.hpp"
+
+/*
+    Cycles spent per stage of Simulator::simulatePhase (and in the output of the sim binary), for finding the stage to
+    optimize for a given topology. Only compiled in with SIM_STAGE_TIMING (cmake -DSIM_STAGE_TIMING=ON); otherwise every
+    call is discarded at compile time.
+    Cycles are from the time stamp counter where available (x86), else nanoseconds of the steady clock. ms per stage is
+    estimated from the cycles counted against the steady clock over the whole run.
+    With SIM_PERF_COUNTERS (implies SIM_STAGE_TIMING) the hardware counters of perf-counters.hpp are also accumulated
+    per stage, for the thread constructing the simulator; if they cannot be opened only the cycles are counted.
+    With SIM_ALLOC_TRACKING (implies SIM_STAGE_TIMING, and alloc-count.cpp must be linked) the heap allocations of
+    each stage are counted, those of the scheduler stage being the allocations of the scheduler library.
+*/
+#if (defined(SIM_PERF_COUNTERS) || defined(SIM_ALLOC_TRACKING)) && !defined(SIM_STAGE_TIMING)
+#define SIM_STAGE_TIMING
+#endif
+#ifdef SIM_STAGE_TIMING
+inline constexpr bool stage_timing = true;
+#else
+inline constexpr bool stage_timing = false;
+#endif
+#ifdef SIM_PERF_COUNTERS
+inline constexpr bool stage_perf_counters = true;
+#else
+inline constexpr bool stage_perf_counters = false;
+#endif
+
+enum class Stage {
+    scheduler,       // extGetScheduleChoiceAll
+    normalization,   // Choice weights to per-switch schedules
+    rate_limit,      // Per-port bandwidth sharing, rounded down
+    rounding_topup,  // Filling the port bandwidth left by rounding down
+    receive,         // Scatter of sent packets to the receiving nodes
+    buffer_update,   // Resetting scratch memory, summing sent per node, applying send/receive to the buffers
+    sampling,        // Latency sample transfers
+    ingress,         // New packets, overflow check and next phase
+    observers,       // The observers attached to the simulator (SimObserver), e.g. latency curves
+    output,          // Handing the results to the output writer thread (sim binary only)
+    count
+};
+
+inline constexpr std::array<const char*, static_cast<std::size_t>(Stage::count)> STAGE_NAMES{
+    "scheduler", "normalization", "rate_limit", "rounding_topup", "receive", "buffer_update", "sampling", "ingress", "observers", "output"};
+
+inline std::uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Cycles (and counters) of a stage are those since the previous lap (or start).
+class StageTimings {
+public:
+    StageTimings() {
+        if constexpr (stage_perf_counters) perf_ = std::make_unique<PerfCounters>();
+    }
+
+    void start() {
+        if constexpr (stage_timing) last_ = read_cycles();
+        if constexpr (alloc_tracking) allocations_last_ = threadAllocations;
+        if constexpr (stage_perf_counters) perf_last_ = perf_->read();
+    }
+    void lap(Stage stage) {
+        const auto index = static_cast<std::size_t>(stage);
+        if constexpr (stage_timing) {
+            const auto now = read_cycles();
+            cycles_[index] += now - last_;
+            laps_[index]++;
+            last_ = now;
+        }
+        if constexpr (alloc_tracking) {
+            const auto now = threadAllocations;
+            allocations_[index].allocations += now.allocations - allocations_last_.allocations;
+            allocations_[index].bytes += now.bytes - allocations_last_.bytes;
+            allocations_last_ = now;
+        }
+        if constexpr (stage_perf_counters) {
+            if (perf_->available()) {
+                const auto now = perf_->read();
+                for (int counter = 0; counter < PerfCounters::count; ++counter) {
+                    perf_counts_[index][counter] += now[counter] - perf_last_[counter];
+                }
+                perf_last_ = now;
+            }
+        }
+    }
+    [[nodiscard]] std::uint64_t cycles(Stage stage) const { return cycles_[static_cast<std::size_t>(stage)]; }
+    [[nodiscard]] std::uint64_t laps(Stage stage) const { return laps_[static_cast<std::size_t>(stage)]; }
+    [[nodiscard]] const AllocationCount& allocations(Stage stage) const { return allocations_[static_cast<std::size_t>(stage)]; }
+    // Forgets all counts so far, e.g. those of a warm-up.
+    void reset() {
+        cycles_ = {};
+        laps_ = {};
+        allocations_ = {};
+        perf_counts_ = {};
+    }
+
+    // Why the hardware counters are not counted, empty if they are (or were not compiled in).
+    [[nodiscard]] std::string perf_error() const { return perf_ && !perf_->available() ? perf_->error() : ""; }
+
+    // {"<stage>": {"cycles": ..., "ms": ..., "laps": ...[, "allocations": ..., "allocated_bytes": ...]
+    //  [, "perf": {"cycles": ..., ..., "ipc": ...}]}, ...} on one line.
+    // The laps of the scheduler stage are the scheduler calls.
+    void write_json(std::ostream& out) const {
+        const double ms_per_cycle = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - clock_begin_).count() /
+                                    static_cast<double>(read_cycles() - cycles_begin_);
+        out << "{";
+        for (std::size_t stage = 0; stage < cycles_.size(); ++stage) {
+            out << (stage == 0 ? "" : ", ") << '"' << STAGE_NAMES[stage] << "\": {\"cycles\": " << cycles_[stage]
+                << ", \"ms\": " << static_cast<double>(cycles_[stage]) * ms_per_cycle << ", \"laps\": " << laps_[stage];
+            if constexpr (alloc_tracking) {
+                out << ", \"allocations\": " << allocations_[stage].allocations << ", \"allocated_bytes\": " << allocations_[stage].bytes;
+            }
+            if (perf_ && perf_->available()) {
+                const auto& counts = perf_counts_[stage];
+                out << ", \"perf\": {";
+                for (int counter = 0; counter < PerfCounters::count; ++counter) {
+                    out << '"' << PerfCounters::NAMES[counter] << "\": " << counts[counter] << ", ";
+                }
+                const auto core_cycles = counts[PerfCounters::cycles];
+                out << "\"ipc\": " << (core_cycles == 0 ? 0.0 : static_cast<double>(counts[PerfCounters::instructions]) / static_cast<double>(core_cycles)) << "}";
+            }
+            out << "}";
+        }
+        out << "}";
+    }
+
+private:
+    std::array<std::uint64_t, static_cast<std::size_t>(Stage::count)> cycles_{};
+    std::array<std::uint64_t, static_cast<std::size_t>(Stage::count)> laps_{};
+    std::array<AllocationCount, static_cast<std::size_t>(Stage::count)> allocations_{};
+    AllocationCount allocations_last_{};
+    std::uint64_t last_ = 0;
+    std::unique_ptr<PerfCounters> perf_;
+    PerfCounters::Values perf_last_{};
+    std::array<PerfCounters::Values, static_cast<std::size_t>(Stage::count)> perf_counts_{};
+    std::chrono::steady_clock::time_point clock_begin_ = std::chrono::steady_clock::now();
+    std::uint64_t cycles_begin_ = read_cycles();
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "sim-engine.hpp"
+
+/*
+    The choices of a scheduler in every phase, for one whose choices in a phase never change (e.g. fixed), so that they
+    can be written into the UPPAAL declarations as a table instead of calling the library on every transition
+    (rossa generate --static-schedule). Whether they never change cannot be told from asking a few times, so the
+    scheduler declares it (extStaticSchedule, which libraries built before it do not define): it is not asked for the
+    table otherwise. check static-schedule compares the table against every call of simulations.
+*/
+struct StaticSchedule {
+    int num_phases = 0;
+    std::size_t choices_per_phase = 0;  // num_nodes x num_flows x (num_switches + 1), as extGetScheduleChoiceAll.
+    std::vector<int32_t> choices;       // num_phases x choices_per_phase.
+
+    [[nodiscard]] const int32_t* phase(phase_t phase) const { return &choices[phase * choices_per_phase]; }
+};
+
+// Throws std::invalid_argument for a scheduler that does not declare static choices. The scheduler is initialized
+// (extSchedulerInit) for the model, so the caller holds the lock of a library without thread-local state.
+inline StaticSchedule static_schedule(SimModel model, const SchedulerApi& scheduler) {
+    return with_runtime_simulator(std::move(model), scheduler, [&](auto& sim) {
+        sim.ON_CONSTRUCT();
+        if (scheduler.static_schedule == nullptr || scheduler.static_schedule() == 0) {
+            throw std::invalid_argument("The scheduler does not declare static choices (extStaticSchedule)");
+        }
+        StaticSchedule table;
+        table.num_phases = sim.num_phases();
+        table.choices_per_phase = static_cast<std::size_t>(sim.num_nodes()) * sim.num_flows() * (sim.num_switches() + 1);
+        table.choices.resize(table.num_phases * table.choices_per_phase);
+        const std::vector<packet_t> empty(static_cast<std::size_t>(sim.num_nodes()) * sim.num_flows(), 0);
+        for (phase_t phase = 0; phase < table.num_phases; ++phase) {
+            sim.scheduleChoices(phase, empty.data(), &table.choices[phase * table.choices_per_phase]);
+        }
+        return table;
+    });
+}
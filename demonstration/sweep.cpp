@@ -0,0 +1,378 @@
+// Runs a parameter sweep (scheduler x port bandwidth x node capacity x traffic x seed) over a runtime model in one
+// process, on a work-stealing thread pool. Results stream to a single output file, one line per scenario in completion
+// order.
+//
+// Usage: sweep <spec-file> <output-file> [threads]
+//
+// The spec file has one axis per line ('#' starts a comment), e.g.
+//     model sim-model.txt
+//     scheduler ./schedulers/rotor_lb/librotor_lb.so ./schedulers/fixed/libfixed.so
+//     bandwidth 300 350 400
+//     capacity 4000 6000
+//     trace day.rtrace night.rtrace
+//     seed 1 2 3
+//     demand_variance 20
+//     antithetic on
+// model and scheduler are required. bandwidth and capacity replace the value of all ports or nodes of the model, trace
+// replaces its ingress amounts by a traffic trace (traffic-trace.hpp), and seed seeds the sampling of the simulator and
+// the scheduler. The traffic of the model (or trace) is the same for every seed unless demand_variance varies every
+// ingress amount by up to that percentage, drawn from the seed (Simulator::set_demand_variance). antithetic on adds the
+// antithetic twin (Simulator::set_antithetic) of every seeded scenario, which mirrors the demand variance as well.
+//
+// With more than one scheduler and at least two seeds, the differences of each scheduler to the first are written to
+// stdout: per bandwidth, capacity and trace, the mean over the seeds of the paired differences with their confidence
+// interval, next to the interval the same number of independent runs would give. Scenarios with the same seed draw
+// common random numbers, so the paired interval is the narrower one where the schedulers react alike to the draws.
+// Schedulers should be built with EXT_THREAD_LOCAL_STATE, otherwise each runs one scenario at a time. Scheduler
+// parameters are read from the environment as usual.
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include "adaptive-sampling.hpp"
+#include "scheduler-library.hpp"
+#include "sim-engine.hpp"
+
+struct SweepSpec {
+    std::string model_path;
+    std::vector<std::string> schedulers;
+    std::vector<std::optional<packet_t>> bandwidths{std::nullopt};
+    std::vector<std::optional<packet_t>> capacities{std::nullopt};
+    std::vector<std::optional<std::string>> traces{std::nullopt};
+    std::vector<std::optional<std::uint32_t>> seeds{std::nullopt};
+    double demand_variance = 0;  // A fraction.
+    bool antithetic = false;
+};
+
+SweepSpec read_spec(std::istream& in) {
+    SweepSpec spec;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string axis;
+        if (!(words >> axis)) continue;
+        auto read_values = [&words, &axis]<typename T>(std::vector<std::optional<T>>& values) {
+            values.clear();
+            T value;
+            while (words >> value) values.emplace_back(value);
+            if (!words.eof() || values.empty()) throw std::runtime_error("Bad sweep spec: invalid values for " + axis);
+        };
+        if (axis == "model") {
+            words >> spec.model_path;
+        } else if (axis == "scheduler") {
+            std::string path;
+            while (words >> path) spec.schedulers.push_back(path);
+        } else if (axis == "bandwidth") {
+            read_values(spec.bandwidths);
+        } else if (axis == "capacity") {
+            read_values(spec.capacities);
+        } else if (axis == "trace") {
+            read_values(spec.traces);
+        } else if (axis == "seed") {
+            read_values(spec.seeds);
+        } else if (axis == "demand_variance") {
+            if (!(words >> spec.demand_variance) || spec.demand_variance < 0 || spec.demand_variance > 100) {
+                throw std::runtime_error("Bad sweep spec: demand_variance is a percentage");
+            }
+            spec.demand_variance /= 100;
+        } else if (axis == "antithetic") {
+            std::string value;
+            words >> value;
+            if (value != "on" && value != "off") throw std::runtime_error("Bad sweep spec: antithetic is on or off");
+            spec.antithetic = value == "on";
+        } else {
+            throw std::runtime_error("Bad sweep spec: unknown axis " + axis);
+        }
+    }
+    if (spec.model_path.empty() || spec.schedulers.empty()) throw std::runtime_error("Bad sweep spec: model and scheduler are required");
+    if (spec.antithetic && !spec.seeds.front()) throw std::runtime_error("Bad sweep spec: antithetic needs seeds");
+    if (spec.demand_variance > 0 && !spec.seeds.front()) throw std::runtime_error("Bad sweep spec: demand_variance needs seeds");
+    return spec;
+}
+
+struct Scenario {
+    std::size_t id;
+    std::size_t scheduler;
+    std::optional<packet_t> bandwidth;
+    std::optional<packet_t> capacity;
+    std::size_t trace;
+    std::optional<std::uint32_t> seed;
+    bool antithetic;
+};
+
+struct ScenarioResult {
+    bool did_overflow = false;
+    packet_t max_packets_at_node = 0;
+    double mean_port_utilization = 0;
+    double mean_sample_latency = 0;
+    int max_sample_latency = 0;
+    int missing_samples = 0;  // Sampled packets that did not reach their egress within the sampling steps.
+};
+
+template <typename Sim>
+ScenarioResult simulate(Sim& sim) {
+    const auto& model = sim.model();
+    ScenarioResult result;
+    double utilization_sum = 0;
+    sim.ON_CONSTRUCT();
+    sim.run_one_simulation(model.sim_steps, [&](int step) {
+        result.did_overflow |= sim.gDidOverflow;
+        for (int node = 0; node < sim.num_nodes(); ++node) result.max_packets_at_node = std::max(result.max_packets_at_node, sim.packetsAtNode(node));
+        if (step == 0) return;  // Nothing sent yet.
+        for (int port = 0; port < sim.num_ports(); ++port) utilization_sum += sim.portUtilization(port);
+    });
+    result.mean_port_utilization = model.sim_steps == 0 ? 0 : utilization_sum / (static_cast<double>(model.sim_steps) * sim.num_ports());
+
+    double latency_sum = 0;
+    int latency_count = 0;
+    for (int sample_id = 0; sample_id < model.sampling_count; ++sample_id) {
+        sim.run_one_simulation(model.sampling_steps, [](int) {});
+        for (int flow = 0; flow < sim.num_flows(); ++flow) {
+            const int latency = sim.sampleLatency[flow];
+            if (latency < 0) {
+                result.missing_samples++;
+                continue;
+            }
+            latency_sum += latency;
+            latency_count++;
+            result.max_sample_latency = std::max(result.max_sample_latency, latency);
+        }
+    }
+    result.mean_sample_latency = latency_count == 0 ? 0 : latency_sum / latency_count;
+    return result;
+}
+
+/*
+    The differences of every scheduler to the first, paired by seed: the scenarios are laid out scheduler-major with the
+    seeds (and their antithetic twins) innermost, see main. The twins of a seed are averaged into one observation.
+*/
+void write_paired_differences(std::ostream& out, const SweepSpec& spec, const std::vector<ScenarioResult>& results) {
+    constexpr double CONFIDENCE = 0.95;
+    const std::size_t twins = spec.antithetic ? 2 : 1;
+    const std::size_t seeds = spec.seeds.size();
+    const std::size_t settings = spec.bandwidths.size() * spec.capacities.size() * spec.traces.size();
+    const std::pair<const char*, double (*)(const ScenarioResult&)> metrics[] = {
+        {"mean_sample_latency", [](const ScenarioResult& r) { return r.mean_sample_latency; }},
+        {"max_sample_latency", [](const ScenarioResult& r) { return static_cast<double>(r.max_sample_latency); }},
+        {"mean_port_utilization", [](const ScenarioResult& r) { return r.mean_port_utilization; }},
+        {"max_packets_at_node", [](const ScenarioResult& r) { return static_cast<double>(r.max_packets_at_node); }},
+    };
+    auto variance = [](const std::vector<double>& values, double mean) {
+        double squares = 0;
+        for (const double value : values) squares += (value - mean) * (value - mean);
+        return squares / static_cast<double>(values.size() - 1);
+    };
+    auto mean = [](const std::vector<double>& values) {
+        double sum = 0;
+        for (const double value : values) sum += value;
+        return sum / static_cast<double>(values.size());
+    };
+
+    out << "Paired differences to " << spec.schedulers.front() << " over " << seeds << " seeds"
+        << (spec.antithetic ? " (antithetic twins averaged)" : "") << ", " << CONFIDENCE * 100 << "% confidence:\n";
+    out << "scheduler; bandwidth; capacity; trace; metric; difference; half_width; independent_half_width; \n";
+    const double t = student_t_quantile(CONFIDENCE, static_cast<double>(seeds - 1));
+    const double t_independent = student_t_quantile(CONFIDENCE, static_cast<double>(2 * seeds - 2));
+    std::vector<double> base(seeds), other(seeds), differences(seeds);
+    for (std::size_t scheduler = 1; scheduler < spec.schedulers.size(); ++scheduler) {
+        for (std::size_t setting = 0; setting < settings; ++setting) {
+            const std::size_t trace = setting % spec.traces.size();
+            const std::size_t capacity = setting / spec.traces.size() % spec.capacities.size();
+            const std::size_t bandwidth = setting / spec.traces.size() / spec.capacities.size();
+            for (const auto& [name, metric] : metrics) {
+                auto observation = [&](std::size_t s, std::size_t seed) {
+                    const std::size_t first = ((s * settings + setting) * seeds + seed) * twins;
+                    double sum = 0;
+                    for (std::size_t twin = 0; twin < twins; ++twin) sum += metric(results[first + twin]);
+                    return sum / static_cast<double>(twins);
+                };
+                for (std::size_t seed = 0; seed < seeds; ++seed) {
+                    base[seed] = observation(0, seed);
+                    other[seed] = observation(scheduler, seed);
+                    differences[seed] = other[seed] - base[seed];
+                }
+                const double difference = mean(differences);
+                const double half_width = t * std::sqrt(variance(differences, difference) / static_cast<double>(seeds));
+                const double independent_half_width =
+                    t_independent * std::sqrt((variance(base, mean(base)) + variance(other, mean(other))) / static_cast<double>(seeds));
+                auto value_or_model = [](const auto& value) { return value ? std::to_string(*value) : std::string("model"); };
+                out << spec.schedulers[scheduler] << "; " << value_or_model(spec.bandwidths[bandwidth]) << "; "
+                    << value_or_model(spec.capacities[capacity]) << "; " << spec.traces[trace].value_or("model") << "; "
+                    << name << "; " << difference << "; " << half_width << "; " << independent_half_width << "; \n";
+            }
+        }
+    }
+}
+
+/*
+    Runs a fixed set of tasks on a number of threads. The tasks are split in contiguous blocks, one per worker. A worker
+    takes tasks from the back of its own deque and, once that is empty, steals from the front of the others.
+*/
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned num_threads) : queues_(std::max(1u, num_threads)) {}
+
+    // Calls task(i) for every i in [0, num_tasks) and returns when all are done. Rethrows the first exception of a task.
+    void run(std::size_t num_tasks, const std::function<void(std::size_t)>& task) {
+        const std::size_t num_workers = queues_.size();
+        for (std::size_t worker = 0; worker < num_workers; ++worker) {
+            queues_[worker].tasks.clear();
+            for (std::size_t i = worker * num_tasks / num_workers; i < (worker + 1) * num_tasks / num_workers; ++i) {
+                queues_[worker].tasks.push_back(i);
+            }
+        }
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        std::vector<std::thread> threads;
+        for (std::size_t worker = 0; worker < num_workers; ++worker) {
+            threads.emplace_back([&, worker] {
+                while (const auto i = next_task(worker)) {
+                    try {
+                        task(*i);
+                    } catch (...) {
+                        std::lock_guard lock(error_mutex);
+                        if (!error) error = std::current_exception();
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        if (error) std::rethrow_exception(error);
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+
+    std::optional<std::size_t> next_task(std::size_t worker) {
+        {
+            auto& own = queues_[worker];
+            std::lock_guard lock(own.mutex);
+            if (!own.tasks.empty()) {
+                const auto task = own.tasks.back();
+                own.tasks.pop_back();
+                return task;
+            }
+        }
+        // No tasks are added while running, so when every queue was seen empty all tasks are taken.
+        for (std::size_t offset = 1; offset < queues_.size(); ++offset) {
+            auto& victim = queues_[(worker + offset) % queues_.size()];
+            std::lock_guard lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                const auto task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return task;
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::vector<Queue> queues_;
+};
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " <spec-file> <output-file> [threads]\n";
+        return 2;
+    }
+    try {
+        std::ifstream spec_file(argv[1]);
+        if (!spec_file) throw std::runtime_error(std::string("Could not open sweep spec: ") + argv[1]);
+        const auto spec = read_spec(spec_file);
+        std::ifstream model_file(spec.model_path);
+        if (!model_file) throw std::runtime_error("Could not open model file: " + spec.model_path);
+        const auto base_model = read_model(model_file);
+        const unsigned num_threads = argc == 4 ? static_cast<unsigned>(std::stoul(argv[3])) : std::thread::hardware_concurrency();
+
+        std::vector<std::unique_ptr<SchedulerLibrary>> schedulers;
+        for (const auto& path : spec.schedulers) {
+            schedulers.push_back(std::make_unique<SchedulerLibrary>(path));
+            if (!schedulers.back()->thread_local_state() && num_threads > 1) {
+                std::cerr << "Warning: " << path << " was not built with EXT_THREAD_LOCAL_STATE, its scenarios run one at a time.\n";
+            }
+        }
+
+        // One model per trace (mapped once), shared read-only by all scenarios using it. The simulators replace the
+        // bandwidths and capacities of a scenario.
+        std::vector<std::shared_ptr<const SimModel>> models;
+        for (const auto& path : spec.traces) {
+            auto model = base_model;
+            if (path) model.use_trace(std::make_shared<const TrafficTrace>(*path));
+            models.push_back(std::make_shared<const SimModel>(std::move(model)));
+        }
+        if (spec.seeds.size() > 1 && spec.demand_variance == 0) {
+            std::cerr << "Note: the seeds vary the sampling and the scheduler, not the traffic (see demand_variance).\n";
+        }
+
+        std::vector<Scenario> scenarios;
+        for (std::size_t scheduler = 0; scheduler < schedulers.size(); ++scheduler) {
+            for (const auto bandwidth : spec.bandwidths) {
+                for (const auto capacity : spec.capacities) {
+                    for (std::size_t trace = 0; trace < models.size(); ++trace) {
+                        for (const auto seed : spec.seeds) {
+                            scenarios.push_back({scenarios.size(), scheduler, bandwidth, capacity, trace, seed, false});
+                            if (spec.antithetic) scenarios.push_back({scenarios.size(), scheduler, bandwidth, capacity, trace, seed, true});
+                        }
+                    }
+                }
+            }
+        }
+
+        std::ofstream out(argv[2]);
+        if (!out) throw std::runtime_error(std::string("Could not open output file: ") + argv[2]);
+        out << "scenario; scheduler; bandwidth; capacity; trace; seed; antithetic; did_overflow; max_packets_at_node; mean_port_utilization; "
+               "mean_sample_latency; max_sample_latency; missing_samples; \n";
+        std::mutex out_mutex;
+        std::atomic<std::size_t> completed = 0;
+        std::vector<ScenarioResult> results(scenarios.size());
+
+        WorkStealingPool pool(num_threads);
+        pool.run(scenarios.size(), [&](std::size_t i) {
+            const auto& scenario = scenarios[i];
+            auto& scheduler = *schedulers[scenario.scheduler];
+            std::unique_lock<std::mutex> lock;
+            if (!scheduler.thread_local_state()) lock = scheduler.lock();
+            const auto result = with_runtime_simulator(models[scenario.trace], scheduler.api(), [&scenario, &spec](auto& sim) {
+                if (scenario.bandwidth) sim.set_port_bandwidths(*scenario.bandwidth);
+                if (scenario.capacity) sim.set_node_capacities(*scenario.capacity);
+                if (scenario.seed) sim.seed(*scenario.seed);
+                sim.set_antithetic(scenario.antithetic);
+                sim.set_demand_variance(spec.demand_variance);
+                return simulate(sim);
+            });
+            if (lock) lock.unlock();
+            results[i] = result;
+
+            auto value_or_model = [](const auto& value) { return value ? std::to_string(*value) : std::string("model"); };
+            std::ostringstream line;
+            line << scenario.id << "; " << scheduler.path() << "; " << value_or_model(scenario.bandwidth) << "; "
+                 << value_or_model(scenario.capacity) << "; " << spec.traces[scenario.trace].value_or("model") << "; "
+                 << value_or_model(scenario.seed) << "; " << std::boolalpha << scenario.antithetic << "; "
+                 << result.did_overflow << "; " << result.max_packets_at_node << "; "
+                 << result.mean_port_utilization << "; " << result.mean_sample_latency << "; "
+                 << result.max_sample_latency << "; " << result.missing_samples << "; \n";
+            std::lock_guard out_lock(out_mutex);
+            out << line.str() << std::flush;
+            std::cerr << "\r" << ++completed << "/" << scenarios.size() << " scenarios" << std::flush;
+        });
+        std::cerr << "\n";
+
+        // Only scenarios with the same seed share their random numbers.
+        if (schedulers.size() > 1 && spec.seeds.size() > 1 && spec.seeds.front()) write_paired_differences(std::cout, spec, results);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include "schedulers/ext/ext.hpp"
+
+/*
+    A binary traffic trace: the ingress amount of every flow at every step, memory-mapped and read in step order.
+    Little-endian layout (written by rossa cppsim.write_traffic_trace):
+        char magic[8] = "RSTRACE1"
+        uint32 num_flows
+        uint32 reserved (0)
+        uint64 num_steps
+        int32 amounts[num_steps][num_flows]
+    As amount_over_time, the trace repeats when a simulation is longer than it.
+*/
+class TrafficTrace {
+public:
+    static constexpr char MAGIC[8] = {'R', 'S', 'T', 'R', 'A', 'C', 'E', '1'};
+    static constexpr std::size_t HEADER_SIZE = 24;
+
+    explicit TrafficTrace(const std::string& path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Could not open traffic trace: " + path);
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < HEADER_SIZE) {
+            close(fd);
+            throw std::runtime_error("Bad traffic trace: " + path);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        mapping_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping_ == MAP_FAILED) throw std::runtime_error("Could not map traffic trace: " + path);
+
+        const auto* bytes = static_cast<const char*>(mapping_);
+        uint32_t num_flows;
+        uint64_t num_steps;
+        std::memcpy(&num_flows, bytes + 8, sizeof(num_flows));
+        std::memcpy(&num_steps, bytes + 16, sizeof(num_steps));
+        if (std::memcmp(bytes, MAGIC, sizeof(MAGIC)) != 0 || num_flows == 0 || num_steps == 0 ||
+            num_steps > static_cast<uint64_t>(std::numeric_limits<int>::max()) ||
+            size_ != HEADER_SIZE + num_steps * num_flows * sizeof(packet_t)) {
+            munmap(mapping_, size_);
+            throw std::runtime_error("Bad traffic trace: " + path);
+        }
+        num_flows_ = static_cast<flow_t>(num_flows);
+        num_steps_ = static_cast<int>(num_steps);
+        data_ = reinterpret_cast<const packet_t*>(bytes + HEADER_SIZE);
+        madvise(mapping_, size_, MADV_SEQUENTIAL);
+    }
+    ~TrafficTrace() { munmap(mapping_, size_); }
+    TrafficTrace(const TrafficTrace&) = delete;
+    TrafficTrace& operator=(const TrafficTrace&) = delete;
+
+    [[nodiscard]] flow_t num_flows() const { return num_flows_; }
+    [[nodiscard]] int num_steps() const { return num_steps_; }
+    [[nodiscard]] packet_t amount(int step, flow_t flow) const {
+        return data_[static_cast<std::size_t>(step) * num_flows_ + flow];
+    }
+
+private:
+    void* mapping_ = nullptr;
+    std::size_t size_ = 0;
+    const packet_t* data_ = nullptr;
+    flow_t num_flows_ = 0;
+    int num_steps_ = 0;
+};
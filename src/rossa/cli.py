@@ -5,6 +5,7 @@ import json
 import time
 from random import Random
 import subprocess
+import shutil
 import tempfile
 
 import tomli
@@ -18,6 +19,7 @@ from plumbum import cli, colors, local
 class SimpleTimings:
     def __init__(self) -> None:
         self.times = {}
+        self.stages = None
 
     def start(self, name):
         self.times[name] = [time.monotonic_ns(), None]
@@ -26,8 +28,11 @@ class SimpleTimings:
         self.times[name][1] = time.monotonic_ns()
 
     def asdict(self):
-        """Returns a dictionary with timings in ms"""
-        return {name: (end_ns - start_ns) * 1e-6 for name, (start_ns, end_ns) in self.times.items()}
+        """Returns a dictionary with timings in ms, and the per-stage breakdown of the simulator (if built with stage timing)"""
+        result = {name: (end_ns - start_ns) * 1e-6 for name, (start_ns, end_ns) in self.times.items()}
+        if self.stages is not None:
+            result["stages"] = self.stages
+        return result
 
 
 class BadConfigException(Exception):
@@ -255,7 +260,41 @@ class RotorGenerate(cli.Application, OutputMixin):
         help="Writes global definitions to stdout",
     )
 
+    build_cache = cli.SwitchAttr(
+        ["--build-cache"],
+        str,
+        envname="ROSSA_BUILD_CACHE",
+        default=None,
+        help="Directory for caching simulator binaries built with --fast. Disabled if not set",
+    )
+    traffic_trace = cli.Flag(
+        "--traffic-trace",
+        default=False,
+        help="With --fast, write the ingress amounts to a binary trace (sim-traffic.rtrace) streamed by the simulator instead of compiling them in",
+    )
+    stage_timing = cli.Flag(
+        "--stage-timing",
+        default=False,
+        help="With --fast, build the simulator counting cycles per stage of a phase, written by rossa run into timings.json",
+    )
+    perf_counters = cli.Flag(
+        "--perf-counters",
+        default=False,
+        help="As --stage-timing, also counting instructions, cache misses and branch misses per stage (perf_event_open, if available)",
+    )
+    alloc_tracking = cli.Flag(
+        "--alloc-tracking",
+        default=False,
+        help="As --stage-timing, also counting heap allocations per stage",
+    )
+
     extension_library_name = cli.SwitchAttr(["--ext-name"], str, mandatory=False, default="libcustom.so")
+    static_schedule = cli.SwitchAttr(
+        "--static-schedule",
+        cli.ExistingFile,
+        help="Ask this scheduler library (one declaring static choices, e.g. libfixed.so) for its choices when generating "
+             "and write them into the UPPAAL declarations, which then do not call a library",
+    )
     # traffic_library_name = cli.SwitchAttr(["--traffic-ext-name"], str, mandatory=False, default="libtraffic_gravity_model.so")
     mode = cli.SwitchAttr(["--mode"], str, default="simulation", help="Mode. One of: simulation, verification, smc")
 
@@ -330,36 +369,60 @@ class RotorGenerate(cli.Application, OutputMixin):
         self.diagnostics("Model built")
 
         if self.no_uppaal:
-            file_content = cppsim.write_model_declarations(model, config=self.config)
+            traffic_trace = 'sim-traffic.rtrace' if self.traffic_trace else None
+            file_content = cppsim.write_model_declarations(model, config=self.config, traffic_trace=traffic_trace)
             output_file = local.path(self.output_file)
             output_file.dirname.mkdir()
+            if traffic_trace:
+                cppsim.write_traffic_trace(model, output_file.dirname / traffic_trace)
             if not self.src_dir:
                 self.src_dir = output_file.dirname
             sim_model_path = output_file.dirname / 'sim-model.h'
             with open(sim_model_path, "w") as f:
                 f.write(file_content)
-            build_dir = tempfile.mkdtemp(dir = output_file.dirname)
+            # The same model in the runtime format, such that any simulator binary for this scheduler can run it (sim <file>).
+            with open(output_file.dirname / 'sim-model.txt', "w") as f:
+                f.write(cppsim.write_runtime_model(model, config=self.config))
             scheduler_lib_path = self.src_dir / self.extension_library_name
             # traffic_lib_path = self.src_dir / self.traffic_library_name
-            subprocess.run(f"cmake -DCMAKE_BUILD_TYPE=RelWithDebInfo -S . -B {build_dir} && cmake --build {build_dir} --target sim && mv {build_dir}/sim {output_file} && rm -r {build_dir}", 
-                           env=dict(os.environ, scheduler_lib_path=scheduler_lib_path, sim_model_path=sim_model_path), 
-                           cwd=self.src_dir, shell=True)
+            build_flags = "-DCMAKE_BUILD_TYPE=RelWithDebInfo"
+            if self.stage_timing:
+                build_flags += " -DSIM_STAGE_TIMING=ON"
+            if self.perf_counters:
+                build_flags += " -DSIM_PERF_COUNTERS=ON"
+            if self.alloc_tracking:
+                build_flags += " -DSIM_ALLOC_TRACKING=ON"
+            cache = cppsim.SimBuildCache(self.build_cache) if self.build_cache else None
+            cache_key = cache.key(file_content, scheduler_lib_path, self.src_dir, build_flags) if cache else None
+            if cache and (cached_path := cache.lookup(cache_key)):
+                self.diagnostics(f"Reusing cached simulator {cached_path}")
+                shutil.copy2(cached_path, output_file)
+            else:
+                build_dir = tempfile.mkdtemp(dir = output_file.dirname)
+                subprocess.run(f"cmake {build_flags} -S . -B {build_dir} && cmake --build {build_dir} --target sim && mv {build_dir}/sim {output_file} && rm -r {build_dir}", 
+                               env=dict(os.environ, scheduler_lib_path=scheduler_lib_path, sim_model_path=sim_model_path), 
+                               cwd=self.src_dir, shell=True)
+                if cache and output_file.is_file():
+                    cache.store(cache_key, output_file)
 
         elif self.export_declarations:
             self.diagnostics("Exporting definitions")
-            model_definitions = uppaal.write_model_declarations(model, ext_name=self.extension_library_name)
+            model_definitions = uppaal.write_model_declarations(model, ext_name=self.extension_library_name, static_schedule_lib=self.static_schedule)
             self.output(model_definitions)
             self.diagnostics("Definitions exported")
         else:
             self.diagnostics("Exporting UPPAAL file")
             if self.mode == "simulation":
-                file_content = uppaal.write_simulation_file(model, config=self.config, ext_name=self.extension_library_name)
+                file_content = uppaal.write_simulation_file(model, config=self.config, ext_name=self.extension_library_name,
+                                                            static_schedule_lib=self.static_schedule)
                 write_file_with_mkdir(file_content, self.output_file)
             if self.mode == "verification":
-                file_content = uppaal.write_verification_file(model, config=self.config, ext_name=self.extension_library_name, statistical=False)
+                file_content = uppaal.write_verification_file(model, config=self.config, ext_name=self.extension_library_name, statistical=False,
+                                                              static_schedule_lib=self.static_schedule)
                 write_file_with_mkdir(file_content, self.output_file)
             if self.mode == "smc":
-                file_content = uppaal.write_verification_file(model, config=self.config, ext_name=self.extension_library_name, statistical=True)
+                file_content = uppaal.write_verification_file(model, config=self.config, ext_name=self.extension_library_name, statistical=True,
+                                                              static_schedule_lib=self.static_schedule)
                 write_file_with_mkdir(file_content, self.output_file)
 
     def _parse_config_file(self):
@@ -401,6 +464,72 @@ class RotorRun(cli.Application, OutputMixin):
     output_dir = cli.SwitchAttr(["-o", "--output-dir"], cli.ExistingDirectory)
     log_name = cli.SwitchAttr(["--logfile-name"], str, default="verifyta.log")
     segments_name = cli.SwitchAttr(["--segments-name"], str, default="segments.json")
+    scheduler_lib = cli.SwitchAttr(
+        "--in-process",
+        cli.ExistingFile,
+        help="With --fast, simulate in this process with the given scheduler library. The model file is then the runtime model (sim-model.txt)",
+    )
+    latency_distribution = cli.Flag(
+        "--latency-distribution",
+        default=False,
+        help="With --fast, also write the latency distribution of every packet per flow (from the arrival and departure curves) to latency-distribution.json",
+    )
+    throughput = cli.Flag(
+        "--throughput",
+        default=False,
+        help="With --fast, also write the packets of every flow delivered at its egress in each step to the output, and the "
+             "offered and delivered packets, goodput and time to drain of every flow to throughput.json",
+    )
+    efficiency = cli.Flag(
+        "--efficiency",
+        default=False,
+        help="With --fast, also write where packets and bandwidth went (held back, delivered directly or over several hops, "
+             "unused bandwidth by cause) to efficiency.json",
+    )
+    sampling_precision = cli.SwitchAttr(
+        "--sampling-precision",
+        float,
+        help="With --fast, take latency samples until the confidence interval of --sampling-statistic is within +- this many steps "
+             "(instead of sampling_count), writing the achieved precision to sampling-precision.json",
+    )
+    sampling_statistic = cli.SwitchAttr(
+        "--sampling-statistic",
+        cli.Set("mean", "p99", "max"),
+        default="mean",
+        help="With --sampling-precision: the mean or p99 latency of every flow, or the mean of the largest latency over the flows",
+    )
+    sampling_budget = cli.SwitchAttr("--sampling-budget", int, default=1000, help="With --sampling-precision, the most samples to take")
+    seed = cli.SwitchAttr(
+        "--seed",
+        int,
+        help="With --fast, seed the random draws of the simulator and the scheduler; runs of different schedulers with the same seed "
+             "draw common random numbers",
+    )
+    antithetic = cli.Flag("--antithetic", default=False, help="With --seed, mirror the random draws of the simulator (the antithetic twin run)")
+    demand_variance = cli.SwitchAttr(
+        "--demand-variance",
+        float,
+        help="With --fast, vary every ingress amount uniformly by +- this percentage, drawn per step and flow like the other "
+             "random draws of the simulator",
+    )
+    overflow_probability = cli.SwitchAttr(
+        "--overflow-probability",
+        int,
+        help="With --fast, estimate the probability of an overflow within this many steps (as smc_steps) by multilevel "
+             "splitting, writing it to overflow-probability.json",
+    )
+    splitting_levels = cli.SwitchAttr(
+        "--splitting-levels",
+        str,
+        help="With --overflow-probability, the comma separated levels of the fullest node relative to its capacity",
+    )
+    splitting_effort = cli.SwitchAttr("--splitting-effort", int, default=1000, help="With --overflow-probability, the simulations per level")
+    record_schedule = cli.SwitchAttr(
+        "--record-schedule",
+        str,
+        help="With --fast, write the choices of the scheduler to this schedule trace, which the replay scheduler library "
+             "serves again (REPLAY_SCHEDULE_TRACE)",
+    )
 
     def main(self, env = None):
         self.verbose = True
@@ -415,11 +544,28 @@ class RotorRun(cli.Application, OutputMixin):
         path_segments = self.output_dir / self.segments_name
         timings_path = self.output_dir / "timings.json"
 
-        if self.no_uppaal:
+        result = None
+        if self.no_uppaal and self.scheduler_lib:
+            self.diagnostics("Running simulation in-process")
+            timings.start("simulation")
+            exit_code, sout, serr, result = self._run_in_process(self.model_file, self.scheduler_lib)
+            timings.stop("simulation")
+            self.diagnostics("Running simulation complete")
+        elif self.no_uppaal:
             self.diagnostics("Running simulation")
             timings.start("simulation")
-            exit_code, sout, serr = self._run_cpp(self.model_file)
+            exit_code, sout, serr = self._run_cpp(self.model_file, self._sim_args())
             timings.stop("simulation")
+            timings.stages = cppsim.parse_stage_timings(serr)
+            for name, parse in [("latency-distribution.json", cppsim.parse_latency_distribution),
+                                ("sampling-precision.json", cppsim.parse_sampling_precision),
+                                ("overflow-probability.json", cppsim.parse_overflow_probability),
+                                ("throughput.json", cppsim.parse_throughput),
+                                ("efficiency.json", cppsim.parse_efficiency),
+                                ("scheduler-report.json", cppsim.parse_scheduler_report)]:
+                if (data := parse(serr)) is not None:
+                    with open(self.output_dir / name, "w") as f:
+                        json.dump(data, f)
             self.diagnostics("Running simulation complete")
         else:
             self.diagnostics("Running UPPAAL")
@@ -436,7 +582,9 @@ class RotorRun(cli.Application, OutputMixin):
             self.output(serr, is_error=True)
             return
 
-        if self.no_uppaal:
+        if result is not None:
+            segments = cppsim.sim_result_segments(result)
+        elif self.no_uppaal:
             segments = cppsim.parse_sim_output(sout)
         else:
             segments = [s for s in uppaal.parse_uppaal_output(sout) if s.formula_expr is not None]
@@ -451,10 +599,56 @@ class RotorRun(cli.Application, OutputMixin):
             json.dump(json_obj, f)
         
 
-    def _run_cpp(self, model_path):
-        result = subprocess.run(model_path, capture_output=True, shell=True, text=True, cwd=model_path.dirname, env=self.env)
+    def _sim_args(self) -> list[str]:
+        args = []
+        if self.latency_distribution:
+            args.append("--latency-distribution")
+        if self.throughput:
+            args.append("--throughput")
+        if self.efficiency:
+            args.append("--efficiency")
+        if self.sampling_precision:
+            args += ["--sampling-precision", str(self.sampling_precision), "--sampling-statistic", self.sampling_statistic,
+                     "--sampling-budget", str(self.sampling_budget)]
+        if self.seed is not None:
+            args += ["--seed", str(self.seed)]
+            if self.antithetic:
+                args.append("--antithetic")
+        if self.demand_variance:
+            args += ["--demand-variance", str(self.demand_variance)]
+        if self.overflow_probability:
+            args += ["--overflow-probability", str(self.overflow_probability), "--splitting-effort", str(self.splitting_effort)]
+            if self.splitting_levels:
+                args += ["--splitting-levels", self.splitting_levels]
+        if self.record_schedule:
+            # The binary runs in its own directory.
+            args += ["--record-schedule", str(local.path(self.record_schedule))]
+        return args
+
+    def _run_cpp(self, model_path, args=()):
+        result = subprocess.run([str(model_path), *args], capture_output=True, text=True, cwd=model_path.dirname, env=self.env)
         return result.returncode, result.stdout, result.stderr
 
+    # Options of the sim binary (_sim_args) the in-process simulation does not produce the reports of.
+    _NOT_IN_PROCESS = {"latency_distribution": "--latency-distribution", "throughput": "--throughput",
+                       "efficiency": "--efficiency", "sampling_precision": "--sampling-precision",
+                       "overflow_probability": "--overflow-probability", "record_schedule": "--record-schedule"}
+
+    def _run_in_process(self, model_path, scheduler_lib):
+        unsupported = [switch for name, switch in self._NOT_IN_PROCESS.items() if getattr(self, name)]
+        if unsupported:
+            raise ValueError(f"--in-process cannot be combined with {', '.join(unsupported)}; run without --in-process")
+        try:
+            # The scheduler takes its settings (e.g. CHOICE_APPROACH) from the environment of this run, passed
+            # explicitly: os.environ is shared by the process, and older libraries read it only once.
+            result = cppsim.simulate_file_in_process(model_path, scheduler_lib, seed=self.seed,
+                                                     antithetic=self.antithetic,
+                                                     demand_variance=self.demand_variance or 0.0,
+                                                     settings=self.env)
+            return 0, "", "", result
+        except (RuntimeError, ValueError) as e:
+            return 1, "", str(e), None
+
     def _run_verifyta(self, model_path):
         if not self.uppaal_key:
             raise RuntimeError("UPPAAL key was not supplied")
@@ -1,14 +1,19 @@
 import os
 import re
+import struct
 import csv
 import io
+import hashlib
+import json
+import shutil
+import tempfile
 from collections import defaultdict
 import collections.abc
 from typing import Dict, Literal, Sequence, Tuple, Union, NamedTuple, Mapping, Optional
 from .model import Model
 from .uppaal import data_file_contents, UppaalSegment
 
-__all__ = ['write_model_declarations', 'parse_sim_output']
+__all__ = ['write_model_declarations', 'write_runtime_model', 'write_traffic_trace', 'read_binary_output', 'parse_sim_output', 'parse_latency_distribution', 'parse_sampling_precision', 'SimBuildCache', 'load_scheduler', 'static_schedule', 'simulate_in_process', 'simulate_file_in_process']
 
 DECLARATION_TEMPLATE = "sim-model.h"
 
@@ -34,7 +39,7 @@ def write_array_linestart(data, new_line_depth=1, indentation='', indent_with="
 
 
 
-def apply_substitutions(model: Model, template_declarations: str, config: dict):
+def apply_substitutions(model: Model, template_declarations: str, config: dict, traffic_trace: Optional[str] = None):
     query_config = config.get("query", dict())
     sim_steps = query_config.get('sim_steps', 50)
     sampling_steps = query_config.get('sampling_steps', 200)
@@ -45,7 +50,15 @@ def apply_substitutions(model: Model, template_declarations: str, config: dict):
     gen_port_bandwidths = write_array_linestart((p.bandwidth for p in model.ports), line_suffix='\\')
     gen_topology = write_array(model.topology, line_suffix='\\')
     # gen_flows = write_array([(f.ingress.index, f.egress.index, f.amount) for f in model.flows], line_suffix='\\')
-    gen_flows = write_array([(f.ingress.index, f.egress.index, '{' + ','.join(str(amount) for amount in f.amount_over_time) + '}') for f in model.flows], line_suffix='\\')
+    if traffic_trace:
+        # The amounts are streamed from the trace, so they are left out of the header.
+        max_flow_time = 1
+        gen_flows = write_array([(f.ingress.index, f.egress.index, '{0}') for f in model.flows], line_suffix='\\')
+        traffic_trace_definition = f'#define ROSSA_TRAFFIC_TRACE "{traffic_trace}"'
+    else:
+        max_flow_time = model.get_max_flow_time()
+        gen_flows = write_array([(f.ingress.index, f.egress.index, '{' + ','.join(str(amount) for amount in f.amount_over_time) + '}') for f in model.flows], line_suffix='\\')
+        traffic_trace_definition = '// Ingress amounts are in ROSSA_GEN_FLOWS.'
     # Add random sampling variances.
     # flow_config = config.get('flow', dict())
     # sampling_demand_variance_percent = flow_config.get('sampling_demand_variance_percent', 0)
@@ -61,7 +74,7 @@ def apply_substitutions(model: Model, template_declarations: str, config: dict):
     substitutions = {
         'NUM_NODES': model.num_nodes,
         'NUM_FLOWS': model.num_flows,
-        'MAX_FLOW_TIME': model.get_max_flow_time(),
+        'MAX_FLOW_TIME': max_flow_time,
         'NUM_PHASES': model.num_phases,
         # 'NUM_PORTS': model.num_ports,
         'NUM_SWITCHES': model.num_switches,
@@ -70,6 +83,7 @@ def apply_substitutions(model: Model, template_declarations: str, config: dict):
         'GEN_PORT_BANDWIDTHS': gen_port_bandwidths,
         'GEN_TOPOLOGY': gen_topology,
         'GEN_FLOWS': gen_flows,
+        'TRAFFIC_TRACE_DEFINITION': traffic_trace_definition,
         # 'GEN_SCHEDULE_TOGGLE': gen_schedule_toggle,
         # 'DEMAND_INJECTION': demand_injection,
         # 'EXT_NAME': ext_name,
@@ -83,10 +97,205 @@ def apply_substitutions(model: Model, template_declarations: str, config: dict):
 
     return re.sub(r'<<([^>]+)>>', replace_fn, template_declarations)
 
-def write_model_declarations(model: Model, config: dict) -> str:
+def write_model_declarations(model: Model, config: dict, traffic_trace: Optional[str] = None) -> str:
+    """With traffic_trace, the simulator streams the ingress amounts from that trace file (relative to the binary)."""
     data_file = DECLARATION_TEMPLATE
     template_declarations = data_file_contents(data_file)
-    return apply_substitutions(model, template_declarations, config)
+    return apply_substitutions(model, template_declarations, config, traffic_trace)
+
+TRAFFIC_TRACE_MAGIC = b'RSTRACE1'
+
+def write_traffic_trace(model: Model, path) -> None:
+    """Writes the ingress amounts of all flows in the binary trace format of the simulator (see traffic-trace.hpp)."""
+    num_steps = model.get_max_flow_time()
+    row = struct.Struct(f'<{model.num_flows}i')
+    with open(path, 'wb') as f:
+        f.write(struct.pack('<8sIIQ', TRAFFIC_TRACE_MAGIC, model.num_flows, 0, num_steps))
+        for step in range(num_steps):
+            f.write(row.pack(*(flow.amount_over_time[step] for flow in model.flows)))
+
+SIM_OUTPUT_MAGIC = b'RSIMOUT1'
+
+def read_binary_output(data: bytes) -> dict:
+    """Reads the output of the sim binary run with --binary-output (format in output-writer.hpp) into the arrays
+    returned by simulate_in_process (see RossaData.from_arrays)."""
+    import numpy as np
+    magic, num_nodes, num_ports, num_flows, flags = struct.unpack_from('<8sIIII', data)
+    if magic != SIM_OUTPUT_MAGIC:
+        raise ValueError('Not a binary simulator output')
+    deliveries = bool(flags & 1)  # Run with --throughput.
+    step = np.dtype([('kind', 'u1'), ('step', '<i4'), ('did_overflow', 'u1'),
+                     ('packets_at_node', '<i4', (num_nodes,)), ('port_utilization', '<f8', (num_ports,))]
+                    + ([('delivered_at_egress', '<i4', (num_flows,))] if deliveries else []))
+    sample = np.dtype([('kind', 'u1'), ('sample_id', '<i4'), ('sample_latency', '<i4', (num_flows,))])
+    offset = struct.calcsize('<8sIIII')
+    # The steps, up to the separator record (kind 1), are followed by the samples.
+    num_steps = 0
+    while offset + num_steps * step.itemsize < len(data) and data[offset + num_steps * step.itemsize] == 0:
+        num_steps += 1
+    steps = np.frombuffer(data, dtype=step, count=num_steps, offset=offset)
+    offset += num_steps * step.itemsize + 1
+    samples = np.frombuffer(data, dtype=sample, count=(len(data) - offset) // sample.itemsize, offset=offset)
+    result = {'did_overflow': steps['did_overflow'].astype(bool),
+              'packets_at_node': steps['packets_at_node'].reshape(num_steps, num_nodes),
+              'port_utilization': steps['port_utilization'].reshape(num_steps, num_ports),
+              'sample_latency': samples['sample_latency'].reshape(len(samples), num_flows)}
+    if deliveries:
+        result['delivered_at_egress'] = steps['delivered_at_egress'].reshape(num_steps, num_flows)
+    return result
+
+def write_runtime_model(model: Model, config: dict) -> str:
+    """Writes the model in the format the simulator reads at runtime (see read_model in sim-engine.hpp)."""
+    query_config = config.get("query", dict())
+    sim_steps = query_config.get('sim_steps', 50)
+    sampling_steps = query_config.get('sampling_steps', 200)
+    sampling_count = query_config.get('sampling_count', 50)
+    max_flow_time = max(model.get_max_flow_time(), 1)
+
+    def line(values) -> str:
+        return ' '.join(str(value) for value in values) + '\n'
+
+    result = 'rossa-model 1\n'
+    result += line([model.num_phases, model.num_nodes, model.num_flows, model.num_switches, max_flow_time])
+    result += line([sim_steps, sampling_steps, sampling_count])
+    result += line(n.capacity for n in model.nodes)
+    result += line(p.bandwidth for p in model.ports)
+    for phase_topology in model.topology:
+        result += line(phase_topology)
+    for f in model.flows:
+        result += line([f.ingress.index, f.egress.index] + list(f.amount_over_time))
+    return result
+
+
+def _native():
+    try:
+        import rossa_sim
+    except ImportError as e:
+        raise ImportError("The rossa_sim extension is not available. Build the rossa_sim target of demonstration/CMakeLists.txt "
+                          "(requires pybind11) and add its directory to PYTHONPATH.") from e
+    return rossa_sim
+
+# Loaded schedulers by the real path of their library.
+_schedulers: Dict[str, object] = {}
+
+def load_scheduler(scheduler_lib_path):
+    """Loads a scheduler library for simulate_in_process. Loading the same library again (by any path) returns the same
+    scheduler, whose simulations run one at a time unless it was built with EXT_THREAD_LOCAL_STATE."""
+    path = str(scheduler_lib_path)
+    if os.path.exists(path):  # Else left to dlopen, which searches the library path.
+        path = os.path.realpath(path)
+    scheduler = _schedulers.get(path)
+    if scheduler is None:
+        scheduler = _schedulers.setdefault(path, _native().Scheduler(path))
+    return scheduler
+
+def _as_scheduler(scheduler):
+    return scheduler if isinstance(scheduler, _native().Scheduler) else load_scheduler(scheduler)
+
+def simulate_in_process(model: Model, config: dict, scheduler, seed=None, antithetic=False, demand_variance=0.0,
+                        settings: Optional[Mapping[str, str]] = None) -> dict:
+    """Simulates the model in this process, like running the generated sim binary.
+
+    scheduler is a scheduler library path or the result of load_scheduler. seed, antithetic and demand_variance (percent)
+    are the --seed, --antithetic and --demand-variance of the sim binary. settings replace the environment as the
+    settings of the scheduler (e.g. {'CHOICE_APPROACH': 'QUICKEST'}) for this simulation, without touching os.environ,
+    which the scheduler libraries of one process share. Returns numpy arrays:
+    did_overflow[step], packets_at_node[step, node], port_utilization[step, port] and sample_latency[sample, flow]."""
+    query_config = config.get("query", dict())
+    return _native().simulate(_as_scheduler(scheduler),
+                              num_phases=model.num_phases,
+                              num_switches=model.num_switches,
+                              node_capacities=[n.capacity for n in model.nodes],
+                              port_bandwidths=[p.bandwidth for p in model.ports],
+                              topology=[list(phase_topology) for phase_topology in model.topology],
+                              flows=[(f.ingress.index, f.egress.index) for f in model.flows],
+                              amounts=[list(f.amount_over_time) for f in model.flows],
+                              sim_steps=query_config.get('sim_steps', 50),
+                              sampling_steps=query_config.get('sampling_steps', 200),
+                              sampling_count=query_config.get('sampling_count', 50),
+                              seed=seed, antithetic=antithetic, demand_variance=demand_variance,
+                              settings=dict(settings) if settings is not None else None)
+
+def static_schedule(model: Model, scheduler) -> list[list[int]]:
+    """The choices (extGetScheduleChoiceAll) of a scheduler whose choices in a phase never change (e.g. fixed), per
+    phase a list of num_nodes * num_flows * (num_switches + 1) weights. Raises ValueError for a scheduler that does not
+    declare them static (extStaticSchedule, see demonstration/static-schedule.hpp)."""
+    table = _native().static_schedule(_as_scheduler(scheduler),
+                                      num_phases=model.num_phases,
+                                      num_switches=model.num_switches,
+                                      node_capacities=[n.capacity for n in model.nodes],
+                                      port_bandwidths=[p.bandwidth for p in model.ports],
+                                      topology=[list(phase_topology) for phase_topology in model.topology],
+                                      flows=[(f.ingress.index, f.egress.index) for f in model.flows])
+    return table.tolist()
+
+def simulate_file_in_process(model_path, scheduler, traffic_trace=None, seed=None, antithetic=False, demand_variance=0.0,
+                             settings: Optional[Mapping[str, str]] = None) -> dict:
+    """As simulate_in_process, for a runtime model file (sim-model.txt) written by rossa generate --fast.
+    With traffic_trace, the ingress amounts are read from that trace (write_traffic_trace)."""
+    return _native().simulate_file(_as_scheduler(scheduler), str(model_path), str(traffic_trace) if traffic_trace else None,
+                                   seed=seed, antithetic=antithetic, demand_variance=demand_variance,
+                                   settings=dict(settings) if settings is not None else None)
+
+
+class SimBuildCache:
+    """Content-addressed cache of simulator binaries.
+
+    A binary is keyed by the generated model header, the scheduler library, the sources in the source directory and
+    the build flags, so identical model and scheduler combinations are only compiled once. Paths enter the key relative
+    to the source directory, so the same checkout in another place or the same library under another path hits."""
+
+    # The files of the source directory that may affect the binary.
+    SOURCE_SUFFIXES = ('.hpp', '.cpp', '.h')
+    SOURCE_NAMES = ('CMakeLists.txt',)
+    # Directories of the source directory that do not: the extracted Boost of the schedulers.
+    SKIP_DIRECTORIES = ('boost_graph',)
+
+    def __init__(self, directory):
+        self.directory = os.path.abspath(str(directory))
+
+    @classmethod
+    def sources(cls, src_dir) -> list[str]:
+        """Every C++ source and CMake file below src_dir, relative to it and sorted. Hidden directories, CMake build trees
+        (holding a CMakeCache.txt) and SKIP_DIRECTORIES are skipped."""
+        src_dir = str(src_dir)
+        sources = []
+        for root, dirs, files in os.walk(src_dir):
+            dirs[:] = [d for d in dirs if not d.startswith('.') and d not in cls.SKIP_DIRECTORIES
+                       and not os.path.isfile(os.path.join(root, d, 'CMakeCache.txt'))]
+            for name in files:
+                if name.endswith(cls.SOURCE_SUFFIXES) or name in cls.SOURCE_NAMES:
+                    sources.append(os.path.relpath(os.path.join(root, name), src_dir).replace(os.sep, '/'))
+        return sorted(sources)
+
+    def key(self, model_header: str, scheduler_lib_path, src_dir, build_flags: str) -> str:
+        h = hashlib.sha256()
+        h.update(model_header.encode())
+        files = [('scheduler library', str(scheduler_lib_path))]
+        files += [(source, os.path.join(str(src_dir), source)) for source in self.sources(src_dir)]
+        for name, path in files:
+            h.update(name.encode() + b'\0')
+            if os.path.isfile(path):
+                with open(path, 'rb') as f:
+                    h.update(hashlib.sha256(f.read()).digest())
+        h.update(' '.join([build_flags, os.environ.get('CXX', ''), os.environ.get('CXXFLAGS', '')]).encode())
+        return h.hexdigest()
+
+    def _path(self, key: str) -> str:
+        return os.path.join(self.directory, key[:2], key)
+
+    def lookup(self, key: str) -> Optional[str]:
+        path = self._path(key)
+        return path if os.path.isfile(path) else None
+
+    def store(self, key: str, binary_path) -> None:
+        path = self._path(key)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        # Copy then rename, such that concurrent builders of the same key never see a partial binary.
+        fd, tmp_path = tempfile.mkstemp(dir=os.path.dirname(path))
+        os.close(fd)
+        shutil.copy2(str(binary_path), tmp_path)
+        os.replace(tmp_path, path)
 
 
 Points2D = Sequence[Tuple[float, float]]
@@ -164,6 +373,18 @@ class RossaData(NamedTuple):
                          port_utilizations = {key: sorted(values, key = lambda x: x[0]) for key, values in port_utilizations.items()},
                          flow_samples = flow_samples)
     @classmethod
+    def from_arrays(cls, result: dict) -> "RossaData":
+        """From the arrays returned by simulate_in_process."""
+        steps = range(len(result['did_overflow']))
+        packets_at_node = result['packets_at_node'].T.astype(float).tolist()
+        port_utilization = result['port_utilization'].T.tolist()
+        sample_latency = result['sample_latency'].T.astype(float).tolist()
+        return RossaData(did_overflow = list(zip(steps, result['did_overflow'].tolist())),
+                         packets_at_nodes = {f'packetsAtNode({node})': list(zip(steps, values)) for node, values in enumerate(packets_at_node)},
+                         port_utilizations = {f'portUtilization({port})': list(zip(steps, values)) for port, values in enumerate(port_utilization)},
+                         flow_samples = {f'sampleLatency[{flow}]': values for flow, values in enumerate(sample_latency)})
+
+    @classmethod
     def from_csv_str(cls, csv_string: str) -> "RossaData":
         splits = csv_string.split('@@@\n', maxsplit=1)
         port_and_node_string = splits[0]
@@ -214,5 +435,64 @@ class RossaData(NamedTuple):
         return [query_sim_packets_at_node, query_sim_sampled_latency, query_sim_port_utilization]
 
 
+STAGE_TIMINGS_PREFIX = 'stage-timings: '
+LATENCY_DISTRIBUTION_PREFIX = 'latency-distribution: '
+SAMPLING_PRECISION_PREFIX = 'sampling-precision: '
+OVERFLOW_PROBABILITY_PREFIX = 'overflow-probability: '
+EFFICIENCY_PREFIX = 'efficiency: '
+THROUGHPUT_PREFIX = 'throughput: '
+SCHEDULER_REPORT_PREFIX = 'scheduler-report: '
+
+def _parse_stderr_json(stderr: str, prefix: str):
+    for line in stderr.splitlines():
+        if line.startswith(prefix):
+            return json.loads(line[len(prefix):])
+    return None
+
+def parse_stage_timings(stderr: str) -> Optional[dict]:
+    """The cycles and estimated ms per stage of the simulator, if it was built with stage timing (rossa generate
+    --fast --stage-timing): {stage: {"cycles": int, "ms": float}}."""
+    return _parse_stderr_json(stderr, STAGE_TIMINGS_PREFIX)
+
+def parse_latency_distribution(stderr: str) -> Optional[list]:
+    """The latency distribution of every flow from the arrival and departure curves, if the simulator was run with
+    --latency-distribution (see latency-curves.hpp): [{"delivered", "in_flight", "mean", "p50", "p90", "p99", "max",
+    "histogram": [packets with latency 0, 1, ...]}] indexed by flow."""
+    return _parse_stderr_json(stderr, LATENCY_DISTRIBUTION_PREFIX)
+
+def parse_sampling_precision(stderr: str) -> Optional[dict]:
+    """The achieved precision of the latency samples, if the simulator was run with --sampling-precision (see
+    adaptive-sampling.hpp): {"statistic", "confidence", "target_half_width", "samples", "converged",
+    "estimates": [{"value", "half_width", "samples", "undelivered"}]} with estimates per flow (one for "max")."""
+    return _parse_stderr_json(stderr, SAMPLING_PRECISION_PREFIX)
+
+def parse_overflow_probability(stderr: str) -> Optional[dict]:
+    """The overflow probability estimated by splitting, if the simulator was run with --overflow-probability (see
+    rare-event.hpp): {"steps", "probability", "relative_error", "confidence", "interval", "simulated_steps",
+    "monte_carlo_steps", "stages": [{"level", "trials", "hits", "steps"}]}."""
+    return _parse_stderr_json(stderr, OVERFLOW_PROBABILITY_PREFIX)
+
+def parse_throughput(stderr: str) -> Optional[list]:
+    """The throughput of every flow, if the simulator was run with --throughput (see flow-throughput.hpp):
+    [{"offered", "delivered", "delivered_ratio", "goodput", "goodput_steady", "backlog", "time_to_drain"}] indexed by
+    flow. The goodput of every step is in the output (deliveredAtEgress columns, delivered_at_egress of
+    read_binary_output)."""
+    return _parse_stderr_json(stderr, THROUGHPUT_PREFIX)
+
+def parse_efficiency(stderr: str) -> Optional[dict]:
+    """Where the packets and the bandwidth of the simulation went, if the simulator was run with --efficiency (see
+    efficiency-counters.hpp): {"steps", "total", "phases", "unused_per_port"} with counters {"held", "rate_limited",
+    "sent", "delivered_direct", "delivered_indirect", "forwarded", "bandwidth", "unused_idle", "unused_self_loop",
+    "unused_truncation"} in total and per phase of the cycle."""
+    return _parse_stderr_json(stderr, EFFICIENCY_PREFIX)
+
+def parse_scheduler_report(stderr: str) -> Optional[dict]:
+    """The counters the scheduler kept over the simulation (extSchedulerReport), if it kept any, e.g.
+    {"bounded_acceptance": {"acceptances", "truncated", "iterations", "accepted"}} of a bounded RotorLB."""
+    return _parse_stderr_json(stderr, SCHEDULER_REPORT_PREFIX)
+
 def parse_sim_output(data: str) -> list[UppaalSegment]:
     return RossaData.from_csv_str(data).to_uppaal_segments()
+
+def sim_result_segments(result: dict) -> list[UppaalSegment]:
+    return RossaData.from_arrays(result).to_uppaal_segments()
@@ -26,21 +26,26 @@ const node_t TOPOLOGY[NUM_PHASES][port_t] = <<GEN_TOPOLOGY>>;
 const Flow FLOWS[flow_t] = <<GEN_FLOWS>>;
 
 /*** STATE ***/
+// Code between //#if SAMPLING and //#endif is left out of the declarations for verification, so only the buffers, the
+// phase counters and gDidOverflow are stored (and hashed) in every explored state. Likewise STATIC_SCHEDULE and
+// EXTERNAL_SCHEDULER select between baked-in choices of the scheduler and calling its library.
 bool gDidOverflow = false;  // Whether any port at any time overflowed
 int gCurrentPhase = 0;      // Current phase of the system (will cycle).
-int gCurrentStep = 0;  // Non-cyclic phase step counter.
 int gCurrentFlowStep = 0;
 packet_t gNodeBuffers[BUFFER_SIZE];
-packet_t gPortSent[port_t];
+<<PORT_SENT_QUALIFIER>>packet_t gPortSent[port_t];  // Sent in the last phase, not part of the state in verification.
 meta packet_t maxSendFromPortInPhase = 0;
 
 // Sampling
-bool sampling = <<ENABLE_SAMPLING>>;  // You need to disable sampling to perform verification.
+const bool sampling = <<ENABLE_SAMPLING>>;  // Disabled (and the sampling left out) for verification and SMC.
+//#if SAMPLING
+int gCurrentStep = 0;  // Non-cyclic phase step counter.
 int sampleIntroIndex[flow_t]; // The sampled packets place in queue outside network (num rounds before it starts)
 int sampleEntryStep[flow_t];
 int32_t sampleNodePosition[flow_t]; // The position of the packet in the flow (num packets before it)
 int sampleNode[flow_t]; // The node it is in.
 int sampleLatency[flow_t];  // The result latency.
+//#endif
 
 port_t port_of(node_t node, switch_t sw) { return node * NUM_SWITCHES + sw; }
 node_t port_owner(port_t port) { return port / NUM_SWITCHES; }
@@ -52,6 +57,12 @@ void set_buffer(node_t node, flow_t flow, packet_t value) {
     gNodeBuffers[node * NUM_FLOWS + flow] = value;
 }
 
+//#if STATIC_SCHEDULE
+// The choices of a scheduler that does not look at the buffers, asked from it when generating instead of calling it.
+const packet_t SCHEDULE_CHOICES[NUM_PHASES][SCHEDULE_SIZE] = <<GEN_SCHEDULE_CHOICES>>;
+//#endif
+
+//#if EXTERNAL_SCHEDULER
 /*** EXT INTERFACE ***/
 import "./<<EXT_NAME>>" {
     void extPushNetwork(int32_t num_phases, int32_t num_nodes, int32_t num_flows, int32_t num_switches,
@@ -86,6 +97,7 @@ void __ON_BEGIN__() {
     // Let the scheduler initialize itself
     extSchedulerInit();
 }
+//#endif
 
 /*** CONSTRAINTS ***/
 
@@ -106,6 +118,7 @@ bool verifyConstraints() {
 /*** TRANSITION ***/
 
 void setup() {
+//#if SAMPLING
     if (sampling) {
         // Hardcoded assume 50 steps for good enough stabilisation
         const double fStepsToStable = 50.0;
@@ -117,8 +130,10 @@ void setup() {
             sampleIntroIndex[flow] = fint(fStepsToStable + random(fStepsToStable));
         }
     }
+//#endif
 }
 
+//#if SAMPLING
 /** SAMPLING **/
 
 double maxSampleLatency() {
@@ -178,6 +193,7 @@ void samplePortTransfer(flow_t flow, node_t destNode, packet_t amountSendNode, p
         }
     }
 }
+//#endif
 
 /** NORMAL UPDATE **/
 
@@ -218,9 +234,11 @@ void nextPhase() {
     if (gCurrentFlowStep == MAX_FLOW_TIME) {
         gCurrentFlowStep = 0;
     }
+//#if SAMPLING
     if (sampling) {
         gCurrentStep += 1;
     }
+//#endif
 }
 
 bool validNodeState(node_t n) {
@@ -254,8 +272,10 @@ void simulatePhase() {
     packet_t sentNode[node_t][flow_t];
     packet_t schedule[flow_t][switch_t];
 
+//#if EXTERNAL_SCHEDULER
     packet_t schedule_choice_output[SCHEDULE_SIZE];
     extGetScheduleChoiceAll(phase, gNodeBuffers, schedule_choice_output);
+//#endif
 
     // Calculate sent (only relevant for current phase 'i')
     for (node: node_t) {
@@ -270,9 +290,9 @@ void simulatePhase() {
             packet_t buffered = get_buffer(node, flow);
             packet_t weights[switch_t];
             packet_t s = 0;
-            packet_t dummy_weight = schedule_choice_output[(node * NUM_FLOWS + flow) * (NUM_SWITCHES + 1)];  // a dummy switch to allow not attempting to send all buffered packets in the flow.
+            packet_t dummy_weight = <<SCHEDULE_CHOICE>>[(node * NUM_FLOWS + flow) * (NUM_SWITCHES + 1)];  // a dummy switch to allow not attempting to send all buffered packets in the flow.
             for (sw: switch_t) {
-                packet_t choice_weight = schedule_choice_output[(node * NUM_FLOWS + flow) * (NUM_SWITCHES + 1) + sw + 1];
+                packet_t choice_weight = <<SCHEDULE_CHOICE>>[(node * NUM_FLOWS + flow) * (NUM_SWITCHES + 1) + sw + 1];
                 weights[sw] = choice_weight;
                 s += choice_weight;
             }
@@ -372,6 +392,7 @@ void simulatePhase() {
         }
     }
 
+//#if SAMPLING
     if (sampling) {
         // Must be here after buffers are modified, but before new ingress.
         for (flow : flow_t) {
@@ -394,15 +415,18 @@ void simulatePhase() {
             }
         }
     }
+//#endif
 
     // Add ingress
     for (flow : flow_t) {
         const node_t node = FLOWS[flow].ingress;
         packet_t amount = FLOWS[flow].<<AMOUNT>>;
         set_buffer(node, flow, get_buffer(node, flow) + amount);
+//#if SAMPLING
         if (sampling) {
             sampleIngressAdded(flow, amount);
         }
+//#endif
     }
     updateValidState();
     nextPhase();
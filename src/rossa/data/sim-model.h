@@ -7,6 +7,7 @@
 #define ROSSA_GEN_PORT_BANDWIDTHS <<GEN_PORT_BANDWIDTHS>>
 #define ROSSA_GEN_TOPOLOGY <<GEN_TOPOLOGY>>
 #define ROSSA_GEN_FLOWS <<GEN_FLOWS>>
+<<TRAFFIC_TRACE_DEFINITION>>
 
 #define ROSSA_SIM_STEPS <<SIM_STEPS>>
 #define ROSSA_SAMPLING_STEPS <<SAMPLING_STEPS>>
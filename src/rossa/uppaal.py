@@ -19,9 +19,12 @@ XML_CHARS_REPLACE = {
     '&': '&amp;'
 }
 RE_XLM_CHARS = re.compile(f'[${"".join(XML_CHARS_REPLACE.keys())}]')
+# Lines of the declaration template only kept when the condition (SAMPLING, STATIC_SCHEDULE, ...) holds.
+RE_CONDITIONAL_SECTION = re.compile(r'^[ \t]*//#if (\w+)\n(.*?)^[ \t]*//#endif\n', flags=re.MULTILINE | re.DOTALL)
 
 
-def apply_substitutions(model: Model, template_declarations: str, ext_name: str, enable_sampling = True):
+def apply_substitutions(model: Model, template_declarations: str, ext_name: str, enable_sampling = True,
+                        static_schedule: Optional[Sequence[Sequence[int]]] = None):
     # port_owners = write_array_linestart(p.owner.index for p in model.ports)
     gen_node_capacities = write_array_linestart(n.capacity for n in model.nodes)
     gen_port_bandwidths = write_array_linestart(p.bandwidth for p in model.ports)
@@ -59,28 +62,47 @@ typedef struct {
         'EXT_NAME': ext_name,
         'FLOW_STRUCT': flow_struct,
         'AMOUNT': amount,
-        'ENABLE_SAMPLING': "true" if enable_sampling else "false"
+        'ENABLE_SAMPLING': "true" if enable_sampling else "false",
+        # Written every phase but only read by simulation queries, so verification does not tell states apart by it.
+        'PORT_SENT_QUALIFIER': "" if enable_sampling else "meta ",
+        'GEN_SCHEDULE_CHOICES': write_array(static_schedule) if static_schedule is not None else '',
+        'SCHEDULE_CHOICE': 'SCHEDULE_CHOICES[phase]' if static_schedule is not None else 'schedule_choice_output',
+    }
+    conditions = {
+        'SAMPLING': enable_sampling,
+        'STATIC_SCHEDULE': static_schedule is not None,
+        'EXTERNAL_SCHEDULER': static_schedule is None,
     }
 
     def replace_fn(matchobj):
         return str(substitutions[matchobj.group(1)])
 
+    # Without sampling (verification and SMC), the sampling state and code are left out, keeping the state vector to
+    # the buffers, the phase counters and gDidOverflow. With a static schedule the scheduler library is not imported.
+    template_declarations = RE_CONDITIONAL_SECTION.sub(lambda m: m.group(2) if conditions[m.group(1)] else '', template_declarations)
     return re.sub(r'<<([^>]+)>>', replace_fn, template_declarations)
 
 
 def write_model_declarations(
         model: Model,
         ext_name: str,
-        enable_sampling: bool = True) -> str:
+        enable_sampling: bool = True,
+        static_schedule_lib: Optional[str] = None) -> str:
+    """With static_schedule_lib, the choices of that scheduler library (which must declare them static, as fixed does)
+    are asked for when generating and written into the declarations, which then do not call a library."""
     data_file = DECLARATION_TEMPLATE
     template_declarations = data_file_contents(data_file)
-    return apply_substitutions(model, template_declarations, ext_name, enable_sampling = enable_sampling)
+    static_schedule = None
+    if static_schedule_lib:
+        from . import cppsim  # cppsim imports this module.
+        static_schedule = cppsim.static_schedule(model, static_schedule_lib)
+    return apply_substitutions(model, template_declarations, ext_name, enable_sampling = enable_sampling, static_schedule = static_schedule)
 
 
 def escape_xml(text: str) -> str:
     return RE_XLM_CHARS.sub(lambda m: XML_CHARS_REPLACE[m.group(0)], text)
 
-def write_simulation_file(model: Model, config: dict, ext_name: str) -> str:
+def write_simulation_file(model: Model, config: dict, ext_name: str, static_schedule_lib: Optional[str] = None) -> str:
     query_config = config.get("query", dict())
     sim_steps = query_config.get('sim_steps', 50)
     sampling_steps = query_config.get('sampling_steps', 200)
@@ -106,10 +128,11 @@ def write_simulation_file(model: Model, config: dict, ext_name: str) -> str:
         (comment, query) for config_name, comment, query in formula_candidates
         if query_config.get(config_name, False)
     ]
-    return write_file(model, formulas, ext_name=ext_name, enable_sampling=True)
+    return write_file(model, formulas, ext_name=ext_name, enable_sampling=True, static_schedule_lib=static_schedule_lib)
 
 
-def write_verification_file(model: Model, config: dict, ext_name: str, statistical: bool = False) -> str:
+def write_verification_file(model: Model, config: dict, ext_name: str, statistical: bool = False,
+                            static_schedule_lib: Optional[str] = None) -> str:
     if statistical:
         query_config = config.get("query", dict())
         smc_steps = query_config.get('smc_steps', 50)
@@ -122,17 +145,18 @@ def write_verification_file(model: Model, config: dict, ext_name: str, statistic
         # formulas += [(f'Overflow probability {capacity}', f'Pr[#<={smc_steps}]([] maxPacketsBuffered() < {capacity})') for capacity in range(max_capacity // subdivisions, max_capacity+1, max_capacity // subdivisions)]
         # smc_probability = query_config.get('smc_probability', 0.5)
         # formulas += [('Statistically no overflow', f'Pr[#<={smc_steps}]([] !gDidOverflow) >= {smc_probability}')]
-        return write_file(model, formulas, ext_name=ext_name, enable_sampling=False)
+        return write_file(model, formulas, ext_name=ext_name, enable_sampling=False, static_schedule_lib=static_schedule_lib)
     else:
         formulas = [
             ('Overflow Check', 'A[] gDidOverflow == 0')
         ]
-        return write_file(model, formulas, ext_name=ext_name, enable_sampling=False)
+        return write_file(model, formulas, ext_name=ext_name, enable_sampling=False, static_schedule_lib=static_schedule_lib)
 
 
-def write_file(model: Model, formulas: Sequence[Tuple[str,str]], ext_name='libcustom.so', enable_sampling: bool = True) -> str:
+def write_file(model: Model, formulas: Sequence[Tuple[str,str]], ext_name='libcustom.so', enable_sampling: bool = True,
+               static_schedule_lib: Optional[str] = None) -> str:
     uppaal_template = data_file_contents(MODEL_TEMPLATE)
-    declarations = write_model_declarations(model, ext_name, enable_sampling = enable_sampling)
+    declarations = write_model_declarations(model, ext_name, enable_sampling = enable_sampling, static_schedule_lib = static_schedule_lib)
 
     xml_queries = []
     for comment, formula in formulas:
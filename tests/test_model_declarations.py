@@ -0,0 +1,72 @@
+import itertools
+import re
+import unittest
+
+from rossa import uppaal
+from rossa.model import Flow, Model
+
+# What each conditional section of the declaration template declares, so none of it may be referenced once the section
+# is left out.
+SECTION_REFERENCES = {
+    'SAMPLING': re.compile(r'\bsample\w*|\bgCurrentStep\b|\w*SampleLatency\b'),
+    'STATIC_SCHEDULE': re.compile(r'\bSCHEDULE_CHOICES\b'),
+    'EXTERNAL_SCHEDULER': re.compile(r'\bext[A-Z]\w*|\bschedule_choice_output\b|\bimport\b|\b__ON_\w+__'),
+}
+RE_SECTION_MARKER = re.compile(r'^[ \t]*//#(if|endif)\b', flags=re.MULTILINE)
+RE_COMMENT = re.compile(r'//[^\n]*|/\*.*?\*/', flags=re.DOTALL)
+# Top level declarations (not indented) of a type followed by the declared name.
+RE_TOP_LEVEL_DECLARATION = re.compile(r'^(?:const |meta )?\w+ (\w+)\s*[\[(=;]', flags=re.MULTILINE)
+
+
+def small_model() -> Model:
+    model = Model()
+    nodes = [model.add_node(100) for _ in range(3)]
+    for node in nodes:
+        for _ in range(2):
+            model.add_port(node, 10)
+    # Two phases of two switches, port node * 2 + switch.
+    model.topology = [[1, 2, 2, 0, 0, 1], [2, 1, 0, 2, 1, 0]]
+    model.add_flows([Flow(nodes[0], nodes[2], [4]), Flow(nodes[1], nodes[0], [3])])
+    return model
+
+
+def static_schedule(model: Model) -> list[list[int]]:
+    schedule_size = model.num_nodes * model.num_flows * (model.num_switches + 1)
+    return [[1] * schedule_size for _ in range(model.num_phases)]
+
+
+class TestModelDeclarationSections(unittest.TestCase):
+    def setUp(self):
+        self.template = uppaal.data_file_contents(uppaal.DECLARATION_TEMPLATE)
+        self.model = small_model()
+
+    def render(self, sampling: bool, static: bool) -> str:
+        return uppaal.apply_substitutions(self.model, self.template, 'libcustom.so', enable_sampling=sampling,
+                                          static_schedule=static_schedule(self.model) if static else None)
+
+    def test_every_combination(self):
+        for sampling, static in itertools.product([True, False], repeat=2):
+            conditions = {'SAMPLING': sampling, 'STATIC_SCHEDULE': static, 'EXTERNAL_SCHEDULER': not static}
+            with self.subTest(**conditions):
+                declarations = self.render(sampling, static)
+                self.assertIsNone(RE_SECTION_MARKER.search(declarations))
+                self.assertNotIn('<<', declarations)
+                code = RE_COMMENT.sub('', declarations)
+                for condition, references in SECTION_REFERENCES.items():
+                    found = references.findall(code)
+                    if conditions[condition]:
+                        self.assertTrue(found, f'{condition} is kept but nothing of it is in the declarations')
+                    else:
+                        self.assertEqual(found, [], f'{condition} is left out but still referenced')
+
+    def test_references_cover_the_sections(self):
+        sections = uppaal.RE_CONDITIONAL_SECTION.findall(self.template)
+        self.assertEqual({condition for condition, _ in sections}, set(SECTION_REFERENCES))
+        for condition, body in sections:
+            for name in RE_TOP_LEVEL_DECLARATION.findall(RE_COMMENT.sub('', body)):
+                with self.subTest(condition=condition, name=name):
+                    self.assertRegex(name, SECTION_REFERENCES[condition])
+
+
+if __name__ == '__main__':
+    unittest.main()